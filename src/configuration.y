@@ -50,10 +50,13 @@ void	yyerror(struct ocsim_context *, void *, const char *);
 %token	<integer>	INTEGER
 %token	<var>		VAR
 %token	<ip_address>	IP_ADDRESS
+%token	<ip_address>	IP_PREFIX
 
 %token	kw_INCLUDE
 %token	kw_SERVER
 %token	kw_SCENARIO
+%token	kw_TRANSACTION
+%token	kw_STEP
 %token	kw_CASE
 %token	kw_NAME
 %token	kw_VERSION
@@ -64,8 +67,26 @@ void	yyerror(struct ocsim_context *, void *, const char *);
 %token	kw_GENERIC_USER_RANGE
 %token	kw_GENERIC_PASSWORD
 %token	kw_IP_RANGE
+%token	kw_USERS_FILE
 %token	kw_REPEAT
+%token	kw_CHUNK_SIZE
 %token	kw_ATTACHMENT
+%token	kw_GENERATE_BODY
+%token	kw_GENERATE_ATTACHMENT
+%token	kw_LARGE_ATTACHMENT
+%token	kw_PROPERTIES
+%token	kw_NAMED_PROPERTIES
+%token	kw_PROPERTY_PROFILE
+%token	kw_RECIPIENTS
+%token	kw_RECIPIENT_COUNT
+%token	kw_DISTRIBUTION_LIST
+%token	kw_BATCH
+%token	kw_NETWORK
+%token	kw_USERS
+%token	kw_LATENCY
+%token	kw_JITTER
+%token	kw_LOSS
+%token	kw_BANDWIDTH
 %token	kw_FILE_UTF8
 %token	kw_FILE_HTML
 %token	kw_FILE_RTF
@@ -101,6 +122,12 @@ keywords	:
 				ctx->case_el->attachment_count = 0;
 				ctx->case_el->attachments = talloc_array(ctx->case_el, char *, 2);
 			}
+			if (!ctx->transaction_el) {
+				ctx->transaction_el = talloc_zero(ctx->mem_ctx, struct ocsim_transaction);
+			}
+			if (!ctx->network_el) {
+				ctx->network_el = talloc_zero(ctx->mem_ctx, struct ocsim_network);
+			}
 		}
 		| keywords kvalues
 		;
@@ -109,6 +136,8 @@ kvalues		: include
 		| set
 		| server
 		| scenario
+		| transaction
+		| network
 		;
 
 include		:
@@ -121,15 +150,23 @@ include		:
 set		:
 		IDENTIFIER EQUAL STRING
 		{
+			configuration_add_var(ctx, $1, $3);
 		}
 		| IDENTIFIER EQUAL INTEGER
 		{
+			char	*value;
+
+			value = talloc_asprintf(ctx->mem_ctx, "%u", $3);
+			configuration_add_var(ctx, $1, value);
+			talloc_free(value);
 		}
 		| IDENTIFIER EQUAL IDENTIFIER
 		{
+			configuration_add_var(ctx, $1, $3);
 		}
 		| IDENTIFIER EQUAL VAR
 		{
+			configuration_add_var(ctx, $1, configuration_get_var(ctx, $3));
 		}
 		;
 
@@ -190,6 +227,10 @@ server_content	: kw_NAME EQUAL IDENTIFIER SEMICOLON
 		{
 			ctx->server_el->generic_password = talloc_strdup(ctx->server_el, $3);
 		}
+		| kw_USERS_FILE EQUAL STRING SEMICOLON
+		{
+			ctx->server_el->users_file = talloc_strdup(ctx->server_el, $3);
+		}
 		| kw_GENERIC_USER_RANGE EQUAL INTEGER MINUS INTEGER SEMICOLON
 		{
 			if ($5 < $3) {
@@ -204,15 +245,42 @@ server_content	: kw_NAME EQUAL IDENTIFIER SEMICOLON
 		}
 		| kw_IP_RANGE EQUAL IP_ADDRESS MINUS IP_ADDRESS SEMICOLON
 		{
-			ctx->server_el->ip_start = configuration_get_ip(ctx->mem_ctx, $3);
-			if (!ctx->server_el->ip_start) {
-				yyerror(ctx, NULL, "Invalid IP address for start range");
+			ctx->server_el->ip_range = configuration_get_ip_range(ctx->mem_ctx, $3, $5);
+			if (!ctx->server_el->ip_range) {
+				yyerror(ctx, NULL, "Invalid IP range");
+			} else {
+				ctx->server_el->ip_number = ctx->server_el->ip_range->count;
 			}
-			ctx->server_el->ip_end   = configuration_get_ip(ctx->mem_ctx, $5);
-			
-			ctx->server_el->ip_number = configuration_get_ip_count(ctx->server_el->ip_start, 
-									       ctx->server_el->ip_end);
+		}
+		| kw_IP_RANGE EQUAL IP_PREFIX SEMICOLON
+		{
+			ctx->server_el->ip_range = configuration_get_ip_prefix(ctx->mem_ctx, $3);
+			if (!ctx->server_el->ip_range) {
+				yyerror(ctx, NULL, "Invalid IP prefix");
+			} else {
+				ctx->server_el->ip_number = ctx->server_el->ip_range->count;
+			}
+		}
+		| kw_IP_RANGE EQUAL STRING SEMICOLON
+		{
+			char	*end;
 
+			/* IPv6 addresses are quoted: "2001:db8::/64" or "2001:db8::10 - 2001:db8::ff" */
+			if (strchr($3, '/')) {
+				ctx->server_el->ip_range = configuration_get_ip_prefix(ctx->mem_ctx, $3);
+			} else if ((end = strchr($3, '-'))) {
+				*end++ = '\0';
+				ctx->server_el->ip_range = configuration_get_ip_range(ctx->mem_ctx,
+										  strtok($3, " \t"),
+										  strtok(end, " \t"));
+			} else {
+				ctx->server_el->ip_range = NULL;
+			}
+			if (!ctx->server_el->ip_range) {
+				yyerror(ctx, NULL, "Invalid IP range");
+			} else {
+				ctx->server_el->ip_number = ctx->server_el->ip_range->count;
+			}
 		}
 		;
 
@@ -242,6 +310,14 @@ scenario_content: kw_NAME EQUAL IDENTIFIER SEMICOLON
 		{
 			ctx->scenario_el->repeat = $3;
 		}
+		| kw_CHUNK_SIZE EQUAL INTEGER SEMICOLON
+		{
+			ctx->scenario_el->chunk_size = talloc_asprintf(ctx->scenario_el, "%u", $3);
+		}
+		| kw_CHUNK_SIZE EQUAL STRING SEMICOLON
+		{
+			ctx->scenario_el->chunk_size = talloc_strdup(ctx->scenario_el, $3);
+		}
 		| scenario_case
 		{
 			configuration_add_generic_scenario_case(ctx->scenario_el, ctx->case_el);
@@ -255,6 +331,101 @@ scenario_content: kw_NAME EQUAL IDENTIFIER SEMICOLON
 		}
 		;
 
+transaction	:
+		kw_TRANSACTION OBRACE transaction_contents EBRACE SEMICOLON
+		{
+			configuration_add_transaction(ctx, ctx->transaction_el);
+			talloc_free(ctx->transaction_el);
+			ctx->transaction_el = talloc_zero(ctx->mem_ctx, struct ocsim_transaction);
+		}
+
+transaction_contents: | transaction_contents transaction_content
+		{
+		}
+		;
+
+transaction_content: kw_NAME EQUAL IDENTIFIER SEMICOLON
+		{
+			ctx->transaction_el->name = talloc_strdup(ctx->transaction_el, $3);
+		}
+		| kw_NAME EQUAL STRING SEMICOLON
+		{
+			ctx->transaction_el->name = talloc_strdup(ctx->transaction_el, $3);
+		}
+		| kw_REPEAT EQUAL INTEGER SEMICOLON
+		{
+			ctx->transaction_el->repeat = $3;
+		}
+		| kw_STEP EQUAL IDENTIFIER SEMICOLON
+		{
+			configuration_add_transaction_step(ctx->transaction_el, $3, NULL);
+		}
+		| kw_STEP EQUAL STRING SEMICOLON
+		{
+			configuration_add_transaction_step(ctx->transaction_el, $3, NULL);
+		}
+		| kw_STEP EQUAL IDENTIFIER COLON STRING SEMICOLON
+		{
+			configuration_add_transaction_step(ctx->transaction_el, $3, $5);
+		}
+		| kw_STEP EQUAL STRING COLON STRING SEMICOLON
+		{
+			configuration_add_transaction_step(ctx->transaction_el, $3, $5);
+		}
+		;
+
+network		:
+		kw_NETWORK OBRACE network_contents EBRACE SEMICOLON
+		{
+			configuration_add_network(ctx, ctx->network_el);
+			talloc_free(ctx->network_el);
+			ctx->network_el = talloc_zero(ctx->mem_ctx, struct ocsim_network);
+		}
+
+network_contents: | network_contents network_content
+		{
+		}
+		;
+
+network_content: kw_NAME EQUAL IDENTIFIER SEMICOLON
+		{
+			ctx->network_el->name = talloc_strdup(ctx->network_el, $3);
+		}
+		| kw_NAME EQUAL STRING SEMICOLON
+		{
+			ctx->network_el->name = talloc_strdup(ctx->network_el, $3);
+		}
+		| kw_USERS EQUAL INTEGER MINUS INTEGER SEMICOLON
+		{
+			if ($5 < $3) {
+				printf("Invalid network users range: start > end\n");
+			} else {
+				ctx->network_el->range_start = $3;
+				ctx->network_el->range_end = $5;
+			}
+		}
+		| kw_LATENCY EQUAL INTEGER SEMICOLON
+		{
+			ctx->network_el->latency = $3;
+		}
+		| kw_JITTER EQUAL INTEGER SEMICOLON
+		{
+			ctx->network_el->jitter = $3;
+		}
+		| kw_LOSS EQUAL INTEGER SEMICOLON
+		{
+			ctx->network_el->loss = talloc_asprintf(ctx->network_el, "%u", $3);
+		}
+		| kw_LOSS EQUAL STRING SEMICOLON
+		{
+			ctx->network_el->loss = talloc_strdup(ctx->network_el, $3);
+		}
+		| kw_BANDWIDTH EQUAL INTEGER SEMICOLON
+		{
+			ctx->network_el->bandwidth = $3;
+		}
+		;
+
 scenario_case	: kw_CASE OBRACE scases EBRACE SEMICOLON
 		{
 		}
@@ -277,6 +448,61 @@ scase		: kw_NAME EQUAL STRING SEMICOLON
 		  ctx->case_el->attachments[ctx->case_el->attachment_count] = talloc_strdup(ctx->case_el->attachments, $3);
 		  ctx->case_el->attachment_count += 1;
 		}
+		| kw_GENERATE_ATTACHMENT EQUAL STRING SEMICOLON
+		{
+			ctx->case_el->generators = talloc_realloc(ctx->case_el, ctx->case_el->generators, char *,
+								  ctx->case_el->generator_count + 1);
+			ctx->case_el->generators[ctx->case_el->generator_count] = talloc_strdup(ctx->case_el->generators, $3);
+			ctx->case_el->generator_count += 1;
+		}
+		| kw_LARGE_ATTACHMENT EQUAL STRING SEMICOLON
+		{
+			ctx->case_el->larges = talloc_realloc(ctx->case_el, ctx->case_el->larges, char *,
+							      ctx->case_el->large_count + 1);
+			ctx->case_el->larges[ctx->case_el->large_count] = talloc_strdup(ctx->case_el->larges, $3);
+			ctx->case_el->large_count += 1;
+		}
+		| kw_PROPERTIES EQUAL INTEGER SEMICOLON
+		{
+			ctx->case_el->property_count = $3;
+		}
+		| kw_NAMED_PROPERTIES EQUAL INTEGER SEMICOLON
+		{
+			ctx->case_el->named_count = $3;
+		}
+		| kw_PROPERTY_PROFILE EQUAL STRING SEMICOLON
+		{
+			ctx->case_el->property_profile = talloc_strdup(ctx->case_el, $3);
+		}
+		| kw_RECIPIENTS EQUAL STRING SEMICOLON
+		{
+			ctx->case_el->recipients = talloc_strdup(ctx->case_el, $3);
+		}
+		| kw_RECIPIENT_COUNT EQUAL INTEGER SEMICOLON
+		{
+			ctx->case_el->recipient_count = $3;
+		}
+		| kw_DISTRIBUTION_LIST EQUAL STRING SEMICOLON
+		{
+			ctx->case_el->lists = talloc_realloc(ctx->case_el, ctx->case_el->lists, char *,
+							     ctx->case_el->list_count + 1);
+			ctx->case_el->lists[ctx->case_el->list_count] = talloc_strdup(ctx->case_el->lists, $3);
+			ctx->case_el->list_count += 1;
+		}
+		| kw_BATCH EQUAL INTEGER SEMICOLON
+		{
+			ctx->case_el->batch = $3;
+		}
+		| kw_GENERATE_BODY EQUAL STRING SEMICOLON
+		{
+			if (ctx->case_el->body_type == OCSIM_BODY_NONE) {
+				ctx->case_el->body_type = OCSIM_BODY_GENERATED;
+				ctx->case_el->body_generator = talloc_strdup(ctx->case_el, $3);
+			} else {
+				printf("%s: %d\n", "body already specificed for this case", ctx->lineno);
+				exit (1);
+			}
+		}
 		| kw_FILE_UTF8 EQUAL STRING SEMICOLON
 		{
 			if (ctx->case_el->body_type == OCSIM_BODY_NONE) {
@@ -25,6 +25,8 @@
    \brief OpenChangeSim configuration API
  */
 
+#include <arpa/inet.h>
+
 #include "src/openchangesim.h"
 
 /**
@@ -53,6 +55,11 @@ _PUBLIC_ int configuration_add_server(struct ocsim_context *ctx,
 	el->realm = talloc_strdup(el, server->realm);
 	el->generic_user = talloc_strdup(el, server->generic_user);
 	el->generic_password = talloc_strdup(el, server->generic_password);
+	el->users_file = talloc_strdup(el, server->users_file);
+	/* Roster profiles are still named after the generic user */
+	if (el->users_file && !el->generic_user) {
+		el->generic_user = talloc_strdup(el, OCSIM_ROSTER_PROFNAME);
+	}
 	el->range = server->range;
 
 	if (el->range == true) {
@@ -63,8 +70,7 @@ _PUBLIC_ int configuration_add_server(struct ocsim_context *ctx,
 		el->range_end = 0;
 	}
 
-	el->ip_start = talloc_steal(el, server->ip_start);
-	el->ip_end = talloc_steal(el, server->ip_end);
+	el->ip_range = talloc_steal(el, server->ip_range);
 
 	el->ip_number = server->ip_number;
 
@@ -74,6 +80,79 @@ _PUBLIC_ int configuration_add_server(struct ocsim_context *ctx,
 }
 
 
+/**
+   \details Parse the chunk_size of a scenario: a size or a comma
+   separated list of sizes to sweep. Sizes are clamped to the largest
+   chunk libmapi accepts.
+
+   \return true on success, otherwise false
+ */
+static bool configuration_parse_chunk_sizes(struct ocsim_scenario *el, const char *value)
+{
+	const char	*p = value;
+	char		*end;
+	unsigned long	size;
+
+	el->chunk_count = 0;
+	if (!value) return true;
+
+	while (*p) {
+		p += strspn(p, " \t,");
+		if (!*p) break;
+		if (*p < '0' || *p > '9' || el->chunk_count == OCSIM_STREAM_MAX_SWEEP) goto error;
+
+		size = strtoul(p, &end, 0);
+		if (!size) goto error;
+		if (size > OCSIM_STREAM_MAX_CHUNK) {
+			DEBUG(0, ("%s: chunk_size %lu clamped to %d\n", el->name, size, OCSIM_STREAM_MAX_CHUNK));
+			size = OCSIM_STREAM_MAX_CHUNK;
+		}
+		el->chunk_sizes[el->chunk_count++] = size;
+		p = end;
+		if (*p && *p != ',' && *p != ' ' && *p != '\t') goto error;
+	}
+
+	return true;
+
+error:
+	el->chunk_count = 0;
+	DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, el->name, DEBUG_ERR_CHUNK_SIZE));
+	return false;
+}
+
+
+static bool configuration_parse_recipients(struct ocsim_scenario_sendmail *sendmail, const char *value)
+{
+	const char	*p;
+	char		*end;
+
+	sendmail->recipient_policy = OCSIM_RECIPIENT_SELF;
+	sendmail->zipf_exponent = OCSIM_RECIPIENTS_DFLT_EXPONENT;
+	if (!value || !strcasecmp(value, OCSIM_RECIPIENTS_SELF)) return true;
+
+	if (!strcasecmp(value, OCSIM_RECIPIENTS_UNIFORM)) {
+		sendmail->recipient_policy = OCSIM_RECIPIENT_UNIFORM;
+		return true;
+	}
+
+	if (!strncasecmp(value, OCSIM_RECIPIENTS_ZIPF, strlen(OCSIM_RECIPIENTS_ZIPF))) {
+		p = value + strlen(OCSIM_RECIPIENTS_ZIPF);
+		if (*p == ':') {
+			sendmail->zipf_exponent = strtod(p + 1, &end);
+			if (end == p + 1 || *end || sendmail->zipf_exponent <= 0) goto error;
+		} else if (*p) {
+			goto error;
+		}
+		sendmail->recipient_policy = OCSIM_RECIPIENT_ZIPF;
+		return true;
+	}
+
+error:
+	DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, value, DEBUG_ERR_RECIPIENTS));
+	return false;
+}
+
+
 /**
    \details Add a scenario parsed from configuration file to the list
    of available scenarios
@@ -115,6 +194,10 @@ _PUBLIC_ int configuration_add_scenario(struct ocsim_context *ctx,
 		el->cases = NULL;
 		el->name = talloc_strdup(el, gscenario->name);
 		el->repeat = gscenario->repeat;
+		if (!configuration_parse_chunk_sizes(el, gscenario->chunk_size)) {
+			talloc_free(el);
+			return OCSIM_ERROR;
+		}
 
 		for (elm = gscenario->case_el, j = 0; elm; elm = elm->next, j++) {
 			element = talloc_zero(el, struct ocsim_scenario_case);
@@ -129,18 +212,62 @@ _PUBLIC_ int configuration_add_scenario(struct ocsim_context *ctx,
 			case OCSIM_BODY_UTF8_INLINE:
 			case OCSIM_BODY_HTML_INLINE:
 				sendmail->body_inline = talloc_strdup(sendmail, elm->body_inline);
+				sendmail->body_inline_length = sendmail->body_inline ? strlen(sendmail->body_inline) : 0;
 				break;
 			case OCSIM_BODY_UTF8_FILE:
 			case OCSIM_BODY_HTML_FILE:
 			case OCSIM_BODY_RTF_FILE:
 				sendmail->body_file = talloc_strdup(sendmail, elm->body_file);
 				break;
+			case OCSIM_BODY_GENERATED:
+				sendmail->body_generator = talloc_strdup(sendmail, elm->body_generator);
+				break;
 			}
 			sendmail->attachment_count = elm->attachment_count;
 			sendmail->attachments = talloc_array(sendmail, char *, sendmail->attachment_count + 2);
 			for (i = 0; i < sendmail->attachment_count; i++) {
 				sendmail->attachments[i] = talloc_strdup(sendmail->attachments, elm->attachments[i]);
 			}
+			sendmail->generator_count = elm->generator_count;
+			sendmail->generators = talloc_array(sendmail, char *, sendmail->generator_count + 1);
+			for (i = 0; i < sendmail->generator_count; i++) {
+				sendmail->generators[i] = talloc_strdup(sendmail->generators, elm->generators[i]);
+			}
+			sendmail->large_count = elm->large_count;
+			sendmail->larges = talloc_array(sendmail, char *, sendmail->large_count + 1);
+			for (i = 0; i < sendmail->large_count; i++) {
+				sendmail->larges[i] = talloc_strdup(sendmail->larges, elm->larges[i]);
+			}
+			sendmail->property_count = elm->property_count;
+			sendmail->named_count = elm->named_count;
+			if (sendmail->property_count + sendmail->named_count > OCSIM_PROPERTY_MAX) {
+				DEBUG(0, ("%s: properties limited to %d\n", el->name, OCSIM_PROPERTY_MAX));
+				if (sendmail->property_count > OCSIM_PROPERTY_MAX) {
+					sendmail->property_count = OCSIM_PROPERTY_MAX;
+				}
+				sendmail->named_count = OCSIM_PROPERTY_MAX - sendmail->property_count;
+			}
+			if (elm->property_profile) {
+				sendmail->property_profile = talloc_strdup(sendmail, elm->property_profile);
+			}
+			if (!configuration_parse_recipients(sendmail, elm->recipients)) {
+				talloc_free(el);
+				return OCSIM_ERROR;
+			}
+			sendmail->recipient_count = elm->recipient_count ? elm->recipient_count : 1;
+			if (sendmail->recipient_count > OCSIM_RECIPIENTS_MAX) {
+				sendmail->recipient_count = OCSIM_RECIPIENTS_MAX;
+			}
+			sendmail->batch = elm->batch ? elm->batch : 1;
+			if (sendmail->batch > OCSIM_BATCH_MAX) {
+				DEBUG(0, ("%s: batch limited to %d\n", el->name, OCSIM_BATCH_MAX));
+				sendmail->batch = OCSIM_BATCH_MAX;
+			}
+			sendmail->list_count = elm->list_count;
+			sendmail->lists = talloc_array(sendmail, char *, sendmail->list_count + 1);
+			for (i = 0; i < sendmail->list_count; i++) {
+				sendmail->lists[i] = talloc_strdup(sendmail->lists, elm->lists[i]);
+			}
 			if (elm->name) {
 				element->name = talloc_strdup(element, elm->name);
 			}  else {
@@ -157,6 +284,10 @@ _PUBLIC_ int configuration_add_scenario(struct ocsim_context *ctx,
 		el->cases = NULL;
 		el->name = talloc_strdup(el, gscenario->name);
 		el->repeat = gscenario->repeat;
+		if (!configuration_parse_chunk_sizes(el, gscenario->chunk_size)) {
+			talloc_free(el);
+			return OCSIM_ERROR;
+		}
 
 		DLIST_ADD_END(ctx->scenarios, el, struct ocsim_scenario *);
 	}
@@ -193,6 +324,9 @@ _PUBLIC_ int configuration_add_generic_scenario_case(struct ocsim_generic_scenar
 	case OCSIM_BODY_RTF_FILE:
 		el->body_file = talloc_strdup(el, gcase->body_file);
 		break;
+	case OCSIM_BODY_GENERATED:
+		el->body_generator = talloc_strdup(el, gcase->body_generator);
+		break;
 	}
 
 	el->attachment_count = gcase->attachment_count;
@@ -201,103 +335,465 @@ _PUBLIC_ int configuration_add_generic_scenario_case(struct ocsim_generic_scenar
 		el->attachments[i] = talloc_strdup(el->attachments, gcase->attachments[i]);
 	}
 
+	el->generator_count = gcase->generator_count;
+	el->generators = talloc_array(el, char *, gcase->generator_count + 1);
+	for (i = 0; i < el->generator_count; i++) {
+		el->generators[i] = talloc_strdup(el->generators, gcase->generators[i]);
+	}
+
+	el->large_count = gcase->large_count;
+	el->larges = talloc_array(el, char *, gcase->large_count + 1);
+	for (i = 0; i < el->large_count; i++) {
+		el->larges[i] = talloc_strdup(el->larges, gcase->larges[i]);
+	}
+
+	el->property_count = gcase->property_count;
+	el->named_count = gcase->named_count;
+	if (gcase->property_profile) {
+		el->property_profile = talloc_strdup(el, gcase->property_profile);
+	}
+
+	if (gcase->recipients) {
+		el->recipients = talloc_strdup(el, gcase->recipients);
+	}
+	el->recipient_count = gcase->recipient_count;
+	el->batch = gcase->batch;
+	el->list_count = gcase->list_count;
+	el->lists = talloc_array(el, char *, gcase->list_count + 1);
+	for (i = 0; i < el->list_count; i++) {
+		el->lists[i] = talloc_strdup(el->lists, gcase->lists[i]);
+	}
+
 	DLIST_ADD_END(gscenario->case_el, el, struct ocsim_generic_scenario_case);
 
 	return OCSIM_SUCCESS;
 }
 
 /**
-   \details Split an IP address represented as a string into an array
-   of uint8_t
+   \details Add a transaction parsed from configuration file to the
+   list of available transactions
 
-   \param mem_ctx pointer to the memory context
-   \param ip_address the ip address to analyze
+   \param ctx pointer to the openchangesim context
+   \param transaction pointer to the current transaction record to be
+   added
 
-   \return pointer to the uint8_t array on success, otherwise NULL
-*/
-uint8_t	*configuration_get_ip(TALLOC_CTX *mem_ctx, const char *ip_address)
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+_PUBLIC_ int configuration_add_transaction(struct ocsim_context *ctx,
+					   struct ocsim_transaction *transaction)
 {
-	int		i;
-	int		index;
-	int		pos;
-	char		*tmp;
-	uint8_t		*ip;
-
-	ip = talloc_array(mem_ctx, uint8_t, 4);
-	for (i = 0, pos = 0, index = 0; i < strlen(ip_address); i++) {
-		if (ip_address[i] == '.') {
-			tmp = talloc_strndup(mem_ctx, &ip_address[pos], i - pos);
-			ip[index] = atoi(tmp);
-			if (ip[index] >= 255) {
-				ip = NULL;
-				goto end;
-			}
-			pos = i + 1;
-			index++;
-			talloc_free(tmp);
+	struct ocsim_transaction	*el;
+	struct ocsim_transaction_step	*step;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+	OCSIM_RETVAL_IF(!transaction, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	if (!transaction->name) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_ERR, DEBUG_ERR_MISSING_NAME));
+		return OCSIM_ERROR;
+	}
+
+	if (!transaction->steps) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, transaction->name, DEBUG_ERR_NO_STEP));
+		return OCSIM_ERROR;
+	}
+
+	/* Ensure the transaction has not already been added */
+	for (el = ctx->transactions; el; el = el->next) {
+		if (el->name && !strcmp(el->name, transaction->name)) {
+			DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, transaction->name, DEBUG_ERR_DUPLICATE_TRANSACTION));
+			return OCSIM_ERROR;
 		}
-		if (index == 3) {
-			break;
+	}
+
+	el = talloc_zero(ctx->mem_ctx, struct ocsim_transaction);
+	el->name = talloc_strdup(el, transaction->name);
+	el->repeat = transaction->repeat;
+	for (step = transaction->steps; step; step = step->next) {
+		configuration_add_transaction_step(el, step->module, step->case_name);
+	}
+
+	DLIST_ADD_END(ctx->transactions, el, struct ocsim_transaction *);
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Add a network conditions group parsed from configuration
+   file
+
+   \param ctx pointer to the openchangesim context
+   \param network pointer to the current network record to be added
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+_PUBLIC_ int configuration_add_network(struct ocsim_context *ctx,
+				       struct ocsim_network *network)
+{
+	struct ocsim_network	*el;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+	OCSIM_RETVAL_IF(!network, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	if (!network->name) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_ERR, DEBUG_ERR_MISSING_NAME));
+		return OCSIM_ERROR;
+	}
+
+	/* netem applies jitter around the delay only */
+	if (network->jitter && !network->latency) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, network->name, DEBUG_ERR_NETWORK_JITTER));
+		return OCSIM_ERROR;
+	}
+
+	/* Ensure the network has not already been added */
+	for (el = ctx->networks; el; el = el->next) {
+		if (!strcmp(el->name, network->name)) {
+			DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, network->name, DEBUG_ERR_DUPLICATE_NETWORK));
+			return OCSIM_ERROR;
 		}
 	}
-	tmp = talloc_strdup(mem_ctx, &ip_address[pos]);
-	ip[index] = atoi(tmp);
-end:
-	talloc_free(tmp);
 
-	return ip;
+	el = talloc_zero(ctx->mem_ctx, struct ocsim_network);
+	el->name = talloc_strdup(el, network->name);
+	el->range_start = network->range_start;
+	el->range_end = network->range_end;
+	el->latency = network->latency;
+	el->jitter = network->jitter;
+	el->loss = network->loss ? talloc_strdup(el, network->loss) : NULL;
+	el->bandwidth = network->bandwidth;
+
+	DLIST_ADD_END(ctx->networks, el, struct ocsim_network *);
+
+	return OCSIM_SUCCESS;
 }
 
+
 /**
-   \details Calculate the available number of IP within the start-end
-   range.
+   \details Append a step to a transaction
 
-   \param start pointer to the uint8 array with starting IP address
-   \param end pointer to the uint8 array with ending IP address
+   \param transaction pointer to the transaction
+   \param module the name of the module to run
+   \param case_name the name of the case to run, NULL for all cases
 
-   \return number of available IP address
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
  */
-uint32_t configuration_get_ip_count(uint8_t *start, uint8_t *end)
+_PUBLIC_ int configuration_add_transaction_step(struct ocsim_transaction *transaction,
+						const char *module,
+						const char *case_name)
 {
-	int	diff;
-	int	count = 0;
-
-	/* sanity checks */
-	if (start[0] > end[0]) return 0;
-	if (start[1] > end[1]) return 0;
-
-	/* X.X.X.X 
-	   | | | |_ 255
-	   | | |___ 65.025
-	   | |_____ 16.581.375
-	   |_______ 4.228.250.625
-
-	   The tool will only supports a maximum of 5.000 concurrent
-	   clients. So we assume (for convenience purposes) that we
-	   will have a class B network max.
-	 */
-	diff = end[2] - start[2];
-	if (diff) {
-		/* This is a class B */
-		count = 256 * (diff + 1);
-		/* value range from 0 to 255
-		 * we counted already a full range
-		 * we have to remove the start value and
-		 * what is left from the end value to 255.
-		 * For instance if start[3] == 0 and end[3] == 255
-		 * we have to remove 0 address we have x set of 256 addresses
-		 */
-		count -= start[3];
-		count -= 255 - end[3];
-		
-		return count;
-	}
-
-	/* This is a class C */
-	diff = end[3] - start[3];
-	if (diff) {
-		return diff + 1;
-	}
-
-	return 0;
+	struct ocsim_transaction_step	*el;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!transaction, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+	OCSIM_RETVAL_IF(!module, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	el = talloc_zero(transaction, struct ocsim_transaction_step);
+	el->module = talloc_strdup(el, module);
+	el->case_name = case_name ? talloc_strdup(el, case_name) : NULL;
+
+	DLIST_ADD_END(transaction->steps, el, struct ocsim_transaction_step *);
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Add or replace a global variable parsed from configuration
+   file
+
+   \param ctx pointer to the openchangesim context
+   \param name the variable name
+   \param value the variable value
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+_PUBLIC_ int configuration_add_var(struct ocsim_context *ctx,
+				   const char *name,
+				   const char *value)
+{
+	struct ocsim_var	*el;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+	OCSIM_RETVAL_IF(!name, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	for (el = ctx->options; el; el = el->next) {
+		if (el->name && !strcmp(el->name, name)) {
+			talloc_free((char *)el->value);
+			el->value = value ? talloc_strdup(el, value) : NULL;
+			return OCSIM_SUCCESS;
+		}
+	}
+
+	el = talloc_zero(ctx->mem_ctx, struct ocsim_var);
+	el->name = talloc_strdup(el, name);
+	el->value = value ? talloc_strdup(el, value) : NULL;
+
+	DLIST_ADD_END(ctx->options, el, struct ocsim_var *);
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Retrieve the value of a global variable
+
+   \param ctx pointer to the openchangesim context
+   \param name the variable name
+
+   \return pointer to the variable value on success, otherwise NULL
+ */
+_PUBLIC_ const char *configuration_get_var(struct ocsim_context *ctx,
+					   const char *name)
+{
+	struct ocsim_var	*el;
+
+	/* Sanity checks */
+	if (!ctx || !ctx->options || !name) return NULL;
+
+	for (el = ctx->options; el; el = el->next) {
+		if (el->name && !strcmp(el->name, name)) {
+			return (const char *) el->value;
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+   \details Retrieve the integer value of a global variable
+
+   \param ctx pointer to the openchangesim context
+   \param name the variable name
+   \param dflt value to return when the variable is not set
+
+   \return the variable value on success, otherwise dflt
+ */
+_PUBLIC_ uint32_t configuration_get_var_int(struct ocsim_context *ctx,
+					    const char *name,
+					    uint32_t dflt)
+{
+	const char	*value;
+
+	value = configuration_get_var(ctx, name);
+	if (!value) return dflt;
+
+	return strtoul(value, NULL, 0);
+}
+
+static int configuration_ip_parse(const char *ip_address, uint8_t *addr)
+{
+	if (inet_pton(AF_INET, ip_address, addr) == 1) return AF_INET;
+	if (inet_pton(AF_INET6, ip_address, addr) == 1) return AF_INET6;
+
+	return AF_UNSPEC;
+}
+
+static void configuration_ip_add(uint8_t *addr, size_t len, uint32_t value)
+{
+	uint64_t	carry = value;
+	int		i;
+
+	for (i = len - 1; i >= 0 && carry; i--) {
+		carry += addr[i];
+		addr[i] = carry & 0xFF;
+		carry >>= 8;
+	}
+}
+
+/**
+   \details Build the IP range between two addresses of the same
+   family
+
+   Ranges larger than 2^32 addresses are truncated.
+
+   \param mem_ctx pointer to the memory context
+   \param start the first IP address of the range
+   \param end the last IP address of the range
+
+   \return pointer to the IP range on success, otherwise NULL
+ */
+struct ocsim_ip_range *configuration_get_ip_range(TALLOC_CTX *mem_ctx, const char *start, const char *end)
+{
+	struct ocsim_ip_range	*range;
+	uint8_t			last[16];
+	uint64_t		count = 0;
+	size_t			len;
+	int			borrow = 0;
+	int			diff;
+	int			i;
+
+	if (!start || !end) return NULL;
+
+	range = talloc_zero(mem_ctx, struct ocsim_ip_range);
+	if (!range) return NULL;
+
+	range->family = configuration_ip_parse(start, range->start);
+	if (range->family == AF_UNSPEC || configuration_ip_parse(end, last) != range->family) {
+		talloc_free(range);
+		return NULL;
+	}
+	len = (range->family == AF_INET) ? 4 : 16;
+
+	/* end - start, saturated to 32 bits */
+	for (i = len - 1; i >= 0; i--) {
+		diff = last[i] - range->start[i] - borrow;
+		borrow = (diff < 0);
+		if (borrow) diff += 256;
+		if (i >= (int) len - 4) {
+			count |= (uint64_t) diff << (8 * (len - 1 - i));
+		} else if (diff) {
+			count = UINT32_MAX;
+		}
+	}
+	if (borrow) {
+		talloc_free(range);
+		return NULL;
+	}
+
+	range->count = (count >= UINT32_MAX) ? UINT32_MAX : count + 1;
+
+	return range;
+}
+
+/**
+   \details Build the IP range of the host addresses within a network
+   prefix such as 10.0.0.0/12 or 2001:db8::/64
+
+   The network and broadcast addresses are excluded for IPv4, the
+   subnet-router anycast address for IPv6. Ranges larger than 2^32
+   addresses are truncated.
+
+   \param mem_ctx pointer to the memory context
+   \param prefix the network prefix
+
+   \return pointer to the IP range on success, otherwise NULL
+ */
+struct ocsim_ip_range *configuration_get_ip_prefix(TALLOC_CTX *mem_ctx, const char *prefix)
+{
+	struct ocsim_ip_range	*range;
+	char			*address;
+	char			*slash;
+	char			*endptr;
+	unsigned long		prefixlen;
+	uint32_t		bits;
+	uint32_t		host;
+	uint64_t		count;
+	uint32_t		i;
+
+	if (!prefix) return NULL;
+
+	range = talloc_zero(mem_ctx, struct ocsim_ip_range);
+	if (!range) return NULL;
+
+	address = talloc_strdup(range, prefix);
+	slash = address ? strchr(address, '/') : NULL;
+	if (!slash) goto error;
+	*slash = '\0';
+
+	range->family = configuration_ip_parse(address, range->start);
+	if (range->family == AF_UNSPEC) goto error;
+	bits = (range->family == AF_INET) ? 32 : 128;
+
+	prefixlen = strtoul(slash + 1, &endptr, 10);
+	if (*endptr || endptr == slash + 1 || prefixlen > bits) goto error;
+	talloc_free(address);
+
+	/* Clear the host bits */
+	for (i = prefixlen; i < bits; i++) {
+		range->start[i / 8] &= ~(0x80 >> (i % 8));
+	}
+
+	host = bits - prefixlen;
+	if (host <= 1) {
+		/* Single address or point-to-point link */
+		range->count = 1 << host;
+		return range;
+	}
+
+	count = (host >= 33) ? ((uint64_t) UINT32_MAX + 2) : ((uint64_t) 1 << host);
+	count -= (range->family == AF_INET) ? 2 : 1;
+	range->count = (count > UINT32_MAX) ? UINT32_MAX : count;
+	configuration_ip_add(range->start, bits / 8, 1);
+
+	return range;
+
+error:
+	talloc_free(range);
+	return NULL;
+}
+
+/**
+   \details Retrieve the IP address at a given index of an IP range
+
+   \param range pointer to the IP range
+   \param index the index of the address in the range
+   \param buf the buffer to write the address to
+   \param len the size of buf
+
+   \return true on success, otherwise false
+ */
+bool configuration_get_ip_at(struct ocsim_ip_range *range, uint32_t index, char *buf, size_t len)
+{
+	uint8_t		addr[16];
+
+	if (!range || index >= range->count) return false;
+
+	memcpy(addr, range->start, sizeof (addr));
+	configuration_ip_add(addr, (range->family == AF_INET) ? 4 : 16, index);
+
+	return inet_ntop(range->family, addr, buf, len) != NULL;
+}
+
+/**
+   \details Cover a slice of an IP range with the smallest set of
+   network prefixes
+
+   \param mem_ctx pointer to the memory context
+   \param range pointer to the IP range
+   \param index the index of the first address of the slice
+   \param count the number of addresses in the slice
+
+   \return NULL terminated array of "address/prefixlen" strings on
+   success, otherwise NULL
+ */
+char **configuration_get_ip_prefixes(TALLOC_CTX *mem_ctx, struct ocsim_ip_range *range,
+				     uint32_t index, uint32_t count)
+{
+	char		**prefixes;
+	char		buf[INET6_ADDRSTRLEN];
+	uint8_t		addr[16];
+	size_t		len;
+	uint32_t	n = 0;
+	uint32_t	k;
+
+	if (!range || !count || index >= range->count) return NULL;
+	if (count > range->count - index) count = range->count - index;
+
+	len = (range->family == AF_INET) ? 4 : 16;
+	memcpy(addr, range->start, sizeof (addr));
+	configuration_ip_add(addr, len, index);
+
+	prefixes = talloc_zero_array(mem_ctx, char *, 1);
+	while (prefixes && count) {
+		/* Largest block starting at addr that fits in the slice */
+		for (k = 0; k < 31 && !(addr[len - 1 - k / 8] & (1 << (k % 8))) &&
+			     ((uint32_t) 1 << (k + 1)) <= count; k++);
+
+		inet_ntop(range->family, addr, buf, sizeof (buf));
+		prefixes = talloc_realloc(mem_ctx, prefixes, char *, n + 2);
+		if (!prefixes) break;
+		prefixes[n++] = talloc_asprintf(prefixes, "%s/%d", buf, (int)(len * 8 - k));
+		prefixes[n] = NULL;
+
+		configuration_ip_add(addr, len, (uint32_t) 1 << k);
+		count -= (uint32_t) 1 << k;
+	}
+
+	return prefixes;
 }
@@ -57,6 +57,9 @@ _PUBLIC_ int configuration_dump_servers(struct ocsim_context *ctx)
 		} else {
 			DEBUG(0, ("\t\t generic user range\t= none - single user\n"));
 		}
+		if (el->users_file) {
+			DEBUG(0, ("\t\t users file\t\t= %s\n", el->users_file));
+		}
 		DEBUG(0, ("\t\t generic password\t= %s\n", 
 			  el->generic_password ? el->generic_password : 
 			  "no password supplied (!!!WARNING!!!)"));
@@ -115,7 +118,11 @@ _PUBLIC_ int configuration_dump_scenarios(struct ocsim_context *ctx)
 
 	for (el = ctx->scenarios; el->next; el = el->next) {
 		DEBUG(0, ("scenario %s {\n", el->name));
-		DEBUG(0, ("\t repeat\t\t= %d\n\n", el->repeat));
+		DEBUG(0, ("\t repeat\t\t= %d\n", el->repeat));
+		for (i = 0; i < el->chunk_count; i++) {
+			DEBUG(0, ("\t chunk_size\t= %d\n", el->chunk_sizes[i]));
+		}
+		DEBUG(0, ("\n"));
 		for (elc = el->cases; elc; elc = elc->next) {
 			DEBUG(0, ("\t case \"%s\" {\n", elc->name));
 			if (!strcasecmp(el->name, SENDMAIL_MODULE_NAME)) {
@@ -144,11 +151,45 @@ _PUBLIC_ int configuration_dump_scenarios(struct ocsim_context *ctx)
 					DEBUG(0, ("\t\t body\t\t\t= RTF FILE\n"));
 					DEBUG(0, ("\t\t filename\t\t= %s\n", sendmail->body_file));
 					break;
+				case OCSIM_BODY_GENERATED:
+					DEBUG(0, ("\t\t body\t\t\t= GENERATED\n"));
+					DEBUG(0, ("\t\t generator\t\t= %s\n", sendmail->body_generator));
+					break;
 				}
 				DEBUG(0, ("\t\t attachments\t\t= %d\n", sendmail->attachment_count));
 				for (i = 0; i < sendmail->attachment_count; i++) {
 					DEBUG(0, ("\t\t attachment\t\t= %s\n", sendmail->attachments[i]));
 				}
+				for (i = 0; i < sendmail->generator_count; i++) {
+					DEBUG(0, ("\t\t generated attachment\t= %s\n", sendmail->generators[i]));
+				}
+				for (i = 0; i < sendmail->large_count; i++) {
+					DEBUG(0, ("\t\t large attachment\t= %s\n", sendmail->larges[i]));
+				}
+				if (sendmail->property_count || sendmail->named_count) {
+					DEBUG(0, ("\t\t properties\t\t= %u standard, %u named (%s)\n",
+						  sendmail->property_count, sendmail->named_count,
+						  sendmail->property_profile ? sendmail->property_profile :
+						  OCSIM_PROPERTY_DFLT_PROFILE));
+				}
+				switch (sendmail->recipient_policy) {
+				case OCSIM_RECIPIENT_SELF:
+					DEBUG(0, ("\t\t recipients\t\t= self\n"));
+					break;
+				case OCSIM_RECIPIENT_UNIFORM:
+					DEBUG(0, ("\t\t recipients\t\t= %u uniform\n", sendmail->recipient_count));
+					break;
+				case OCSIM_RECIPIENT_ZIPF:
+					DEBUG(0, ("\t\t recipients\t\t= %u zipf (exponent %.2f)\n",
+						  sendmail->recipient_count, sendmail->zipf_exponent));
+					break;
+				}
+				for (i = 0; i < sendmail->list_count; i++) {
+					DEBUG(0, ("\t\t distribution list\t= %s\n", sendmail->lists[i]));
+				}
+				if (sendmail->batch > 1) {
+					DEBUG(0, ("\t\t batch\t\t\t= %u messages\n", sendmail->batch));
+				}
 			}
 			DEBUG(0, ("\t };\n\n"));
 		}
@@ -159,6 +200,52 @@ _PUBLIC_ int configuration_dump_scenarios(struct ocsim_context *ctx)
 }
 
 
+_PUBLIC_ int configuration_dump_transactions(struct ocsim_context *ctx)
+{
+	struct ocsim_transaction	*el;
+	struct ocsim_transaction_step	*step;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+
+	for (el = ctx->transactions; el; el = el->next) {
+		DEBUG(0, ("transaction %s {\n", el->name));
+		DEBUG(0, ("\t repeat\t\t= %d\n", el->repeat));
+		for (step = el->steps; step; step = step->next) {
+			if (step->case_name) {
+				DEBUG(0, ("\t step\t\t= %s : \"%s\"\n", step->module, step->case_name));
+			} else {
+				DEBUG(0, ("\t step\t\t= %s\n", step->module));
+			}
+		}
+		DEBUG(0, ("}\n"));
+	}
+
+	return OCSIM_SUCCESS;
+}
+
+
+_PUBLIC_ int configuration_dump_networks(struct ocsim_context *ctx)
+{
+	struct ocsim_network	*el;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+
+	for (el = ctx->networks; el; el = el->next) {
+		DEBUG(0, ("network %s {\n", el->name));
+		DEBUG(0, ("\t users\t\t= %d-%d\n", el->range_start, el->range_end));
+		DEBUG(0, ("\t latency\t= %d ms\n", el->latency));
+		DEBUG(0, ("\t jitter\t\t= %d ms\n", el->jitter));
+		DEBUG(0, ("\t loss\t\t= %s%%\n", el->loss ? el->loss : "0"));
+		DEBUG(0, ("\t bandwidth\t= %d kbit/s\n", el->bandwidth));
+		DEBUG(0, ("}\n"));
+	}
+
+	return OCSIM_SUCCESS;
+}
+
+
 /**
    \details Ensure the specified server exists within the
    configuration, is valid for further processing and return a pointer
@@ -181,7 +268,7 @@ struct ocsim_server *configuration_validate_server(struct ocsim_context *ctx,
 
 	for (el = ctx->servers; el->next; el = el->next) {
 		if (el->name && !strcmp(el->name, server)) {
-			if (el->generic_user && el->generic_password) {
+			if ((el->generic_user && el->generic_password) || el->users_file) {
 				return el;
 			} else {
 				return NULL;
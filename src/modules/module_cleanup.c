@@ -27,41 +27,25 @@
 uint32_t module_cleanup_run(TALLOC_CTX *mem_ctx, struct mapi_session *session)
 {
 	enum MAPISTATUS		retval;
-	mapi_object_t		obj_store;
-	mapi_object_t		obj_folder;
-	mapi_id_t		id;
+	mapi_object_t		*obj_folder;
 	uint32_t		folders[] = { olFolderInbox, olFolderOutbox, olFolderSentMail, 0};
 	int			i;
 
-	/* Log onto the store */
-	mapi_object_init(&obj_store);
-	retval = OpenMsgStore(session, &obj_store);
-	if (retval) {
-		mapi_errstr("OpenMsgStore", GetLastError());
-		return OCSIM_ERROR;
-	}
-
-	/* Open and cleanup folders */
+	/* Open and cleanup folders, cached for the session */
 	for (i = 0; folders[i] != 0; i++) {
-		retval = GetDefaultFolder(&obj_store, &id, folders[i]);
-		if (retval) {
-			mapi_errstr("GetDefaultFolder", GetLastError());
-			return OCSIM_ERROR;
-		}
-
-		mapi_object_init(&obj_folder);
-		retval = OpenFolder(&obj_store, id, &obj_folder);
+		retval = openchangesim_session_folder(NULL, session, folders[i], NULL, &obj_folder);
 		if (retval) {
 			mapi_errstr("OpenFolder", GetLastError());
+			openchangesim_session_invalidate();
 			return OCSIM_ERROR;
 		}
 
-		retval = EmptyFolder(&obj_folder);
+		retval = EmptyFolder(obj_folder);
 		if (retval) {
 			mapi_errstr("EmptyFolder", GetLastError());
+			/* The cached folders may be stale after an error */
+			openchangesim_session_invalidate();
 		}
-
-		mapi_object_release(&obj_folder);
 	}
 
 	return OCSIM_SUCCESS;
@@ -41,19 +41,47 @@ static void *fetchmail_get_propval(struct SRow *aRow,
 }
 
 
+static struct ocsim_scenario	*fetchmail_scenario = NULL;
+
+
+/*
+ * Record the latency, bytes and CPU time of a stream read
+ */
+static void fetchmail_stream_record(uint32_t chunk, struct timeval *tv_start, uint64_t cpu_start,
+				    uint64_t bytes, bool success)
+{
+	struct timeval	tv_end;
+
+	gettimeofday(&tv_end, NULL);
+	openchangesim_stats_record_stream(FETCHMAIL_STATS_STREAM, chunk,
+					  fetchmail_scenario && fetchmail_scenario->chunk_count > 1,
+					  (uint64_t)(tv_end.tv_sec - tv_start->tv_sec) * 1000000 +
+					  (tv_end.tv_usec - tv_start->tv_usec),
+					  bytes, openchangesim_stats_cpu_usec() - cpu_start, success);
+}
+
+
 static enum MAPISTATUS fetchmail_get_stream(TALLOC_CTX *mem_ctx,
 					    mapi_object_t *obj_stream, 
-					    DATA_BLOB *body)
+					    DATA_BLOB *body,
+					    uint32_t chunk)
 {
 	enum MAPISTATUS	retval;
 	uint16_t	read_size;
-	uint8_t		buf[0x1000];
+	uint8_t		buf[OCSIM_STREAM_MAX_CHUNK];
+	struct timeval	tv_start;
+	uint64_t	cpu_start;
 
 	body->length = 0;
 	body->data = talloc_zero(mem_ctx, uint8_t);
 
+	gettimeofday(&tv_start, NULL);
+	cpu_start = openchangesim_stats_cpu_usec();
 	do {
-		retval = ReadStream(obj_stream, buf, 0x1000, &read_size);
+		retval = ReadStream(obj_stream, buf, chunk, &read_size);
+		if (retval) {
+			fetchmail_stream_record(chunk, &tv_start, cpu_start, body->length, false);
+		}
 		MAPI_RETVAL_IF(retval, GetLastError(), body->data);
 		if (read_size) {
 			body->data = talloc_realloc(mem_ctx, body->data, uint8_t,
@@ -62,6 +90,7 @@ static enum MAPISTATUS fetchmail_get_stream(TALLOC_CTX *mem_ctx,
 			body->length += read_size;
 		}
 	} while (read_size);
+	fetchmail_stream_record(chunk, &tv_start, cpu_start, body->length, true);
 
 	errno = 0;
 	return MAPI_E_SUCCESS;
@@ -74,7 +103,8 @@ static enum MAPISTATUS fetchmail_get_stream(TALLOC_CTX *mem_ctx,
 static enum MAPISTATUS fetchmail_get_body(TALLOC_CTX *mem_ctx,
 					  mapi_object_t *obj_message,
 					  struct SRow *aRow,
-					  DATA_BLOB *body)
+					  DATA_BLOB *body,
+					  uint32_t chunk)
 {
 	enum MAPISTATUS			retval;
 	const struct SBinary_short	*bin;
@@ -103,10 +133,9 @@ static enum MAPISTATUS fetchmail_get_body(TALLOC_CTX *mem_ctx,
 			retval = OpenStream(obj_message, PR_BODY_UNICODE, 0, &obj_stream);
 			MAPI_RETVAL_IF(retval, GetLastError(), NULL);
 			
-			retval = fetchmail_get_stream(mem_ctx, &obj_stream, body);
-			MAPI_RETVAL_IF(retval, GetLastError(), NULL);
-			
+			retval = fetchmail_get_stream(mem_ctx, &obj_stream, body, chunk);
 			mapi_object_release(&obj_stream);
+			MAPI_RETVAL_IF(retval, GetLastError(), NULL);
 		}
 		break;
 	case olEditorHTML:
@@ -119,10 +148,9 @@ static enum MAPISTATUS fetchmail_get_body(TALLOC_CTX *mem_ctx,
 			retval = OpenStream(obj_message, PR_HTML, 0, &obj_stream);
 			MAPI_RETVAL_IF(retval, GetLastError(), NULL);
 
-			retval = fetchmail_get_stream(mem_ctx, &obj_stream, body);
-			MAPI_RETVAL_IF(retval, GetLastError(), NULL);
-
+			retval = fetchmail_get_stream(mem_ctx, &obj_stream, body, chunk);
 			mapi_object_release(&obj_stream);
+			MAPI_RETVAL_IF(retval, GetLastError(), NULL);
 		}			
 		break;
 	case olEditorRTF:
@@ -132,9 +160,8 @@ static enum MAPISTATUS fetchmail_get_body(TALLOC_CTX *mem_ctx,
 		MAPI_RETVAL_IF(retval, GetLastError(), NULL);
 
 		retval = WrapCompressedRTFStream(&obj_stream, body);
-		MAPI_RETVAL_IF(retval, GetLastError(), NULL);
-
 		mapi_object_release(&obj_stream);
+		MAPI_RETVAL_IF(retval, GetLastError(), NULL);
 		break;
 	default:
 		DEBUG(0, ("Undefined Body\n"));
@@ -146,7 +173,9 @@ static enum MAPISTATUS fetchmail_get_body(TALLOC_CTX *mem_ctx,
 
 
 static enum MAPISTATUS fetchmail_get_contents(TALLOC_CTX *mem_ctx,
-					      mapi_object_t *obj_message)
+					      mapi_object_t *obj_message,
+					      uint64_t *size,
+					      uint32_t chunk)
 {
 	enum MAPISTATUS			retval;
 	struct SPropTagArray		*SPropTagArray;
@@ -186,9 +215,10 @@ static enum MAPISTATUS fetchmail_get_contents(TALLOC_CTX *mem_ctx,
 	aRow.cValues = count;
 	aRow.lpProps = lpProps;
 
-	retval = fetchmail_get_body(mem_ctx, obj_message, &aRow, &body);
+	retval = fetchmail_get_body(mem_ctx, obj_message, &aRow, &body, chunk);
 	MAPI_RETVAL_IF(retval, GetLastError(), NULL);
 	
+	*size = body.length;
 	if (body.length) {
 		talloc_free(body.data);
 	} 
@@ -197,17 +227,17 @@ static enum MAPISTATUS fetchmail_get_contents(TALLOC_CTX *mem_ctx,
 }
 
 static uint32_t _module_fetchmail_run(TALLOC_CTX *mem_ctx, 
+				      struct ocsim_log *log,
 				      struct mapi_session *session)
 {
 	enum MAPISTATUS		retval;
-	mapi_object_t		obj_store;
-	mapi_object_t		obj_inbox;
+	mapi_object_t		*obj_store;
+	mapi_object_t		*obj_inbox;
 	mapi_object_t		obj_table;
 	mapi_object_t		obj_message;
 	mapi_object_t		obj_table_attach;
 	mapi_object_t		obj_attach;
 	mapi_object_t		obj_stream;
-	uint64_t		id_inbox = 0;
 	struct SPropTagArray	*SPropTagArray;
 	struct SRowSet		SRowSet;
 	struct SRowSet		SRowSet_attach;
@@ -216,43 +246,39 @@ static uint32_t _module_fetchmail_run(TALLOC_CTX *mem_ctx,
 	const uint8_t		*has_attach;
 	const uint32_t		*attach_num;
 	uint16_t		read_size;
-	unsigned char		buf[MAX_READ_SIZE];
-
-	/* Log onto the store */
-	memset(&obj_store, 0, sizeof(mapi_object_t));
-	memset(&obj_inbox, 0, sizeof(mapi_object_t));
-	memset(&obj_table, 0, sizeof(mapi_object_t));
-	memset(&obj_message, 0, sizeof(mapi_object_t));
-	memset(&obj_table_attach, 0, sizeof(mapi_object_t));
-	memset(&obj_attach, 0, sizeof(mapi_object_t));
-	memset(&obj_stream, 0, sizeof(mapi_object_t));
-
-	mapi_object_init(&obj_store);
-	retval = OpenMsgStore(session, &obj_store);
-	if (retval) {
-		mapi_errstr("OpenMsgStore", GetLastError());
-		return OCSIM_ERROR;
-	}
+	unsigned char		buf[OCSIM_STREAM_MAX_CHUNK];
+	uint64_t		msg_size;
+	uint64_t		stream_size;
+	uint64_t		cpu_start;
+	uint32_t		chunk;
+	uint32_t		ret = OCSIM_ERROR;
+	struct timeval		tv_start;
+
+	/* Released on every path, so failed attempts don't leak handles */
+	mapi_object_init(&obj_table);
+	mapi_object_init(&obj_message);
+	mapi_object_init(&obj_table_attach);
+	mapi_object_init(&obj_attach);
+	mapi_object_init(&obj_stream);
 
-	/* Open default receive folder (Inbox) */
-	retval = GetReceiveFolder(&obj_store, &id_inbox, NULL);
+	/* Store and Inbox are cached for the session */
+	retval = openchangesim_session_store(log, session, &obj_store);
 	if (retval) {
-		mapi_errstr("GetReceiveFolder", GetLastError());
+		mapi_errstr("OpenMsgStore", GetLastError());
 		return OCSIM_ERROR;
 	}
 
-	retval = OpenFolder(&obj_store, id_inbox, &obj_inbox);
+	retval = openchangesim_session_folder(log, session, olFolderInbox, NULL, &obj_inbox);
 	if (retval) {
 		mapi_errstr("OpenFolder", GetLastError());
 		return OCSIM_ERROR;
 	}
 
 	/* Open the contents table and customize the view */
-	mapi_object_init(&obj_table);
-	retval = GetContentsTable(&obj_inbox, &obj_table, 0, &count);
+	OCSIM_LOG_CALL(log, retval, GetContentsTable, (obj_inbox, &obj_table, 0, &count));
 	if (retval) {
 		mapi_errstr("GetContentsTable", GetLastError());
-		return OCSIM_ERROR;
+		goto end;
 	}
 
 	SPropTagArray = set_SPropTagArray(mem_ctx, 0x5,
@@ -261,58 +287,57 @@ static uint32_t _module_fetchmail_run(TALLOC_CTX *mem_ctx,
 					  PR_INST_ID,
 					  PR_INSTANCE_NUM,
 					  PR_SUBJECT);
-	retval = SetColumns(&obj_table, SPropTagArray);
+	OCSIM_LOG_CALL(log, retval, SetColumns, (&obj_table, SPropTagArray));
 	MAPIFreeBuffer(SPropTagArray);
 	if (retval) {
 		mapi_errstr("SetColumns", GetLastError());		
-		return OCSIM_ERROR;
+		goto end;
 	}
 
 	/* Retrieve the messages and attachments */
 	while ((retval = QueryRows(&obj_table, count, TBL_ADVANCE, &SRowSet)) != MAPI_E_NOT_FOUND && SRowSet.cRows) {
 		count -= SRowSet.cRows;
 		for (i = 0; i < SRowSet.cRows; i++) {
-			mapi_object_init(&obj_message);
-			retval = OpenMessage(&obj_store,
-					     SRowSet.aRow[i].lpProps[0].value.d,
-					     SRowSet.aRow[i].lpProps[0].value.d,
-					     &obj_message, 0);
+			OCSIM_LOG_CALL(log, retval, OpenMessage, (obj_store,
+								  SRowSet.aRow[i].lpProps[0].value.d,
+								  SRowSet.aRow[i].lpProps[0].value.d,
+								  &obj_message, 0));
 			if (GetLastError() == MAPI_E_SUCCESS) {
 				struct SPropValue	*lpProps;
 				struct SRow		aRow;
 
 				SPropTagArray = set_SPropTagArray(mem_ctx, 0x1, PR_HASATTACH);
 				lpProps = talloc_zero(mem_ctx, struct SPropValue);
-				retval = GetProps(&obj_message, 0, SPropTagArray, &lpProps, &count);
+				OCSIM_LOG_CALL(log, retval, GetProps, (&obj_message, 0, SPropTagArray, &lpProps, &count));
 				MAPIFreeBuffer(SPropTagArray);
 				if (retval) {
 					mapi_errstr("GetProps", GetLastError());
-					return OCSIM_ERROR;
+					goto end;
 				}
 
 				aRow.ulAdrEntryPad = 0;
 				aRow.cValues = count;
 				aRow.lpProps = lpProps;
 
-				retval = fetchmail_get_contents(mem_ctx, &obj_message);
+				msg_size = 0;
+				chunk = openchangesim_module_chunk_size(fetchmail_scenario);
+				OCSIM_LOG_CALL(log, retval, fetchmail_get_contents, (mem_ctx, &obj_message, &msg_size, chunk));
 
 				has_attach = (const uint8_t *) get_SPropValue_SRow_data(&aRow, PR_HASATTACH);
 				if (has_attach && *has_attach) {
-					mapi_object_init(&obj_table_attach);
-					retval = GetAttachmentTable(&obj_message, &obj_table_attach);
+					OCSIM_LOG_CALL(log, retval, GetAttachmentTable, (&obj_message, &obj_table_attach));
 					if (retval == MAPI_E_SUCCESS) {
 						SPropTagArray = set_SPropTagArray(mem_ctx, 0x1, PR_ATTACH_NUM);
 						retval = SetColumns(&obj_table_attach, SPropTagArray);
-						if (retval != MAPI_E_SUCCESS) return retval;
 						MAPIFreeBuffer(SPropTagArray);
+						if (retval != MAPI_E_SUCCESS) goto end;
 
 						retval = QueryRows(&obj_table_attach, 0xA, TBL_ADVANCE, &SRowSet_attach);
-						if (retval != MAPI_E_SUCCESS) return retval;
+						if (retval != MAPI_E_SUCCESS) goto end;
 
 						for (j = 0; j < SRowSet_attach.cRows; j++) {
 							attach_num = (const uint32_t *) find_SPropValue_data(&(SRowSet_attach.aRow[j]), PR_ATTACH_NUM);
-							mapi_object_init(&obj_attach);
-							retval = OpenAttach(&obj_message, *attach_num, &obj_attach);
+							OCSIM_LOG_CALL(log, retval, OpenAttach, (&obj_message, *attach_num, &obj_attach));
 							if (retval == MAPI_E_SUCCESS) {
 								struct SPropValue	*lpProps2;
 								uint32_t		count2;
@@ -324,41 +349,50 @@ static uint32_t _module_fetchmail_run(TALLOC_CTX *mem_ctx,
 								lpProps2 = talloc_zero(mem_ctx, struct SPropValue);
 								retval = GetProps(&obj_attach, 0, SPropTagArray, &lpProps2, &count2);
 								MAPIFreeBuffer(SPropTagArray);
-								if (retval != MAPI_E_SUCCESS) {
-									MAPIFreeBuffer(lpProps2);
-									return retval;
-								}
 								MAPIFreeBuffer(lpProps2);
+								if (retval != MAPI_E_SUCCESS) goto end;
 
-								mapi_object_init(&obj_stream);
-								retval = OpenStream(&obj_attach, PR_ATTACH_DATA_BIN, 0, &obj_stream);
-								if (retval != MAPI_E_SUCCESS) return retval;
+								OCSIM_LOG_CALL(log, retval, OpenStream, (&obj_attach, PR_ATTACH_DATA_BIN, 0, &obj_stream));
+								if (retval != MAPI_E_SUCCESS) goto end;
 
 								read_size = 0;
+								stream_size = 0;
+								gettimeofday(&tv_start, NULL);
+								cpu_start = openchangesim_stats_cpu_usec();
 								do {
-									retval = ReadStream(&obj_stream, buf, MAX_READ_SIZE, &read_size);
+									OCSIM_LOG_CALL(log, retval, ReadStream, (&obj_stream, buf, chunk, &read_size));
 									if (retval != MAPI_E_SUCCESS) break;
+									stream_size += read_size;
 								} while (read_size);
+								fetchmail_stream_record(chunk, &tv_start, cpu_start, stream_size,
+											retval == MAPI_E_SUCCESS);
+								msg_size += stream_size;
 
 								mapi_object_release(&obj_stream);
-								mapi_object_release(&obj_attach);
 							}
+							mapi_object_release(&obj_attach);
 						}
 					}
+					mapi_object_release(&obj_table_attach);
 				}
 
 				MAPIFreeBuffer(lpProps);
+				openchangesim_log_message(log, SRowSet.aRow[i].lpProps[1].value.d, msg_size);
 			}
 			mapi_object_release(&obj_message);
 		}
 	}
 
-	Logoff(&obj_store);
+	ret = OCSIM_SUCCESS;
 
-	/* talloc_free(mem_ctx); */
-	mapi_object_release(&obj_store);
+end:
+	mapi_object_release(&obj_stream);
+	mapi_object_release(&obj_attach);
+	mapi_object_release(&obj_table_attach);
+	mapi_object_release(&obj_message);
+	mapi_object_release(&obj_table);
 
-	return OCSIM_SUCCESS;
+	return ret;
 }
 
 static uint32_t module_fetchmail_run(TALLOC_CTX *mem_ctx, 
@@ -368,12 +402,23 @@ static uint32_t module_fetchmail_run(TALLOC_CTX *mem_ctx,
 	struct ocsim_log	*log;
 	int 			ret;
 	char			*addr;
+	uint32_t		attempt;
 
 	log = openchangesim_log_init(mem_ctx);
 	openchangesim_log_start(log);
 	/* Need to dup the addr because the session is freeed in _module_fetchmail_run */
 	addr = talloc_strdup(mem_ctx, session->profile->localaddr);
-	ret = _module_fetchmail_run(mem_ctx, session);
+	for (attempt = 0; ; attempt++) {
+		ret = _module_fetchmail_run(mem_ctx, log, session);
+		if (ret == OCSIM_SUCCESS) {
+			break;
+		}
+		/* Cached objects may be stale after an error */
+		openchangesim_session_invalidate();
+		if (!openchangesim_throttle_backoff(log, attempt)) {
+			break;
+		}
+	}
 	if (ret != OCSIM_SUCCESS) {
 		openchangesim_log_string("%s module returned: %s",
 						FETCHMAIL_MODULE_NAME,
@@ -382,7 +427,7 @@ static uint32_t module_fetchmail_run(TALLOC_CTX *mem_ctx,
 	openchangesim_log_end(log, FETCHMAIL_MODULE_NAME, NULL, addr);
 	openchangesim_log_close(log);
 
-	return OCSIM_SUCCESS;
+	return ret;
 }
 
 
@@ -404,6 +449,8 @@ uint32_t module_fetchmail_init(struct ocsim_context *ctx)
 	module->get_ref_count = module_get_ref_count;
 	module->scenario = module_get_scenario(ctx, FETCHMAIL_MODULE_NAME);
 	module->cases = module_get_scenario_data(ctx, FETCHMAIL_MODULE_NAME);
+	fetchmail_scenario = module->scenario;
+	openchangesim_module_chunk_init(ctx, module->scenario, FETCHMAIL_STATS_STREAM);
 
 	if (module->scenario)
 		ret = openchangesim_module_register(ctx, module);
@@ -19,65 +19,9 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include "src/openchangesim.h"
-
-struct sendmail_data {
-	struct Binary_r		pr_html;
-	struct Binary_r		pr_rtf;
-	struct Binary_r		pr_attach;
-	uint32_t		attach_num;
-};
-
-/**
- * read a file and store it in the appropriate structure element
- */
-static bool sdata_read_file(TALLOC_CTX *mem_ctx, const char *filename, 
-			      struct sendmail_data *sdata, uint32_t mapitag)
-{
-	struct stat	sb;
-	int		fd;
-
-	if ((fd = open(filename, O_RDONLY)) == -1) {
-		printf("Error while opening %s\n", filename);
-		return false;
-	}
-	/* stat the file */
-	if (fstat(fd, &sb) != 0) {
-		close(fd);
-		return false;
-	}
-
-	switch (mapitag) {
-	case PR_HTML:
-		sdata->pr_html.lpb = talloc_size(mem_ctx, sb.st_size);
-		sdata->pr_html.cb = read(fd, sdata->pr_html.lpb, sb.st_size);
-		close(fd);
-		break;
-	case PR_RTF_COMPRESSED:
-		sdata->pr_rtf.lpb = talloc_size(mem_ctx, sb.st_size);
-		sdata->pr_rtf.cb = read(fd, sdata->pr_rtf.lpb, sb.st_size);
-		close(fd);
-		break;
-	case PR_ATTACH_DATA_BIN:
-		sdata->pr_attach.cb = sb.st_size;
-		if ((sdata->pr_attach.lpb = mmap(NULL, sb.st_size, 
-						 PROT_READ, MAP_SHARED, fd, 0)) == (void *) -1) {
-			perror("mmap");
-			close(fd);
-			return false;
-		}
-		close(fd);
-		break;
-	default:
-		printf("unsupported MAPITAG: %s\n", get_proptag_name(mapitag));
-		close(fd);
-		return false;
-		break;
-	}
-
-	return true;
-}
+#include <fcntl.h>
 
+#include "src/openchangesim.h"
 
 static const char *get_filename(const char *filename)
 {
@@ -86,104 +30,233 @@ static const char *get_filename(const char *filename)
 	if (!filename) return NULL;
 
 	substr = rindex(filename, '/');
-	if (substr) return substr;
+	if (substr) return substr + 1;
 
 	return filename;
 }
 
 
+static struct ocsim_scenario	*sendmail_scenario = NULL;
+
+
 /**
- * Write a stream with MAX_READ_SIZE chunks
+ * Write a stream with chunks of the scenario chunk size
+ *
+ * Each chunk is a slice of the source buffer (shared content region,
+ * generator buffer or inline body), WriteStream marshals it without
+ * any intermediate copy. The bytes written and the CPU time spent are
+ * recorded in the sendmail:stream statistics, and in those of the
+ * chunk size during a sweep. A stream written short of the buffer
+ * size is a failure.
  */
 
-static bool sendmail_stream(TALLOC_CTX *mem_ctx, mapi_object_t obj_parent, 
-			    mapi_object_t obj_stream, uint32_t mapitag, 
-			    uint32_t access_flags, struct Binary_r bin)
+static bool sendmail_stream(TALLOC_CTX *mem_ctx, struct ocsim_log *log, mapi_object_t *obj_parent, 
+			    uint32_t mapitag, uint32_t access_flags, struct Binary_r bin, uint32_t chunk)
 {
 	enum MAPISTATUS	retval;
+	mapi_object_t	obj_stream;
 	DATA_BLOB	stream;
-	uint32_t	size;
 	uint32_t	offset;
 	uint16_t	read_size;
+	uint64_t	cpu_start;
+	struct timeval	tv_start;
+	struct timeval	tv_end;
+	bool		ret = true;
 
 	/* Open a stream on the parent for the given property */
-	retval = OpenStream(&obj_parent, mapitag, access_flags, &obj_stream);
-	if (retval != MAPI_E_SUCCESS) return false;
+	mapi_object_init(&obj_stream);
+	OCSIM_LOG_CALL(log, retval, OpenStream, (obj_parent, mapitag, access_flags, &obj_stream));
+	if (retval != MAPI_E_SUCCESS) {
+		mapi_object_release(&obj_stream);
+		return false;
+	}
+
+	gettimeofday(&tv_start, NULL);
+	cpu_start = openchangesim_stats_cpu_usec();
 
 	/* WriteStream operation */
-	size = (bin.cb > MAX_READ_SIZE) ? MAX_READ_SIZE : bin.cb;
-	offset = 0;
-	while (offset <= bin.cb) {
-		stream.length = size;
-		stream.data = talloc_size(mem_ctx, size);
-		memcpy(stream.data, bin.lpb + offset, size);
-		
-		retval = WriteStream(&obj_stream, &stream, &read_size);
-		talloc_free(stream.data);
-		if (retval != MAPI_E_SUCCESS) return false;
+	for (offset = 0; offset < bin.cb; offset += read_size) {
+		stream.length = (bin.cb - offset > chunk) ? chunk : bin.cb - offset;
+		stream.data = bin.lpb + offset;
+
+		OCSIM_LOG_CALL(log, retval, WriteStream, (&obj_stream, &stream, &read_size));
+		if (retval != MAPI_E_SUCCESS) {
+			ret = false;
+			break;
+		}
 
 		/* Exit when there is nothing left to write */
-		if (!read_size) return true;
-		
-		offset += read_size;
+		if (!read_size) break;
+	}
+
+	/* A short write leaves the property incomplete */
+	if (offset < bin.cb) {
+		ret = false;
+	}
+
+	gettimeofday(&tv_end, NULL);
+	openchangesim_stats_record_stream(SENDMAIL_STATS_STREAM, chunk,
+					  sendmail_scenario && sendmail_scenario->chunk_count > 1,
+					  (uint64_t)(tv_end.tv_sec - tv_start.tv_sec) * 1000000 +
+					  (tv_end.tv_usec - tv_start.tv_usec),
+					  offset, openchangesim_stats_cpu_usec() - cpu_start, ret);
+	mapi_object_release(&obj_stream);
+
+	return ret;
+}
+
+
+/**
+ * Stream a large attachment one chunk at a time
+ *
+ * Each chunk is read from the file or generated into a single chunk
+ * buffer, so memory does not depend on the attachment size, and the
+ * offset is 64 bits. Every WriteStream round trip is recorded in
+ * sendmail:large:chunk and the whole attachment in sendmail:large.
+ * An attachment streamed short of its size is a failure and leaves
+ * written to 0.
+ */
+
+static bool sendmail_stream_large(struct ocsim_log *log, mapi_object_t *obj_parent,
+				  struct ocsim_large_object *large,
+				  uint32_t chunk, uint64_t *written)
+{
+	enum MAPISTATUS	retval;
+	mapi_object_t	obj_stream;
+	DATA_BLOB	stream;
+	uint8_t		buf[OCSIM_STREAM_MAX_CHUNK];
+	uint64_t	offset;
+	uint64_t	cpu_start;
+	uint16_t	write_size;
+	ssize_t		n;
+	int		fd = -1;
+	struct timeval	tv_start;
+	struct timeval	tv_chunk;
+	struct timeval	tv_end;
+	bool		ret = true;
+
+	*written = 0;
+	if (chunk > sizeof (buf)) {
+		chunk = sizeof (buf);
+	}
+
+	if (large->path) {
+		fd = open(large->path, O_RDONLY);
+		if (fd == -1) {
+			perror(large->path);
+			return false;
+		}
+	}
+
+	mapi_object_init(&obj_stream);
+	OCSIM_LOG_CALL(log, retval, OpenStream, (obj_parent, PR_ATTACH_DATA_BIN, 2, &obj_stream));
+	if (retval != MAPI_E_SUCCESS) {
+		mapi_object_release(&obj_stream);
+		if (fd != -1) close(fd);
+		return false;
+	}
 
-		if ((offset + size) > bin.cb) {
-			size = bin.cb - offset;
+	gettimeofday(&tv_start, NULL);
+	tv_end = tv_start;
+	cpu_start = openchangesim_stats_cpu_usec();
+
+	for (offset = 0; offset < large->size; offset += write_size) {
+		stream.length = (large->size - offset > chunk) ? chunk : large->size - offset;
+		stream.data = buf;
+		if (fd != -1) {
+			do {
+				n = pread(fd, buf, stream.length, offset);
+			} while (n == -1 && errno == EINTR);
+			if (n <= 0) {
+				ret = false;
+				break;
+			}
+			stream.length = n;
+		} else {
+			openchangesim_generator_chunk(large, buf, stream.length);
 		}
 
-		if (!size) break;
+		gettimeofday(&tv_chunk, NULL);
+		OCSIM_LOG_CALL(log, retval, WriteStream, (&obj_stream, &stream, &write_size));
+		gettimeofday(&tv_end, NULL);
+		openchangesim_stats_record_name(SENDMAIL_STATS_LARGE_CHUNK,
+						(uint64_t)(tv_end.tv_sec - tv_chunk.tv_sec) * 1000000 +
+						(tv_end.tv_usec - tv_chunk.tv_usec),
+						retval == MAPI_E_SUCCESS);
+		if (retval != MAPI_E_SUCCESS) {
+			ret = false;
+			break;
+		}
+
+		/* Exit when there is nothing left to write */
+		if (!write_size) break;
+	}
+
+	/* A file which shrank or a short write leaves the attachment incomplete */
+	if (offset < large->size) {
+		ret = false;
 	}
 
-	return true;
+	if (fd != -1) {
+		close(fd);
+	}
+	mapi_object_release(&obj_stream);
+
+	openchangesim_stats_record_stream(SENDMAIL_STATS_LARGE, chunk, false,
+					  (uint64_t)(tv_end.tv_sec - tv_start.tv_sec) * 1000000 +
+					  (tv_end.tv_usec - tv_start.tv_usec),
+					  offset, openchangesim_stats_cpu_usec() - cpu_start, ret);
+	if (ret) {
+		*written = offset;
+	}
+
+	return ret;
 }
 
 
 /**
    \details Create a sample mail with attachment
+
+   The size of the submitted message is returned in msg_size. The
+   message, attachment and stream objects are released on every path,
+   so failed attempts don't leak handles on the session.
  */
 static uint32_t _module_sendmail_run(TALLOC_CTX *mem_ctx, 
+				     struct ocsim_log *log,
 				     struct ocsim_scenario_sendmail *sendmail, 
 				     struct mapi_session *session,
-				     bool doLogoff)
+				     uint64_t *size)
 {
 	enum MAPISTATUS		retval;
-	mapi_object_t		obj_store;
-	mapi_object_t		obj_outbox;
+	mapi_object_t		*obj_outbox;
 	mapi_object_t		obj_message;
-	mapi_object_t		obj_stream;
-	struct SPropTagArray	*SPropTagArray;
+	mapi_object_t		obj_attach;
 	struct SRowSet		*SRowSet = NULL;
-	struct PropertyRowSet_r	*RowSet = NULL;
-	struct SPropValue	SPropValue;
-	struct SPropValue	lpProps[4];
-	const char	       	*username[2];
-	mapi_id_t		id_outbox;
-	char			*subject;
-	char			*body = NULL;
-	uint32_t		msgflag;
-	uint32_t		format;
-	bool			bret;
-	int			prop_index = 0;
+	struct SPropValue	props_attach[3];
+	struct Binary_r		bin;
+	TALLOC_CTX		*rcpt_ctx;
+	struct ocsim_message_template	*template;
+	struct ocsim_large_object	*large;
+	uint32_t		chunk;
+	uint32_t		ret = OCSIM_ERROR;
 	int			i;
-	struct PropertyTagArray_r	*flaglist = NULL;
-	
-	/* Log onto the store */
-	mapi_object_init(&obj_store);
-	retval = OpenMsgStore(session, &obj_store);
-	if (retval) {
-		mapi_errstr("OpenMsgStore", GetLastError());
-		return OCSIM_ERROR;
-	}
+	uint64_t		msg_size;
+	uint64_t		written;
 
-	/* Open default outbox folder */
-	retval = GetDefaultFolder(&obj_store, &id_outbox, olFolderOutbox);
-	if (retval) {
-		mapi_errstr("GetDefaultFolder", GetLastError());
+	/* All the streams of the message use the same chunk size */
+	chunk = openchangesim_module_chunk_size(sendmail_scenario);
+
+	/* Subject, default body and named properties are patched once per client */
+	retval = openchangesim_template_prepare(log, session, sendmail);
+	if (retval != MAPI_E_SUCCESS) {
+		mapi_errstr("GetIDsFromNames", GetLastError());
 		return OCSIM_ERROR;
 	}
-
-	mapi_object_init(&obj_outbox);
-	retval = OpenFolder(&obj_store, id_outbox, &obj_outbox);
+	template = sendmail->message_template;
+	msg_size = template->size;
+	
+	/* Store and Outbox are cached for the session */
+	retval = openchangesim_session_folder(log, session, olFolderOutbox, NULL, &obj_outbox);
 	if (retval) {
 		mapi_errstr("OpenFolder", GetLastError());
 		return OCSIM_ERROR;
@@ -191,222 +264,220 @@ static uint32_t _module_sendmail_run(TALLOC_CTX *mem_ctx,
 
 	/* Create the message */
 	mapi_object_init(&obj_message);
-	retval = CreateMessage(&obj_outbox, &obj_message);
+	mapi_object_init(&obj_attach);
+	OCSIM_LOG_CALL(log, retval, CreateMessage, (obj_outbox, &obj_message));
 	if (retval) {
 		mapi_errstr("CreateMessage", GetLastError());
-		return OCSIM_ERROR;
+		goto end;
 	}
 
-
-	/* Resolve current username */
-	SPropTagArray = set_SPropTagArray(mem_ctx, 0xA, 
-					  PR_ENTRYID,
-					  PR_DISPLAY_NAME_UNICODE,
-					  PR_OBJECT_TYPE,
-					  PR_DISPLAY_TYPE,
-					  PR_TRANSMITTABLE_DISPLAY_NAME_UNICODE,
-					  PR_EMAIL_ADDRESS_UNICODE,
-					  PR_ADDRTYPE_UNICODE,
-					  PR_SEND_RICH_INFO,
-					  PR_7BIT_DISPLAY_NAME_UNICODE,
-					  PR_SMTP_ADDRESS_UNICODE);
-	username[0] = (char *)session->profile->mailbox;
-	username[1] = NULL;
-
-	retval = ResolveNames(mapi_object_get_session(&obj_message), username, SPropTagArray, 
-			      &RowSet, &flaglist, MAPI_UNICODE);
-	MAPIFreeBuffer(SPropTagArray);
+	/* Set Recipients */
+	rcpt_ctx = talloc_new(mem_ctx);
+	retval = openchangesim_recipients_select(rcpt_ctx, log, session, sendmail, &SRowSet);
 	if (retval != MAPI_E_SUCCESS) {
 		mapi_errstr("ResolveNames", GetLastError());
-		MAPIFreeBuffer(flaglist);
-		return OCSIM_ERROR;
+		talloc_free(rcpt_ctx);
+		goto end;
 	}
 
-	SRowSet = talloc_zero(mem_ctx, struct SRowSet);
-	if (RowSet) {
-		cast_PropertyRowSet_to_SRowSet(mem_ctx, RowSet, SRowSet);
-	}
-
-	/* Set Recipients */
-	SetRecipientType(&(SRowSet->aRow[0]), MAPI_TO);
-
-	SPropValue.ulPropTag = PR_SEND_INTERNET_ENCODING;
-	SPropValue.value.l = 0;
-	SRowSet_propcpy(mem_ctx, SRowSet, SPropValue);
-
-	retval = ModifyRecipients(&obj_message, SRowSet);
-	MAPIFreeBuffer(SRowSet);
-	MAPIFreeBuffer(flaglist);
+	OCSIM_LOG_CALL(log, retval, ModifyRecipients, (&obj_message, SRowSet));
+	talloc_free(rcpt_ctx);
 	if (retval != MAPI_E_SUCCESS) {
 		mapi_errstr("ModifyRecipient", GetLastError());
-		return OCSIM_ERROR;
+		goto end;
 	}
 
-	/* Set message properties */
-	msgflag = MSGFLAG_UNSENT|MSGFLAG_FROMME;
-	subject = talloc_asprintf(mem_ctx, "%s Mail from %s\n", DFLT_SUBJECT_PREFIX, session->profile->mailbox);
-	set_SPropValue_proptag(&lpProps[prop_index], PR_SUBJECT, (const void *) subject);
-	prop_index++;
-	set_SPropValue_proptag(&lpProps[prop_index], PR_MESSAGE_FLAGS, (const void *)&msgflag);
-	prop_index++;
-
-	/* Set the message body given sendmail case parameters */
-	if (sendmail->body_type != OCSIM_BODY_NONE) {
-		switch (sendmail->body_type) {
-		case OCSIM_BODY_UTF8_INLINE:
-			format = EDITOR_FORMAT_PLAINTEXT;
-			if (strlen(sendmail->body_inline) > MAX_READ_SIZE) {
-				struct Binary_r bin;
-				
-				bin.lpb = (uint8_t *)sendmail->body_inline;
-				bin.cb = strlen(sendmail->body_inline);
-				sendmail_stream(mem_ctx, obj_message, obj_stream, PR_BODY_UNICODE, 2, bin);
-			} else {
-				set_SPropValue_proptag(&lpProps[prop_index], PR_BODY_UNICODE, (const void *)sendmail->body_inline);
-				prop_index++;
-			}
-			break;
-		case OCSIM_BODY_HTML_INLINE:
-			format = EDITOR_FORMAT_HTML;
-			if (strlen(sendmail->body_inline) > MAX_READ_SIZE) {
-				struct Binary_r bin;
-				
-				bin.lpb = (uint8_t *)sendmail->body_inline;
-				bin.cb = strlen(sendmail->body_inline);
-				sendmail_stream(mem_ctx, obj_message, obj_stream, PR_HTML, 2, bin);
-			} else {
-				struct SBinary_short bin;
-
-				bin.cb = strlen(sendmail->body_inline);
-				bin.lpb = (uint8_t *)sendmail->body_inline;
-				set_SPropValue_proptag(&lpProps[prop_index], PR_HTML, (void *)&bin);
-				prop_index++;
+	/* Stream the body, the template holds every other property */
+	if (template->body_tag) {
+		bin = template->body;
+
+		if (sendmail->body_type == OCSIM_BODY_GENERATED) {
+			if (!openchangesim_generator_fill(sendmail->gen_body, &bin)) {
+				fprintf(stderr, "Unable to generate body %s\n", sendmail->body_generator);
+				goto end;
 			}
-			break;
-		case OCSIM_BODY_UTF8_FILE:
-		{
-			
-		}
-			break;
-		case OCSIM_BODY_HTML_FILE:
-		{
-			struct sendmail_data	sdata;
-
-			format = EDITOR_FORMAT_HTML;
-			bret = sdata_read_file(mem_ctx, sendmail->body_file, &sdata, PR_HTML);
-			if (bret == false) {
-				fprintf(stderr, "Unable to read file %s\n", sendmail->body_file);
-				return OCSIM_ERROR;
-			} 
-
-			mapi_object_init(&obj_stream);
-			sendmail_stream(mem_ctx, obj_message, obj_stream, PR_HTML, 2, sdata.pr_html);
-			talloc_free(sdata.pr_html.lpb);
-			mapi_object_release(&obj_stream);
+			msg_size += bin.cb;
 		}
-			break;
-		case OCSIM_BODY_RTF_FILE:
-		{
-			struct sendmail_data	sdata;
-
-			format = EDITOR_FORMAT_RTF;
-			bret = sdata_read_file(mem_ctx, sendmail->body_file, &sdata, PR_RTF_COMPRESSED);
-			if (bret == false) {
-				fprintf(stderr, "Unable to read file %s\n", sendmail->body_file);
-				return OCSIM_ERROR;
-			}
-			mapi_object_init(&obj_stream);
-			sendmail_stream(mem_ctx, obj_message, obj_stream, PR_RTF_COMPRESSED, 2, sdata.pr_rtf);
-			talloc_free(sdata.pr_rtf.lpb);
-			mapi_object_release(&obj_stream);
 
+		if (!sendmail_stream(mem_ctx, log, &obj_message, template->body_tag, 2, bin, chunk)) goto end;
+	}
+
+	/* Properties are split to fit the request buffer */
+	for (i = 0; i < template->batch_count; i++) {
+		OCSIM_LOG_CALL(log, retval, SetProps, (&obj_message, 0,
+						       &template->props[template->batch_start[i]],
+						       template->batch_start[i + 1] - template->batch_start[i]));
+		if (retval != MAPI_E_SUCCESS) {
+			mapi_errstr("SetProps", GetLastError());
+			goto end;
 		}
-			break;
-		default:
-			break;
+	}
+
+	props_attach[0].ulPropTag = PR_ATTACH_METHOD;
+	props_attach[0].value.l = ATTACH_BY_VALUE;
+	props_attach[1].ulPropTag = PR_RENDERING_POSITION;
+	props_attach[1].value.l = 0;
+	props_attach[2].ulPropTag = PR_ATTACH_FILENAME;
+
+	/* Add attachments */
+	for (i = 0; i < sendmail->attachment_count; i++) {
+		/* Contents are mapped by openchangesim_content_init() */
+		if (!sendmail->attachment_contents) {
+			fprintf(stderr, "Attachment %s is not loaded\n", sendmail->attachments[i]);
+			goto end;
 		}
-	} else {
-		format = EDITOR_FORMAT_PLAINTEXT;
-		body = talloc_asprintf(mem_ctx, "Body of message with subject: %s", subject);
-		set_SPropValue_proptag(&lpProps[prop_index], PR_BODY, (const void *)body);
-		prop_index++;
+
+		OCSIM_LOG_CALL(log, retval, CreateAttach, (&obj_message, &obj_attach));
+		if (retval != MAPI_E_SUCCESS) goto end;
+
+		props_attach[2].value.lpszA = get_filename(sendmail->attachments[i]);
+		OCSIM_LOG_CALL(log, retval, SetProps, (&obj_attach, 0, props_attach, 3));
+		if (retval != MAPI_E_SUCCESS) goto end;
+
+		if (!sendmail_stream(mem_ctx, log, &obj_attach, PR_ATTACH_DATA_BIN, 2,
+				     sendmail->attachment_contents[i], chunk)) goto end;
+
+		/* Save changes on attachment */
+		OCSIM_LOG_CALL(log, retval, SaveChangesAttachment, (&obj_message, &obj_attach, KeepOpenReadWrite));
+		if (retval != MAPI_E_SUCCESS) goto end;
+
+		mapi_object_release(&obj_attach);
 	}
 
-	set_SPropValue_proptag(&lpProps[prop_index], PR_MSG_EDITOR_FORMAT, (const void *)&format);
-	prop_index++;
+	/* Add generated attachments */
+	for (i = 0; i < sendmail->generator_count; i++) {
+		if (!openchangesim_generator_fill(sendmail->gen_attachments[i], &bin)) {
+			fprintf(stderr, "Unable to generate attachment %s\n", sendmail->generators[i]);
+			goto end;
+		}
 
-	retval = SetProps(&obj_message, 0, lpProps, prop_index);
-	talloc_free(subject);
-	talloc_free(body);
-	if (retval != MAPI_E_SUCCESS) {
-		mapi_errstr("SetProps", GetLastError());
-		return OCSIM_ERROR;
+		OCSIM_LOG_CALL(log, retval, CreateAttach, (&obj_message, &obj_attach));
+		if (retval != MAPI_E_SUCCESS) goto end;
+
+		props_attach[2].value.lpszA = template->generated_names[i];
+		OCSIM_LOG_CALL(log, retval, SetProps, (&obj_attach, 0, props_attach, 3));
+		if (retval != MAPI_E_SUCCESS) goto end;
+
+		if (!sendmail_stream(mem_ctx, log, &obj_attach, PR_ATTACH_DATA_BIN, 2, bin, chunk)) goto end;
+		msg_size += bin.cb;
+
+		OCSIM_LOG_CALL(log, retval, SaveChangesAttachment, (&obj_message, &obj_attach, KeepOpenReadWrite));
+		if (retval != MAPI_E_SUCCESS) goto end;
+
+		mapi_object_release(&obj_attach);
 	}
 
-	/* Add attachments */
-	if (sendmail->attachment_count) {
-		for (i = 0; i < sendmail->attachment_count; i++) {
-			struct sendmail_data	sdata;
-			mapi_object_t		obj_attach;
-			struct SPropValue	props_attach[3];
-			uint32_t		count_props_attach;
-
-			mapi_object_init(&obj_attach);
-			
-			retval = CreateAttach(&obj_message, &obj_attach);
-			if (retval != MAPI_E_SUCCESS) return retval;
-		
-			props_attach[0].ulPropTag = PR_ATTACH_METHOD;
-			props_attach[0].value.l = ATTACH_BY_VALUE;
-			props_attach[1].ulPropTag = PR_RENDERING_POSITION;
-			props_attach[1].value.l = 0;
-			props_attach[2].ulPropTag = PR_ATTACH_FILENAME;
-			props_attach[2].value.lpszA = get_filename(sendmail->attachments[i]);
-			count_props_attach = 3;
-
-			/* SetProps */
-			retval = SetProps(&obj_attach, 0, props_attach, count_props_attach);
-			if (retval != MAPI_E_SUCCESS) return retval;
-
-			/* Stream operations */
-			memset(&sdata, 0, sizeof (struct sendmail_data));
-			bret = sdata_read_file(mem_ctx, sendmail->attachments[i], &sdata, PR_ATTACH_DATA_BIN);
-			if (bret == false) {
-				fprintf(stderr, "Unable to read file %s\n", sendmail->body_file);
-				return OCSIM_ERROR;
-			}
+	/* Add large attachments */
+	for (i = 0; i < sendmail->large_count; i++) {
+		large = &sendmail->large_objects[i];
 
-			mapi_object_init(&obj_stream);
-			sendmail_stream(mem_ctx, obj_attach, obj_stream, PR_ATTACH_DATA_BIN, 2, sdata.pr_attach);
-			munmap(sdata.pr_attach.lpb, sdata.pr_attach.cb);
-			mapi_object_release(&obj_stream);
+		OCSIM_LOG_CALL(log, retval, CreateAttach, (&obj_message, &obj_attach));
+		if (retval != MAPI_E_SUCCESS) goto end;
 
-			/* Save changes on attachment */
-			retval = SaveChangesAttachment(&obj_message, &obj_attach, KeepOpenReadWrite);
-			if (retval != MAPI_E_SUCCESS) return retval;
+		props_attach[2].value.lpszA = large->path ? get_filename(large->path) : template->large_names[i];
+		OCSIM_LOG_CALL(log, retval, SetProps, (&obj_attach, 0, props_attach, 3));
+		if (retval != MAPI_E_SUCCESS) goto end;
 
-			mapi_object_release(&obj_attach);
-		}
+		if (!sendmail_stream_large(log, &obj_attach, large, chunk, &written)) goto end;
+		msg_size += written;
+
+		OCSIM_LOG_CALL(log, retval, SaveChangesAttachment, (&obj_message, &obj_attach, KeepOpenReadWrite));
+		if (retval != MAPI_E_SUCCESS) goto end;
+
+		mapi_object_release(&obj_attach);
 	}
 
 	/* Submit the message */
-	retval = SubmitMessage(&obj_message);
+	OCSIM_LOG_CALL(log, retval, SubmitMessage, (&obj_message));
 	if (retval) {
 		fprintf(stderr, "error in SubmitMessage: 0x%x\n", GetLastError());
 		mapi_errstr("SubmitMessage", GetLastError());
-		return OCSIM_ERROR;
+		goto end;
 	}
+	openchangesim_log_message(log, mapi_object_get_id(&obj_message), msg_size);
+	*size = msg_size;
+	ret = OCSIM_SUCCESS;
 
+end:
+	mapi_object_release(&obj_attach);
 	mapi_object_release(&obj_message);
-	mapi_object_release(&obj_outbox);
-	if (doLogoff) {
-		Logoff(&obj_store);
+
+	return ret;
+}
+
+static uint64_t sendmail_elapsed(struct timeval *tv_start)
+{
+	struct timeval	tv_end;
+
+	gettimeofday(&tv_end, NULL);
+
+	return (uint64_t)(tv_end.tv_sec - tv_start->tv_sec) * 1000000 +
+		(tv_end.tv_usec - tv_start->tv_usec);
+}
+
+
+/**
+ * Send the batch messages of a case in a row on the session
+ *
+ * Messages share the cached store, Outbox and message template, so
+ * after the first one each message only costs its own ROPs. Each
+ * message, retries included, is recorded in sendmail:message and a
+ * batch of several messages in sendmail:batch, with the bytes
+ * submitted.
+ */
+
+static bool sendmail_batch(TALLOC_CTX *mem_ctx, struct ocsim_log *log,
+			   struct ocsim_scenario_sendmail *sendmail,
+			   struct mapi_session *session)
+{
+	struct timeval	tv_batch;
+	struct timeval	tv_message;
+	uint64_t	cpu_batch;
+	uint64_t	cpu_message;
+	uint64_t	size;
+	uint64_t	total = 0;
+	uint32_t	sent = 0;
+	uint32_t	attempt;
+	uint32_t	n;
+	bool		ret;
+
+	gettimeofday(&tv_batch, NULL);
+	cpu_batch = openchangesim_stats_cpu_usec();
+
+	for (n = 0; n < sendmail->batch; n++) {
+		gettimeofday(&tv_message, NULL);
+		cpu_message = openchangesim_stats_cpu_usec();
+		size = 0;
+		for (attempt = 0; ; attempt++) {
+			ret = (_module_sendmail_run(mem_ctx, log, sendmail, session, &size) == OCSIM_SUCCESS);
+			if (ret) break;
+
+			/* Cached objects may be stale after an error */
+			openchangesim_session_invalidate();
+			if (!openchangesim_throttle_backoff(log, attempt)) {
+				break;
+			}
+		}
+		openchangesim_stats_record_stream(SENDMAIL_STATS_MESSAGE, 0, false,
+						  sendmail_elapsed(&tv_message), size,
+						  openchangesim_stats_cpu_usec() - cpu_message, ret);
+		if (ret) {
+			sent++;
+			total += size;
+		}
 	}
 
-	mapi_object_release(&obj_store);
-	return OCSIM_SUCCESS;
+	if (sendmail->batch > 1) {
+		openchangesim_stats_record_stream(SENDMAIL_STATS_BATCH, 0, false,
+						  sendmail_elapsed(&tv_batch), total,
+						  openchangesim_stats_cpu_usec() - cpu_batch,
+						  sent == sendmail->batch);
+	}
+
+	return sent == sendmail->batch;
 }
 
+
 static uint32_t module_sendmail_run(TALLOC_CTX *mem_ctx, 
 				    struct ocsim_scenario_case *cases, 
 				    struct mapi_session *session)
@@ -416,6 +487,7 @@ static uint32_t module_sendmail_run(TALLOC_CTX *mem_ctx,
 	struct ocsim_log		*log;
 	TALLOC_CTX *sub_ctx;
 	char				*addr;
+	uint32_t			ret = OCSIM_SUCCESS;
 
 	sub_ctx = talloc_new(mem_ctx);
 
@@ -424,7 +496,9 @@ static uint32_t module_sendmail_run(TALLOC_CTX *mem_ctx,
 		sendmail = (struct ocsim_scenario_sendmail *) el->private_data;
 		openchangesim_log_start(log);
 		addr = talloc_strdup(sub_ctx, session->profile->localaddr);
-		_module_sendmail_run(sub_ctx, sendmail, session, el->next == NULL);
+		if (!sendmail_batch(sub_ctx, log, sendmail, session)) {
+			ret = OCSIM_ERROR;
+		}
 		openchangesim_log_end(log, SENDMAIL_MODULE_NAME, el->name, addr);
 		talloc_free(addr);
 	}
@@ -432,7 +506,7 @@ static uint32_t module_sendmail_run(TALLOC_CTX *mem_ctx,
 	openchangesim_log_close(log);
 	talloc_free(sub_ctx);
 
-	return OCSIM_SUCCESS;
+	return ret;
 }
 
 /**
@@ -444,8 +518,10 @@ static uint32_t module_sendmail_run(TALLOC_CTX *mem_ctx,
  */
 uint32_t module_sendmail_init(struct ocsim_context *ctx)
 {
-	int			ret;
-	struct ocsim_module	*module = NULL;
+	int				ret;
+	struct ocsim_module		*module = NULL;
+	struct ocsim_scenario_case	*el;
+	struct ocsim_scenario_sendmail	*sendmail;
 
 	module = openchangesim_module_init(ctx, SENDMAIL_MODULE_NAME, "sendmail scenario");
 	module->run = module_sendmail_run;
@@ -453,6 +529,21 @@ uint32_t module_sendmail_init(struct ocsim_context *ctx)
 	module->get_ref_count = module_get_ref_count;
 	module->scenario = module_get_scenario(ctx, SENDMAIL_MODULE_NAME);
 	module->cases = module_get_scenario_data(ctx, SENDMAIL_MODULE_NAME);
+	sendmail_scenario = module->scenario;
+	openchangesim_module_chunk_init(ctx, module->scenario, SENDMAIL_STATS_STREAM);
+	for (el = module->cases; el; el = el->next) {
+		sendmail = (struct ocsim_scenario_sendmail *) el->private_data;
+		if (sendmail && sendmail->large_count) {
+			openchangesim_stats_register(SENDMAIL_STATS_LARGE);
+			openchangesim_stats_register(SENDMAIL_STATS_LARGE_CHUNK);
+		}
+		if (sendmail) {
+			openchangesim_stats_register(SENDMAIL_STATS_MESSAGE);
+		}
+		if (sendmail && sendmail->batch > 1) {
+			openchangesim_stats_register(SENDMAIL_STATS_BATCH);
+		}
+	}
 
 	if (module->scenario)
 		ret = openchangesim_module_register(ctx, module);
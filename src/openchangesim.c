@@ -20,6 +20,8 @@
 */
 
 #include <sys/wait.h>
+#include <ctype.h>
+#include <limits.h>
 #include "src/openchangesim.h"
 struct ocsim_signal_context sig_ctx;
 
@@ -46,32 +48,144 @@ uint32_t callback(struct SRowSet *rowset, void *private)
 	return 0;
 }
 
+struct ocsim_profile_state
+{
+	bool			exists;
+	const char		*localaddr;
+};
+
+
 /**
-   \details Duplicate a profile in the database
+   \details Scan the profile store once for the profiles of a server
+
+   Profiles named exactly after the server PROFNAME_TEMPLATE_NB pattern
+   are recorded in states when their index belongs to the range.
+   Outside of the range, those provisioned with a localaddress are
+   appended to the stale list, other profiles sharing the generic user
+   prefix are left alone.
+
+   \return the number of profiles found
+ */
+static uint32_t openchangesim_profile_scan(struct mapi_context *mapi_ctx, TALLOC_CTX *mem_ctx,
+					   struct ocsim_server *el,
+					   struct ocsim_profile_state *states,
+					   const char ***stale, uint32_t *stale_count)
+{
+	const char * const	attrs[] = { "cn", "localaddress", NULL };
+	struct ldb_result	*res = NULL;
+	struct ldb_dn		*basedn;
+	const char		*cn;
+	const char		*localaddr;
+	char			*prefix;
+	char			*name;
+	char			*end;
+	size_t			len;
+	unsigned long		index;
+	bool			match;
+	uint32_t		i;
+	int			ret;
+
+	*stale = NULL;
+	*stale_count = 0;
+
+	basedn = ldb_dn_new(mem_ctx, mapi_ctx->ldb_ctx, "CN=Profiles");
+	ret = ldb_search(mapi_ctx->ldb_ctx, mem_ctx, &res, basedn, LDB_SCOPE_SUBTREE, attrs,
+			 "(cn=%s/%s*@%s)", el->name, el->generic_user, el->realm);
+	if (ret || !res) return 0;
+
+	prefix = talloc_asprintf(mem_ctx, "%s/%s", el->name, el->generic_user);
+	len = strlen(prefix);
+
+	for (i = 0; i < res->count; i++) {
+		cn = ldb_msg_find_attr_as_string(res->msgs[i], "cn", NULL);
+		if (!cn || strncmp(cn, prefix, len) || !isdigit((unsigned char)cn[len])) continue;
+
+		/* The name must be the one the range index gives, without any other digits */
+		index = strtoul(cn + len, &end, 10);
+		if (index > INT_MAX) continue;
+		name = talloc_asprintf(mem_ctx, PROFNAME_TEMPLATE_NB, el->name, el->generic_user,
+				       (int) index, el->realm);
+		match = (name && !strcmp(name, cn));
+		talloc_free(name);
+		if (!match) continue;
+
+		localaddr = ldb_msg_find_attr_as_string(res->msgs[i], "localaddress", NULL);
+		if (index >= el->range_start && index < el->range_end) {
+			states[index - el->range_start].exists = true;
+			states[index - el->range_start].localaddr = localaddr;
+		} else if (localaddr) {
+			*stale = talloc_realloc(mem_ctx, *stale, const char *, *stale_count + 1);
+			(*stale)[(*stale_count)++] = cn;
+		}
+	}
+
+	return res->count;
+}
+
+
+static bool openchangesim_profile_batch(struct mapi_context *mapi_ctx, bool *transaction, uint32_t *writes)
+{
+	(*writes)++;
+	if (*transaction && !(*writes % OCSIM_PROVISION_BATCH)) {
+		if (ldb_transaction_commit(mapi_ctx->ldb_ctx) != 0) {
+			ldb_transaction_cancel(mapi_ctx->ldb_ctx);
+			*transaction = false;
+			DEBUG(0, (DEBUG_FORMAT_STRING_ERR, "Unable to commit the profiles to the database"));
+			return false;
+		}
+		*transaction = (ldb_transaction_start(mapi_ctx->ldb_ctx) == 0);
+	}
+
+	return true;
+}
+
+
+/**
+   \details Reconcile the profile store with the server user range
 
    This operation will only work in an environment where mailboxes
    have been created using a template: generic username and password,
    same storage and administrative group.
 
+   The existing profiles are read in a single scan and diffed against
+   the configured range and IP assignment. Missing profiles are
+   duplicated from the reference profile, profiles with a stale
+   localaddress are updated and profiles outside of the range are
+   deleted. Writes are performed by this single writer in batched ldb
+   transactions, then the virtual interfaces are created by a pool of
+   worker threads.
+
    \param mem_ctx pointer to the memory context
    \param ref_username pointer to the profile name to duplicate
-   \param username of the new profile
    \param el pointer to the server element
+   \param workers the number of interface provisioning threads
 
    \return MAPI_E_SUCCESS on success, otherwise MAPI error
  */
 enum MAPISTATUS openchangesim_DuplicateProfile(struct mapi_context *mapi_ctx, TALLOC_CTX *mem_ctx,
 					       char *profname_src,
-					       struct ocsim_server *el)
+					       struct ocsim_server *el,
+					       uint32_t workers)
 {
-	FILE			*f;
-	int			i;
-	char			*profname_dst;
-	char			*username_dst;
-	enum MAPISTATUS		retval;
-	uint32_t		profile_nb = el->range_end - el->range_start;
-	char			*logstr;
-	char			*ip_address;
+	TALLOC_CTX			*scan_ctx;
+	FILE				*f;
+	int				i;
+	int				idx;
+	char				*profname_dst;
+	char				*username_dst;
+	enum MAPISTATUS			retval = MAPI_E_SUCCESS;
+	uint32_t			profile_nb = el->range_end - el->range_start;
+	char				*logstr;
+	char				**ip_addresses;
+	struct ocsim_profile_state	*states;
+	const char			**stale;
+	uint32_t			stale_count;
+	uint32_t			found;
+	uint32_t			created = 0;
+	uint32_t			updated = 0;
+	uint32_t			deleted = 0;
+	uint32_t			writes = 0;
+	bool				transaction;
 
 	f = fdopen(STDOUT_FILENO, "a");
 	if (!f) {
@@ -79,52 +193,94 @@ enum MAPISTATUS openchangesim_DuplicateProfile(struct mapi_context *mapi_ctx, TA
 		exit(1);
 	}
 
+	ip_addresses = talloc_zero_array(mem_ctx, char *, profile_nb);
+	scan_ctx = talloc_named(mem_ctx, 0, "profile_scan");
+	states = talloc_zero_array(scan_ctx, struct ocsim_profile_state, profile_nb);
+	if (!ip_addresses || !states) {
+		talloc_free(scan_ctx);
+		talloc_free(ip_addresses);
+		return MAPI_E_NOT_ENOUGH_MEMORY;
+	}
+
+	found = openchangesim_profile_scan(mapi_ctx, scan_ctx, el, states, &stale, &stale_count);
+
+	transaction = (ldb_transaction_start(mapi_ctx->ldb_ctx) == 0);
+
+	/* Profiles which no longer belong to the range */
+	for (i = 0; i < stale_count; i++) {
+		if (DeleteProfile(mapi_ctx, stale[i]) == MAPI_E_SUCCESS) {
+			deleted++;
+			if (!openchangesim_profile_batch(mapi_ctx, &transaction, &writes)) {
+				talloc_free(scan_ctx);
+				talloc_free(ip_addresses);
+				return MAPI_E_CALL_FAILED;
+			}
+		}
+	}
+
 	/* First IP of the range has been alocated to the "reference profile"*/
 	for (i = el->range_start + 1; i != el->range_end; i++) {
-		int idx;
-		struct mapi_profile	*profile;
 		openchangesim_interface_get_next_ip(el, false);
+		idx = i - el->range_start;
+
+		ip_addresses[idx] = openchangesim_interface_get_ip(ip_addresses, el, el->ip_used);
+		if (states[idx].exists && states[idx].localaddr &&
+		    !strcmp(states[idx].localaddr, ip_addresses[idx])) {
+			continue;
+		}
 
 		profname_dst = talloc_asprintf(mem_ctx, PROFNAME_TEMPLATE_NB,
 					       el->name, el->generic_user, i, el->realm);
-
-		profile = talloc(mem_ctx, struct mapi_profile);
-		retval = OpenProfile(mapi_ctx, profile, profname_dst, NULL);
-		if (retval != MAPI_E_SUCCESS) {
+		if (!states[idx].exists) {
 			username_dst = talloc_asprintf(mem_ctx, PROFNAME_USER, el->generic_user, i);
 			retval = DuplicateProfile(mapi_ctx, profname_src, profname_dst, username_dst);
+			talloc_free(username_dst);
 			if (retval) {
 				openchangesim_release_ip(el);
+				talloc_free(ip_addresses[idx]);
+				ip_addresses[idx] = NULL;
 				talloc_free(profname_dst);
-				talloc_free(username_dst);
-				return retval;
+				break;
 			}
-			ip_address = talloc_asprintf(mem_ctx, "%d.%d.%d.%d", el->ip_current[0], 
-						     el->ip_current[1], el->ip_current[2], el->ip_current[3]);
-			mapi_profile_modify_string_attr(mapi_ctx, profname_dst, "localaddress", ip_address);
-			idx = i - el->range_start;
-			if (openchangesim_create_interface_tap(mem_ctx, &el->interfaces_fd[idx], ip_address) < 0) {
-				exit (1);
-			}
-			talloc_free(username_dst);
+			created++;
 		} else {
-			idx = i - el->range_start;
-			ip_address = talloc_asprintf(mem_ctx, "%d.%d.%d.%d", el->ip_current[0],
-						     el->ip_current[1], el->ip_current[2], el->ip_current[3]);
-			if (openchangesim_create_interface_tap(mem_ctx, &el->interfaces_fd[idx], ip_address) < 0) {
-				exit (1);
-			}
+			updated++;
 		}
-		talloc_free(ip_address);
-
-		logstr = talloc_asprintf(mem_ctx, "[*] Creating profile %d/%d: %d.%d.%d.%d %s\n",
-					 i, profile_nb, el->ip_current[0], el->ip_current[1], 
-					 el->ip_current[2], el->ip_current[3], profname_dst);
-		openchangesim_printlog(f, logstr);
-		talloc_free(logstr);
+		mapi_profile_modify_string_attr(mapi_ctx, profname_dst, "localaddress", ip_addresses[idx]);
 		talloc_free(profname_dst);
-		talloc_free(profile);
+		if (!openchangesim_profile_batch(mapi_ctx, &transaction, &writes)) {
+			talloc_free(scan_ctx);
+			talloc_free(ip_addresses);
+			return MAPI_E_CALL_FAILED;
+		}
+
+		if (!(writes % 64)) {
+			logstr = talloc_asprintf(mem_ctx, "[*] Reconciling profile %d/%d: %s\n",
+						 idx + 1, profile_nb, ip_addresses[idx]);
+			openchangesim_printlog(f, logstr);
+			talloc_free(logstr);
+		}
+	}
+	talloc_free(scan_ctx);
+
+	if (transaction && ldb_transaction_commit(mapi_ctx->ldb_ctx) != 0) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_ERR, "Unable to commit the profiles to the database"));
+		talloc_free(ip_addresses);
+		return MAPI_E_CALL_FAILED;
+	}
+	el->profile_changes += writes;
+
+	logstr = talloc_asprintf(mem_ctx, "[*] Profiles: %d found, %d created, %d updated, %d deleted %50s\n",
+				 found, created, updated, deleted, "");
+	openchangesim_printlog(f, logstr);
+	talloc_free(logstr);
+
+	/* Interfaces of profiles written so far, even if one failed */
+	if (openchangesim_create_interfaces(f, el->interfaces, ip_addresses, profile_nb, workers) != OCSIM_SUCCESS) {
+		exit (1);
 	}
+	talloc_free(ip_addresses);
+	if (retval) return retval;
 
 	logstr = talloc_asprintf(mem_ctx, "[*] %d User profiles ready %200s\n", profile_nb, "");
 	openchangesim_printlog(f, logstr);
@@ -134,6 +290,61 @@ enum MAPISTATUS openchangesim_DuplicateProfile(struct mapi_context *mapi_ctx, TA
 }
 
 
+/**
+   \details Prepare synthetic profiles for the user range
+
+   Only the reference profile is stored in the database. The source
+   address of every other user is allocated and its interface created,
+   then the profiles are expanded in memory at logon time.
+
+   \param mapi_ctx pointer to the MAPI context
+   \param ctx pointer to the OpenChangeSim context
+   \param profname_src the reference profile name
+   \param el pointer to the server element
+   \param workers the number of interface provisioning threads
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_SyntheticProfiles(struct mapi_context *mapi_ctx, struct ocsim_context *ctx,
+				    char *profname_src,
+				    struct ocsim_server *el,
+				    uint32_t workers)
+{
+	uint32_t		profile_nb = el->range_end - el->range_start;
+	uint32_t		i;
+	char			**ip_addresses;
+	char			*logstr;
+
+	ip_addresses = talloc_zero_array(ctx->mem_ctx, char *, profile_nb);
+	OCSIM_RETVAL_IF(!ip_addresses, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+
+	/* First IP of the range has been alocated to the "reference profile"*/
+	for (i = 1; i < profile_nb; i++) {
+		if (openchangesim_roster_enabled()) {
+			ip_addresses[i] = openchangesim_roster_ip(ip_addresses, el, el->range_start + i);
+		} else {
+			openchangesim_interface_get_next_ip(el, false);
+			ip_addresses[i] = openchangesim_interface_get_ip(ip_addresses, el, el->ip_used);
+		}
+	}
+
+	if (openchangesim_create_interfaces(stdout, el->interfaces, ip_addresses, profile_nb, workers) != OCSIM_SUCCESS) {
+		exit (1);
+	}
+
+	if (openchangesim_synthetic_init(mapi_ctx, ctx, el, profname_src, ip_addresses) != OCSIM_SUCCESS) {
+		talloc_free(ip_addresses);
+		return OCSIM_ERROR;
+	}
+
+	logstr = talloc_asprintf(ctx->mem_ctx, "[*] %d Synthetic user profiles ready %200s\n", profile_nb, "");
+	openchangesim_printlog(stdout, logstr);
+	talloc_free(logstr);
+
+	return OCSIM_SUCCESS;
+}
+
+
 /**
    \details Create a MAPI profile in the database
 
@@ -142,13 +353,15 @@ enum MAPISTATUS openchangesim_DuplicateProfile(struct mapi_context *mapi_ctx, TA
    \param profname pointer to the profile name string
    \param username pointer to the username string to use along with
    the profile
+   \param password pointer to the password of the user
 
    \return MAPI_E_SUCCESS on success, otherwise MAPI error
  */
 enum MAPISTATUS openchangesim_CreateProfile(struct mapi_context *mapi_ctx, TALLOC_CTX *mem_ctx,
 					    struct ocsim_server *el, 
 					    char *profname,
-					    const char *username)
+					    const char *username,
+					    const char *password)
 {
 	enum MAPISTATUS		retval;
 	struct mapi_session	*session = NULL;
@@ -161,8 +374,10 @@ enum MAPISTATUS openchangesim_CreateProfile(struct mapi_context *mapi_ctx, TALLO
 	char			hostname[256];
 	char			*str;
 	const char		*workstation = NULL;
+	struct timeval		tv_start;
+	struct timeval		tv_end;
 
-	retval = CreateProfile(mapi_ctx, profname, username, el->generic_password, 0);
+	retval = CreateProfile(mapi_ctx, profname, username, password, 0);
 	if (retval != MAPI_E_SUCCESS) {
 		mapi_errstr("CreateProfile", GetLastError());
 		return retval;
@@ -198,7 +413,12 @@ enum MAPISTATUS openchangesim_CreateProfile(struct mapi_context *mapi_ctx, TALLO
 	talloc_free(cpid_str);
 	talloc_free(lcid_str);
 
-	retval = MapiLogonProvider(mapi_ctx, &session, profname, el->generic_password, PROVIDER_ID_NSPI);
+	gettimeofday(&tv_start, NULL);
+	retval = MapiLogonProvider(mapi_ctx, &session, profname, password, PROVIDER_ID_NSPI);
+	gettimeofday(&tv_end, NULL);
+	openchangesim_stats_record_name(OCSIM_STATS_PROFILE_NSPI,
+					(uint64_t)(tv_end.tv_sec - tv_start.tv_sec) * 1000000 +
+					(tv_end.tv_usec - tv_start.tv_usec), retval == MAPI_E_SUCCESS);
 	if (retval != MAPI_E_SUCCESS) {
 		char * msg;
 
@@ -214,8 +434,14 @@ enum MAPISTATUS openchangesim_CreateProfile(struct mapi_context *mapi_ctx, TALLO
 		return retval;
 	}
 
+	gettimeofday(&tv_start, NULL);
 	retval = ProcessNetworkProfile(session, username, (mapi_profile_callback_t) callback, 
 				       username);
+	gettimeofday(&tv_end, NULL);
+	openchangesim_stats_record_name(OCSIM_STATS_PROFILE_NETWORK,
+					(uint64_t)(tv_end.tv_sec - tv_start.tv_sec) * 1000000 +
+					(tv_end.tv_usec - tv_start.tv_usec),
+					retval == MAPI_E_SUCCESS || retval == 0x1);
 	if (retval != MAPI_E_SUCCESS && retval != 0x1) {
 		char * msg;
 
@@ -254,6 +480,9 @@ int openchangesim_profile(struct mapi_context *mapi_ctx, struct ocsim_context *c
 	struct mapi_profile	*profile;
 	char			*ip_address;
 	char			*username;
+	const char		*password;
+	uint32_t		workers;
+	int			ret = OCSIM_SUCCESS;
 
 	/* Sanity checks */
 	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
@@ -277,42 +506,68 @@ int openchangesim_profile(struct mapi_context *mapi_ctx, struct ocsim_context *c
 			} else {
 				username = talloc_strdup(ctx->mem_ctx, el->generic_user);
 			}
-			retval = openchangesim_CreateProfile(mapi_ctx, ctx->mem_ctx, el, profname, username);
+			retval = openchangesim_CreateProfile(mapi_ctx, ctx->mem_ctx, el, profname, username,
+							     el->generic_password);
 			talloc_free(username);
 		}
 		talloc_free(profname);
 		break;
 	case true:
 		/* Create first profile */
-		el->interfaces_fd = talloc_zero_array(ctx->mem_ctx, int, el->range_end - (el->range_start));
-		openchangesim_interface_get_next_ip(el, true);
-		ip_address = talloc_asprintf(ctx->mem_ctx, "%d.%d.%d.%d", el->ip_current[0],
-					     el->ip_current[1], el->ip_current[2], el->ip_current[3]);
+		el->interfaces = talloc_zero_array(ctx->mem_ctx, struct ocsim_interface, el->range_end - (el->range_start));
+		if (openchangesim_roster_enabled()) {
+			ip_address = openchangesim_roster_ip(ctx->mem_ctx, el, el->range_start);
+		} else {
+			openchangesim_interface_get_next_ip(el, true);
+			ip_address = openchangesim_interface_get_ip(ctx->mem_ctx, el, el->ip_used);
+		}
+		if (!ip_address) return OCSIM_ERROR;
 		profname = talloc_asprintf(ctx->mem_ctx, PROFNAME_TEMPLATE_NB, el->name,
 					   el->generic_user, el->range_start, el->realm);
 		retval = OpenProfile(mapi_ctx, profile, profname, NULL);
 		if (retval != MAPI_E_SUCCESS) {
-			username = talloc_asprintf(ctx->mem_ctx, PROFNAME_USER,
-						   el->generic_user, el->range_start);
+			/* The first user of the roster is the reference profile */
+			if (openchangesim_roster_enabled()) {
+				username = talloc_strdup(ctx->mem_ctx, openchangesim_roster_get(el->range_start,
+												OCSIM_ROSTER_USERNAME));
+				password = openchangesim_roster_get(el->range_start, OCSIM_ROSTER_PASSWORD);
+			} else {
+				username = talloc_asprintf(ctx->mem_ctx, PROFNAME_USER,
+							   el->generic_user, el->range_start);
+				password = NULL;
+			}
 			retval = openchangesim_CreateProfile(mapi_ctx, ctx->mem_ctx, el,
-							     profname, username);
+							     profname, username,
+							     password ? password : el->generic_password);
 			talloc_free(username);
 			if (retval) return OCSIM_ERROR;
 			mapi_profile_add_string_attr(mapi_ctx, profname, "localaddress", ip_address);
+			el->profile_changes++;
+		} else if (!profile->localaddr || strcmp(profile->localaddr, ip_address)) {
+			mapi_profile_modify_string_attr(mapi_ctx, profname, "localaddress", ip_address);
+			el->profile_changes++;
 		}
-		if (openchangesim_create_interface_tap(ctx->mem_ctx, &el->interfaces_fd[el->ip_used], ip_address) < 0) {
+		if (openchangesim_create_interfaces(stdout, &el->interfaces[0], &ip_address, 1, 1) != OCSIM_SUCCESS) {
 			exit (1);
 		}
 		talloc_free(ip_address);
 
-		/* Duplicate other profiles */
-		openchangesim_DuplicateProfile(mapi_ctx, ctx->mem_ctx, profname, el);
+		/* Duplicate other profiles, or expand them in memory */
+		workers = configuration_get_var_int(ctx, OCSIM_VAR_PROVISION_WORKERS, sysconf(_SC_NPROCESSORS_ONLN));
+		if (openchangesim_synthetic_enabled(ctx) || openchangesim_roster_enabled()) {
+			ret = openchangesim_SyntheticProfiles(mapi_ctx, ctx, profname, el, workers);
+		} else {
+			retval = openchangesim_DuplicateProfile(mapi_ctx, ctx->mem_ctx, profname, el, workers);
+			if (retval != MAPI_E_SUCCESS) {
+				ret = OCSIM_ERROR;
+			}
+		}
 		talloc_free(profname);
 		break;
 	}
 	talloc_free(profile);
 
-	return OCSIM_SUCCESS;
+	return ret;
 }
 
 static int check_range_status(struct ocsim_context *ctx, const char *server)
@@ -326,6 +581,11 @@ static int check_range_status(struct ocsim_context *ctx, const char *server)
 		exit (1);
 	}
 
+	/* Roster users with their own source address don't use the IP range */
+	if (openchangesim_roster_enabled()) {
+		return (openchangesim_roster_addresses() <= el->ip_number) ? 0 : -1;
+	}
+
 	range = el->range_end - el->range_start;
 
 	if (!range && !el->ip_number) {
@@ -370,16 +630,24 @@ int main(int argc, const char *argv[])
 	bool			opt_confcheck = false;
 	bool			opt_confdump = false;
 	bool			opt_server_list = false;
+	bool			opt_cleanup_stale = false;
+	bool			opt_daemon = false;
+	bool			opt_submit = false;
+	bool			opt_daemon_stop = false;
 	const char		*opt_profdb = NULL;
 	const char		*opt_debug = NULL;
 	const char		*opt_conf_file = NULL;
 	const char		*opt_server = NULL;
 	char			*str;
+	char			*snapshot;
+	char			*journal;
+	char			*daemon_socket;
+	struct ocsim_server	*el;
 	struct mapi_context	*mapi_ctx = NULL;
 
 	enum { OPT_PROFILE_DB=1000, OPT_DEBUG, OPT_DUMPDATA, OPT_VERSION,
 	       OPT_CONFIG, OPT_CONFCHECK, OPT_CONFDUMP, OPT_SERVER_LIST, 
-	       OPT_SERVER };
+	       OPT_SERVER, OPT_CLEANUP_STALE, OPT_DAEMON, OPT_SUBMIT, OPT_DAEMON_STOP };
 
 	struct poptOption long_options[] = {
 		POPT_AUTOHELP
@@ -392,6 +660,10 @@ int main(int argc, const char *argv[])
 		{ "confdump", 0, POPT_ARG_NONE, NULL, OPT_CONFDUMP, "Dump configuration", NULL },
 		{ "server-list", 0, POPT_ARG_NONE, NULL, OPT_SERVER_LIST, "List available servers", NULL },
 		{ "server", 0, POPT_ARG_STRING, NULL, OPT_SERVER, "Select server to use for openchangesim", NULL },
+		{ "cleanup-stale", 0, POPT_ARG_NONE, NULL, OPT_CLEANUP_STALE, "Delete interfaces left by an interrupted run", NULL },
+		{ "daemon", 0, POPT_ARG_NONE, NULL, OPT_DAEMON, "Keep profiles and interfaces and run jobs submitted on the daemon socket", NULL },
+		{ "submit", 0, POPT_ARG_NONE, NULL, OPT_SUBMIT, "Submit the configuration file as a job to the daemon", NULL },
+		{ "daemon-stop", 0, POPT_ARG_NONE, NULL, OPT_DAEMON_STOP, "Stop the daemon", NULL },
 		{ NULL, 0, 0, NULL, 0, NULL, NULL }
 	};
 
@@ -431,6 +703,18 @@ int main(int argc, const char *argv[])
 		case OPT_SERVER:
 			opt_server = poptGetOptArg(pc);
 			break;
+		case OPT_CLEANUP_STALE:
+			opt_cleanup_stale = true;
+			break;
+		case OPT_DAEMON:
+			opt_daemon = true;
+			break;
+		case OPT_SUBMIT:
+			opt_submit = true;
+			break;
+		case OPT_DAEMON_STOP:
+			opt_daemon_stop = true;
+			break;
 		default:
 			DEBUG(0, ("Invalid option\n"));
 			exit (1);
@@ -443,6 +727,9 @@ int main(int argc, const char *argv[])
 
 	/* confcheck work case */
 	if (opt_confcheck) {
+		if (!ret) {
+			ret = openchangesim_content_init(ctx, true);
+		}
 		if (ret) {
 			DEBUG(0, (DEBUG_FORMAT_STRING_WARN, DEBUG_CONF_FILE_KO));
 		} else {
@@ -463,10 +750,34 @@ int main(int argc, const char *argv[])
 	if (opt_confdump) {
 		configuration_dump_servers(ctx);
 		configuration_dump_scenarios(ctx);
+		configuration_dump_transactions(ctx);
+		configuration_dump_networks(ctx);
 		openchangesim_release(ctx);
 		exit (0);
 	}
 
+	/* cleanup-stale work case */
+	if (opt_cleanup_stale) {
+		journal = talloc_asprintf(mem_ctx, OCSIM_JOURNAL_PATH, opt_profdb ? opt_profdb :
+					  talloc_asprintf(mem_ctx, DEFAULT_PROFDB, getenv("HOME")));
+		ret = openchangesim_journal_replay(ctx, journal);
+		talloc_free(journal);
+		openchangesim_release(ctx);
+		exit (ret == OCSIM_SUCCESS ? 0 : 1);
+	}
+
+	/* daemon client work case */
+	daemon_socket = talloc_strdup(mem_ctx, configuration_get_var(ctx, OCSIM_VAR_DAEMON_SOCKET));
+	if (!daemon_socket) {
+		daemon_socket = talloc_asprintf(mem_ctx, DEFAULT_DAEMON_SOCKET, getenv("HOME"));
+	}
+	if (opt_submit || opt_daemon_stop) {
+		ret = openchangesim_daemon_submit(daemon_socket, opt_daemon_stop ? OCSIM_DAEMON_QUIT : opt_conf_file);
+		openchangesim_release(ctx);
+		talloc_free(mem_ctx);
+		exit (ret == OCSIM_SUCCESS ? 0 : 1);
+	}
+
 	if (!opt_server) {
 		DEBUG(0, (HELP_FORMAT_STRING, HELP_SERVER_OPTION));
 		configuration_dump_servers_list(ctx);
@@ -474,9 +785,15 @@ int main(int argc, const char *argv[])
 		exit (0);
 	}
 
+	/* Index the user roster, which sets the user range */
+	if (openchangesim_roster_init(ctx, opt_server) != OCSIM_SUCCESS) {
+		openchangesim_release(ctx);
+		exit (1);
+	}
+
 	/* Ensure IP address range is >= number of users requested */
 	if (check_range_status(ctx, opt_server) < 0) {
-		DEBUG(0, (HELP_FORMAT_STRING, HELP_IP_USER_RANGE));
+		DEBUG(0, (HELP_FORMAT_STRING, openchangesim_roster_enabled() ? HELP_ROSTER_RANGE : HELP_IP_USER_RANGE));
 		openchangesim_release(ctx);
 		exit (0);
 	}
@@ -538,31 +855,88 @@ int main(int argc, const char *argv[])
 		SetMAPIDebugLevel(mapi_ctx, atoi(opt_debug));
 	}
 
-	/* Step 5. Load modules */
+	/* Step 5. Initialize statistics and load modules */
+	ret = openchangesim_stats_init(ctx);
+	if (ret == OCSIM_ERROR) {
+		goto end;
+	}
+	openchangesim_logon_register();
+
 	ret = openchangesim_register_modules(ctx);
 	if (ret == OCSIM_ERROR) {
 		goto end;
 	}
 
+	/* Map body and attachment files once, shared by all the clients */
+	ret = openchangesim_content_init(ctx, false);
+	if (ret == OCSIM_ERROR) {
+		goto end;
+	}
+
 	/* Step 6. Perform profile operations */
+	journal = talloc_asprintf(mem_ctx, OCSIM_JOURNAL_PATH, opt_profdb);
+	ret = openchangesim_journal_open(ctx, journal);
+	talloc_free(journal);
+	if (ret == OCSIM_ERROR) {
+		MAPIUninitialize(mapi_ctx);
+		openchangesim_release(ctx);
+		exit (1);
+	}
+
+	ret = openchangesim_netlink_init(ctx);
+	if (ret == OCSIM_ERROR) {
+		goto end;
+	}
+
 	ret = openchangesim_profile(mapi_ctx, ctx, opt_server);
 	if (ret == OCSIM_ERROR) {
 		goto end;
 	}
 
-	/* Step 7. Call fork process model */
+	ret = openchangesim_network_apply(ctx, opt_server);
+	if (ret == OCSIM_ERROR) {
+		goto end;
+	}
+
+	/* Step 7. Compile the profiles snapshot shared by the clients,
+	   roster users have their own credentials */
+	el = configuration_validate_server(ctx, opt_server);
+	if (el && el->range && !openchangesim_synthetic_enabled(ctx) && !openchangesim_roster_enabled()) {
+		snapshot = talloc_asprintf(mem_ctx, OCSIM_SNAPSHOT_PATH, opt_profdb);
+		/* Reuse the previous snapshot when reconciliation changed nothing */
+		if ((!el->profile_changes &&
+		     openchangesim_snapshot_load(snapshot, el->range_start, el->range_end - el->range_start) == OCSIM_SUCCESS) ||
+		    (openchangesim_snapshot_compile(mapi_ctx, ctx, opt_server, snapshot) == OCSIM_SUCCESS &&
+		     openchangesim_snapshot_load(snapshot, el->range_start, el->range_end - el->range_start) == OCSIM_SUCCESS)) {
+			openchangesim_printlog(stdout, "[*] Profiles snapshot loaded\n");
+		}
+		talloc_free(snapshot);
+	}
+
+	/* Daemon mode: run the submitted jobs until asked to stop */
+	if (opt_daemon) {
+		ret = openchangesim_daemon_run(ctx, mapi_ctx, opt_server, daemon_socket);
+		goto end;
+	}
+
+	/* Step 8. Call fork process model */
+	openchangesim_stats_start();
+	openchangesim_host_init(ctx, opt_server);
+	openchangesim_host_sample();
 	ret = openchangesim_fork_process_start(ctx, mapi_ctx, opt_server);
 	if (ret == OCSIM_ERROR) {
 		DEBUG(0, ("Error with the prefork model\n"));
 		goto end;
 	}
 
-	/* Step 8, Wait for all forked children */
+	/* Step 9, Wait for all forked children */
 	ret = openchangesim_fork_process_end(ctx, opt_server);
 	if (ret == OCSIM_ERROR) {
 		DEBUG(0, ("Error ending the prefork model\n"));
 		goto end;
 	}
+	openchangesim_stats_dump();
+	openchangesim_host_dump();
 
 end:
 	/* Last OpenChangeSim Step: Delete virtual interfaces */
@@ -575,6 +949,10 @@ end:
 	/* Uninitialize MAPI subsystem */
 	poptFreeContext(pc);
 	MAPIUninitialize(mapi_ctx);
+	openchangesim_snapshot_release();
+	openchangesim_roster_release();
+	openchangesim_content_release();
+	openchangesim_stats_release();
 	talloc_free(mem_ctx);
 
 	return 0;
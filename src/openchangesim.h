@@ -54,9 +54,23 @@
 #define	DEBUG_CONF_FILE_KO		"Configuration file not OK!"
 #define	DEBUG_CONF_FILE_OK		"Configuration file OK"
 #define	DEBUG_ERR_OUT_OF_ADDRESS	"No more available IP address left"
+#define	DEBUG_ERR_STALE_JOURNAL		"Interfaces from a previous run were not deleted"
 #define	DEBUG_ERR_DUPLICATE		"Duplicate scenario"
+#define	DEBUG_ERR_DUPLICATE_TRANSACTION	"Duplicate transaction, or a transaction named after a module"
+#define	DEBUG_ERR_DUPLICATE_NETWORK	"Duplicate network group"
 #define	DEBUG_ERR_MISSING_NAME		"A scenario defined in the configuration file is missing the required name parameter"
 #define	DEBUG_ERR_INVALID_NAME		"A scenario name defined in the configuration file doesn't exist"
+#define	DEBUG_ERR_NO_STEP		"A transaction defined in the configuration file has no step"
+#define	DEBUG_ERR_INVALID_STEP		"A transaction step refers to a module or case which doesn't exist"
+#define	DEBUG_ERR_CONTENT_FILE		"Body or attachment file is missing or can't be read"
+#define	DEBUG_ERR_GENERATOR		"Invalid content generator, expected content:distribution"
+#define	DEBUG_ERR_GENERATOR_BODY	"Random content can only be generated for attachments"
+#define	DEBUG_ERR_CHUNK_SIZE		"Invalid chunk_size, expected a size or a list of sizes"
+#define	DEBUG_ERR_LARGE_OBJECT		"Invalid large_attachment, expected a file or content:SIZE"
+#define	DEBUG_ERR_PROPERTY_PROFILE	"Invalid property_profile, expected TYPE:WEIGHT[:MIN-MAX] entries"
+#define	DEBUG_ERR_NETWORK_JITTER	"Network jitter requires a latency"
+#define	DEBUG_ERR_NETWORK_QDISC		"The interface routing to the server has its own qdisc, set network_device to replace it"
+#define	DEBUG_ERR_RECIPIENTS		"Invalid recipients, expected self, uniform or zipf[:EXPONENT]"
 
 
 /**
@@ -66,6 +80,8 @@
 #define	HELP_SERVER_OPTION	"You need to specify one server using --server option"
 #define	HELP_SERVER_INVALID	"Invalid server specified"
 #define	HELP_IP_USER_RANGE	"Your IP range is insufficient given the generic user range"
+#define	HELP_ROSTER_RANGE	"Your IP range is insufficient for the users_file entries without a source address"
+#define	HELP_CLEANUP_STALE	"Delete them using --cleanup-stale option"
 
 /**
    Common template strings
@@ -80,17 +96,369 @@
 #define	FETCHMAIL_MODULE_NAME	"fetchmail"
 
 #define	MAX_READ_SIZE	0x1000
+#define	SENDMAIL_STATS_STREAM	"sendmail:stream"
+#define	FETCHMAIL_STATS_STREAM	"fetchmail:stream"
+#define	SENDMAIL_STATS_LARGE	"sendmail:large"
+#define	SENDMAIL_STATS_LARGE_CHUNK	"sendmail:large:chunk"
+#define	SENDMAIL_STATS_MESSAGE	"sendmail:message"
+#define	SENDMAIL_STATS_BATCH	"sendmail:batch"
+
+/**
+   Stream chunk size (chunk_size scenario parameter, stream_chunk_size
+   default). libmapi sends one ReadStream or WriteStream per round trip
+   and refuses to write more than 0x7000 bytes at once. Several sizes
+   make a sweep, each message using the next one.
+ */
+#define	OCSIM_STREAM_MAX_CHUNK		0x7000
+#define	OCSIM_STREAM_MAX_SWEEP		16
+#define	OCSIM_STREAM_STATS_NAME		"%s:%u"
+#define	OCSIM_VAR_STREAM_CHUNK_SIZE	"stream_chunk_size"
+
+/**
+   Keep the client session across modules and transactions instead of
+   logging on again before each of them
+ */
+#define	OCSIM_VAR_SESSION_REUSE		"session_reuse"
+
+/**
+   Tail sampling defaults and configuration variables
+ */
+#define	OCSIM_LOG_MAX_CALLS		32
+#define	OCSIM_LOG_MAX_MSGS		16
+#define	OCSIM_TAIL_DFLT_SIZE		10
+#define	OCSIM_TAIL_DFLT_THRESHOLD_MAX	64
+#define	OCSIM_VAR_TAIL_SIZE		"tail_sample_size"
+#define	OCSIM_VAR_TAIL_THRESHOLD	"tail_sample_threshold"
+#define	OCSIM_VAR_TAIL_THRESHOLD_MAX	"tail_sample_threshold_max"
+
+/**
+   Shared statistics region limits
+ */
+#define	OCSIM_STATS_MAX			64
+#define	OCSIM_STATS_NAME_LEN		64
+#define	OCSIM_HISTOGRAM_SUB_BUCKETS	8
+#define	OCSIM_HISTOGRAM_BUCKETS		(64 * OCSIM_HISTOGRAM_SUB_BUCKETS)
+
+/**
+   Logon phases histograms
+ */
+#define	OCSIM_STATS_LOGON_TCP		"logon:tcp_connect"
+#define	OCSIM_STATS_LOGON_NSPI		"logon:nspi"
+#define	OCSIM_STATS_LOGON_EMSMDB	"logon:emsmdb"
+#define	OCSIM_STATS_LOGON_STORE		"logon:store"
+#define	OCSIM_STATS_PROFILE_NSPI	"profile:nspi_logon"
+#define	OCSIM_STATS_PROFILE_NETWORK	"profile:process_network"
+#define	OCSIM_LOGON_TCP_PORT		"135"
+#define	OCSIM_LOGON_TCP_TIMEOUT		5000
+
+/**
+   Statistics time series and throttling configuration
+ */
+#define	OCSIM_STATS_SLOTS		360
+#define	OCSIM_STATS_DFLT_INTERVAL	10
+#define	OCSIM_VAR_STATS_INTERVAL	"stats_interval"
+#define	OCSIM_THROTTLE_DFLT_BACKOFF_MAX	30000
+#define	OCSIM_THROTTLE_DFLT_RETRIES	3
+#define	OCSIM_VAR_THROTTLE_BACKOFF	"throttle_backoff"
+#define	OCSIM_VAR_THROTTLE_BACKOFF_MAX	"throttle_backoff_max"
+#define	OCSIM_VAR_THROTTLE_RETRIES	"throttle_retries"
+
+/**
+   Host resource sampler configuration
+ */
+#define	OCSIM_IFNAMSIZ			16
+#define	OCSIM_HOST_MAX_CPUS		256
+#define	OCSIM_HOST_MAX_IFACES		8
+#define	OCSIM_HOST_DFLT_INTERVAL	1
+#define	OCSIM_HOST_POLL_USEC		100000
+#define	OCSIM_VAR_HOST_INTERVAL		"host_sample_interval"
+#define	OCSIM_VAR_HOST_INTERFACES	"host_sample_interfaces"
+
+/**
+   Profile provisioning configuration
+ */
+#define	OCSIM_PROVISION_MAX_WORKERS	64
+#define	OCSIM_PROVISION_BATCH		512
+#define	OCSIM_VAR_PROVISION_WORKERS	"provision_workers"
+#define	OCSIM_VAR_SYNTHETIC_PROFILES	"synthetic_profiles"
+
+/**
+   Netlink address pool configuration
+ */
+#define	OCSIM_NETLINK_BUFSIZE		32768
+#define	OCSIM_NETLINK_MSGSIZE		64
+#define	OCSIM_VAR_ADDRESS_POOL		"address_pool"
+
+/**
+   Interface journal entries
+ */
+#define	OCSIM_JOURNAL_PATH		"%s.journal"
+#define	OCSIM_JOURNAL_TAP		"tap"
+#define	OCSIM_JOURNAL_LINK		"link"
+#define	OCSIM_JOURNAL_ADDR		"addr"
+#define	OCSIM_JOURNAL_QDISC		"qdisc"
+
+/**
+   Network conditions emulation
+ */
+#define	OCSIM_NETWORK_TC		"tc -batch -"
+#define	OCSIM_NETWORK_TC_FORCE		"tc -force -batch - 2>/dev/null"
+#define	OCSIM_NETWORK_ROUTE		"ip -o route get %s"
+#define	OCSIM_NETWORK_QDISC		"tc qdisc show dev %s"
+#define	OCSIM_NETWORK_LINE_RATE		"100gbit"
+#define	OCSIM_NETWORK_NETEM_LIMIT	100000
+#define	OCSIM_NETWORK_QUANTUM		60000
+#define	OCSIM_NETWORK_CLASSID		0x10
+#define	OCSIM_VAR_NETWORK_DEVICE	"network_device"
+#define	OCSIM_VAR_NETWORK_IFB		"network_ifb"
+
+/**
+   User roster (users_file): one user per line,
+   username,password,mailbox,source address,group
+ */
+#define	OCSIM_ROSTER_LINE		1024
+#define	OCSIM_ROSTER_HEADER		"username"
+#define	OCSIM_ROSTER_PROFNAME		"roster"
+
+/**
+   Default folders kept open per session (openchangesim_session.c)
+ */
+#define	OCSIM_SESSION_FOLDERS		8
+
+/**
+   Recipients of the sendmail cases (recipients): self, uniform or
+   zipf[:EXPONENT] over the users of the server, recipient_count users
+   per message, plus the distribution_list names
+ */
+#define	OCSIM_RECIPIENTS_SELF		"self"
+#define	OCSIM_RECIPIENTS_UNIFORM	"uniform"
+#define	OCSIM_RECIPIENTS_ZIPF		"zipf"
+#define	OCSIM_RECIPIENTS_DFLT_EXPONENT	1.0
+#define	OCSIM_RECIPIENTS_MAX		256
+
+/**
+   Messages created and submitted in a row by a sendmail case (batch)
+   on the same session
+ */
+#define	OCSIM_BATCH_MAX			100000
+
+/**
+   Generated content (generate_body, generate_attachment):
+   "content:distribution" where content is text, html, compressible or
+   random and distribution is fixed:SIZE, uniform:MIN-MAX,
+   lognormal:MEDIAN:SIGMA or histogram:FILE
+ */
+#define	OCSIM_GENERATOR_BLOCK		65536
+#define	OCSIM_GENERATOR_PATTERN		64
+#define	OCSIM_GENERATOR_MAX_SIZE	(256 * 1024 * 1024)
+#define	OCSIM_GENERATOR_DFLT_SEED	0x6f63
+#define	OCSIM_GENERATOR_FILENAME	"generated-%u.%s"
+#define	OCSIM_VAR_GENERATOR_SEED	"generator_seed"
+
+/**
+   Large attachments (large_attachment) are streamed from a file or
+   generated ("content:SIZE", SIZE in bytes with an optional K, M, G or
+   T suffix) one chunk at a time
+ */
+#define	OCSIM_LARGE_MAX_SIZE		(1ULL << 44)
+#define	OCSIM_LARGE_FILENAME		"large-%u.%s"
+
+/**
+   Extra properties of the sendmail cases: properties standard ones
+   (identifiers from OCSIM_PROPERTY_ID_BASE) and named_properties
+   string named ones, typed and sized along property_profile, a comma
+   separated list of TYPE:WEIGHT[:MIN-MAX] where TYPE is string, long,
+   boolean, time, double or binary and MIN-MAX the size of strings and
+   binaries. The message properties are set with as many SetProps as
+   needed to keep each request within OCSIM_PROPERTY_BATCH_SIZE
+   serialized bytes, below the 32 KB EcDoRpc request buffer.
+ */
+#define	OCSIM_PROPERTY_DFLT_PROFILE	"string:50:16-256,long:20,boolean:10,time:10,binary:10:16-1024"
+#define	OCSIM_PROPERTY_ID_BASE		0x6000
+#define	OCSIM_PROPERTY_MAX		1024
+#define	OCSIM_PROPERTY_MAX_SIZE		0x2000
+#define	OCSIM_PROPERTY_BATCH_SIZE	0x6000
+#define	OCSIM_PROPERTY_NAME		"OpenChangeSim-%04X-%u"
+
+/**
+   Daemon mode
+ */
+#define	DEFAULT_DAEMON_SOCKET		"%s/.openchange/openchangesim/openchangesim.sock"
+#define	OCSIM_VAR_DAEMON_SOCKET		"daemon_socket"
+#define	OCSIM_DAEMON_LINE		4096
+#define	OCSIM_DAEMON_RUN		"RUN"
+#define	OCSIM_DAEMON_QUIT		"QUIT"
+#define	OCSIM_DAEMON_OK			"OK"
+#define	OCSIM_DAEMON_ERROR		"ERROR"
+
+/**
+   Compiled profile snapshot format
+ */
+#define	OCSIM_SNAPSHOT_PATH		"%s.snapshot"
+#define	OCSIM_SNAPSHOT_MAGIC		"OCSIMPRF"
+#define	OCSIM_SNAPSHOT_VERSION		1
+#define	OCSIM_SNAPSHOT_NULL		0xFFFFFFFF
 
 #define FPUTS(s, f) fprintf((f), "%s", (s))
 
+/**
+   Time a MAPI call and aggregate its duration and status into the
+   operation log
+ */
+#define	OCSIM_LOG_CALL(log, retval, fn, args)			\
+do {								\
+	openchangesim_log_call_start(log);			\
+	retval = fn args;					\
+	openchangesim_log_call_end(log, #fn, retval);		\
+} while (0)
+
 extern struct poptOption popt_openchange_version[];
 
 #define	POPT_OPENCHANGE_VERSION { NULL, 0, POPT_ARG_INCLUDE_TABLE, popt_openchange_version, 0, "Common openchange options:", NULL },
 
+/**
+   Aggregated timing of a MAPI call within a single operation
+ */
+struct ocsim_log_call
+{
+	const char		*name;
+	uint32_t		count;
+	uint64_t		usec;
+	uint64_t		max_usec;
+	enum MAPISTATUS		retval;
+};
+
 struct ocsim_log
 {
 	struct timeval		tv_start;
 	struct timeval		tv_end;
+	struct timeval		tv_call;
+	enum MAPISTATUS		retval;
+	uint32_t		throttled;
+	bool			throttle_pending;
+	uint64_t		throttle_usec;
+	uint32_t		call_count;
+	uint32_t		call_dropped;
+	struct ocsim_log_call	calls[OCSIM_LOG_MAX_CALLS];
+	uint32_t		msg_count;
+	uint64_t		msg_bytes;
+	uint64_t		msg_id[OCSIM_LOG_MAX_MSGS];
+	uint64_t		msg_size[OCSIM_LOG_MAX_MSGS];
+};
+
+/**
+   Latency histogram shared between all forked clients
+ */
+struct ocsim_histogram
+{
+	char			name[OCSIM_STATS_NAME_LEN];
+	uint64_t		count;
+	uint64_t		errors;
+	uint64_t		sum;
+	uint64_t		min;
+	uint64_t		max;
+	uint64_t		throttled;
+	uint64_t		throttle_usec;
+	uint64_t		bytes;
+	uint64_t		cpu_usec;
+	uint64_t		buckets[OCSIM_HISTOGRAM_BUCKETS];
+	uint64_t		slot_ops[OCSIM_STATS_SLOTS];
+	uint64_t		slot_throttled[OCSIM_STATS_SLOTS];
+	uint64_t		slot_throttle_usec[OCSIM_STATS_SLOTS];
+};
+
+struct ocsim_stats
+{
+	struct timeval		tv_start;
+	uint32_t		interval;
+	uint32_t		count;
+	struct ocsim_histogram	histograms[OCSIM_STATS_MAX];
+};
+
+/**
+   Compiled profile snapshot: header, one record per user of the range,
+   then the string pool the records point into
+ */
+enum ocsim_roster_field {
+	OCSIM_ROSTER_USERNAME = 0,
+	OCSIM_ROSTER_PASSWORD,
+	OCSIM_ROSTER_MAILBOX,
+	OCSIM_ROSTER_SOURCE_IP,
+	OCSIM_ROSTER_GROUP,
+	OCSIM_ROSTER_FIELDS
+};
+
+enum ocsim_snapshot_string {
+	OCSIM_SNAPSHOT_PROFNAME = 0,
+	OCSIM_SNAPSHOT_USERNAME,
+	OCSIM_SNAPSHOT_PASSWORD,
+	OCSIM_SNAPSHOT_MAILBOX,
+	OCSIM_SNAPSHOT_WORKSTATION,
+	OCSIM_SNAPSHOT_DOMAIN,
+	OCSIM_SNAPSHOT_REALM,
+	OCSIM_SNAPSHOT_SERVER,
+	OCSIM_SNAPSHOT_HOMEMDB,
+	OCSIM_SNAPSHOT_LOCALADDR,
+	OCSIM_SNAPSHOT_ORG,
+	OCSIM_SNAPSHOT_OU,
+	OCSIM_SNAPSHOT_KERBEROS,
+	OCSIM_SNAPSHOT_STRINGS
+};
+
+struct ocsim_snapshot_header
+{
+	char			magic[8];
+	uint32_t		version;
+	uint32_t		count;
+	uint32_t		range_start;
+	uint32_t		strings_size;
+};
+
+struct ocsim_snapshot_profile
+{
+	uint32_t		str[OCSIM_SNAPSHOT_STRINGS];
+	uint32_t		seal;
+	uint32_t		codepage;
+	uint32_t		language;
+	uint32_t		method;
+	uint32_t		exchange_version;
+};
+
+/**
+   Tail sample: full context of an operation kept for outlier analysis
+ */
+struct ocsim_tail_sample
+{
+	uint64_t		usec;
+	char			scenario[32];
+	char			case_name[64];
+	char			clientIP[64];
+	struct ocsim_log	log;
+};
+
+/**
+   Virtual interface created for a client source address
+ */
+struct ocsim_interface
+{
+	int			fd;
+	char			name[OCSIM_IFNAMSIZ];
+};
+
+/**
+   Network conditions emulated for a group of users
+ */
+struct ocsim_network
+{
+	const char		*name;
+	uint32_t		range_start;
+	uint32_t		range_end;
+	uint32_t		latency;	/* ms */
+	uint32_t		jitter;		/* ms */
+	const char		*loss;		/* percent */
+	uint32_t		bandwidth;	/* kbit/s */
+	struct ocsim_network	*prev;
+	struct ocsim_network	*next;
 };
 
 struct ocsim_var
@@ -101,6 +469,17 @@ struct ocsim_var
 	struct ocsim_var	*next;
 };
 
+/**
+   Source address range: the first address and the number of
+   addresses, any index maps to its address in constant time
+ */
+struct ocsim_ip_range
+{
+	int			family;
+	uint8_t			start[16];
+	uint32_t		count;
+};
+
 struct ocsim_server
 {
 	const char		*name;
@@ -110,15 +489,15 @@ struct ocsim_server
 	uint32_t		version;
 	const char		*generic_user;
 	const char		*generic_password;
+	const char		*users_file;
 	bool			range;
 	uint32_t		range_start;
 	uint32_t		range_end;
-	uint8_t			*ip_start;
-	uint8_t			*ip_end;
-	uint8_t			ip_current[4];
+	struct ocsim_ip_range	*ip_range;
 	uint32_t		ip_number;
 	uint32_t		ip_used;
-	int				*interfaces_fd;
+	struct ocsim_interface	*interfaces;
+	uint32_t		profile_changes;
 	
 	struct ocsim_var	*vars;
 	struct ocsim_server	*prev;
@@ -131,7 +510,93 @@ enum ocsim_scenario_body_type {
 	OCSIM_BODY_HTML_INLINE,
 	OCSIM_BODY_UTF8_FILE,
 	OCSIM_BODY_HTML_FILE,
-	OCSIM_BODY_RTF_FILE
+	OCSIM_BODY_RTF_FILE,
+	OCSIM_BODY_GENERATED
+};
+
+enum ocsim_generator_content
+{
+	OCSIM_GENERATOR_TEXT = 0,
+	OCSIM_GENERATOR_HTML,
+	OCSIM_GENERATOR_COMPRESSIBLE,
+	OCSIM_GENERATOR_RANDOM
+};
+
+enum ocsim_recipient_policy
+{
+	OCSIM_RECIPIENT_SELF = 0,
+	OCSIM_RECIPIENT_UNIFORM,
+	OCSIM_RECIPIENT_ZIPF
+};
+
+enum ocsim_generator_distribution
+{
+	OCSIM_GENERATOR_FIXED = 0,
+	OCSIM_GENERATOR_UNIFORM,
+	OCSIM_GENERATOR_LOGNORMAL,
+	OCSIM_GENERATOR_HISTOGRAM
+};
+
+/**
+   Parsed content generator. The buffer is allocated by the client on
+   first use and reused for every message.
+ */
+struct ocsim_generator
+{
+	enum ocsim_generator_content		content;
+	enum ocsim_generator_distribution	distribution;
+	uint32_t				size;		/* fixed size, uniform minimum or lognormal median */
+	uint32_t				max;		/* uniform maximum */
+	double					sigma;		/* lognormal shape */
+	uint32_t				bins;
+	uint32_t				*sizes;		/* histogram sizes */
+	uint64_t				*weights;	/* histogram cumulative weights */
+	uint8_t					*buffer;
+	uint32_t				allocated;
+};
+
+/**
+   Property values built once per sendmail case. Named properties
+   follow the standard ones, their identifiers are set once resolved
+   on the client mailbox.
+ */
+struct ocsim_property_set
+{
+	uint32_t			count;
+	uint32_t			named_count;
+	struct SPropValue		*props;
+	const char			**names;
+	bool				resolved;
+};
+
+/**
+   Message compiled once per sendmail case: the properties set on
+   every message followed by the extra ones, the body streamed if any
+   and the generated attachment names. The subject and default body
+   depend on the client mailbox and are patched on its first message.
+ */
+struct ocsim_message_template
+{
+	struct SPropValue		*props;
+	uint32_t			prop_count;
+	uint32_t			subject_index;
+	uint32_t			body_index;	/* default body, prop_count if none */
+	uint32_t			named_index;	/* first named property */
+	uint32_t			batch_count;	/* SetProps requests */
+	uint32_t			*batch_start;	/* first property of each request */
+	uint32_t			body_tag;	/* streamed body, 0 if none */
+	struct Binary_r			body;		/* unless generated */
+	uint64_t			size;		/* body and attachment files bytes */
+	char				**generated_names;
+	char				**large_names;	/* NULL for large files */
+	bool				prepared;
+};
+
+struct ocsim_large_object
+{
+	const char			*path;		/* NULL for generated content */
+	enum ocsim_generator_content	content;
+	uint64_t			size;
 };
 
 /**
@@ -142,8 +607,34 @@ struct ocsim_scenario_sendmail
 	enum ocsim_scenario_body_type	body_type;
 	char				*body_file;
 	char				*body_inline;
+	uint32_t			body_inline_length;
 	uint32_t			attachment_count;
 	char				**attachments;
+	char				*body_generator;
+	uint32_t			generator_count;
+	char				**generators;
+	uint32_t			large_count;
+	char				**larges;
+	uint32_t			property_count;
+	uint32_t			named_count;
+	char				*property_profile;
+	enum ocsim_recipient_policy	recipient_policy;
+	double				zipf_exponent;
+	uint32_t			recipient_count;
+	uint32_t			list_count;
+	char				**lists;
+	uint32_t			batch;
+	/* cumulative weights set by openchangesim_recipients_init() */
+	double				*zipf_weights;
+	/* contents set by openchangesim_content_init() */
+	struct Binary_r			body_content;
+	struct Binary_r			*attachment_contents;
+	struct ocsim_generator		*gen_body;
+	struct ocsim_generator		**gen_attachments;
+	struct ocsim_large_object	*large_objects;
+	struct ocsim_property_set	*properties;
+	/* compiled by openchangesim_template_compile() */
+	struct ocsim_message_template	*message_template;
 };
 
 struct ocsim_scenario_case
@@ -158,6 +649,9 @@ struct ocsim_scenario
 {
 	const char			*name;
 	uint32_t			repeat;
+	uint32_t			chunk_count;
+	uint32_t			chunk_sizes[OCSIM_STREAM_MAX_SWEEP];
+	uint32_t			chunk_next;
 	struct ocsim_scenario_case	*cases;
 	struct ocsim_scenario		*prev;
 	struct ocsim_scenario		*next;
@@ -177,6 +671,19 @@ struct ocsim_generic_scenario_case
 	char					*body_inline;
 	uint32_t				attachment_count;
 	char					**attachments;
+	char					*body_generator;
+	uint32_t				generator_count;
+	char					**generators;
+	uint32_t				large_count;
+	char					**larges;
+	uint32_t				property_count;
+	uint32_t				named_count;
+	char					*property_profile;
+	char					*recipients;
+	uint32_t				recipient_count;
+	uint32_t				list_count;
+	char					**lists;
+	uint32_t				batch;
 	struct ocsim_generic_scenario_case	*prev;
 	struct ocsim_generic_scenario_case	*next;
 };
@@ -185,9 +692,31 @@ struct ocsim_generic_scenario
 {
 	const char				*name;
 	uint32_t				repeat;
+	char					*chunk_size;
 	struct ocsim_generic_scenario_case	*case_el;
 };
 
+/**
+   A transaction is a named sequence of module runs measured end to
+   end. A step runs all the cases of a module, or a single named case.
+ */
+struct ocsim_transaction_step
+{
+	char				*module;
+	char				*case_name;
+	struct ocsim_transaction_step	*prev;
+	struct ocsim_transaction_step	*next;
+};
+
+struct ocsim_transaction
+{
+	const char			*name;
+	uint32_t			repeat;
+	struct ocsim_transaction_step	*steps;
+	struct ocsim_transaction	*prev;
+	struct ocsim_transaction	*next;
+};
+
 struct ocsim_module
 {
 	struct ocsim_module		*prev;		/* !< Pointer to the previous module */
@@ -209,6 +738,8 @@ struct ocsim_context
 	struct ocsim_server			*server_el;
 	struct ocsim_generic_scenario		*scenario_el;
 	struct ocsim_generic_scenario_case	*case_el;
+	struct ocsim_transaction		*transaction_el;
+	struct ocsim_network			*network_el;
 	unsigned int				lineno;
 	int					result;
 	/* ocsim */
@@ -216,6 +747,8 @@ struct ocsim_context
 	struct ocsim_scenario			*scenarios;
 	struct ocsim_var			*options;
 	struct ocsim_module			*modules;
+	struct ocsim_transaction		*transactions;
+	struct ocsim_network			*networks;
 	/* context */
 	FILE					*fp;
 	const char				*filename;
@@ -257,30 +790,99 @@ int openchangesim_do_debug(struct ocsim_context *, const char *, ...);
 int configuration_add_server(struct ocsim_context *, struct ocsim_server *);
 int configuration_add_scenario(struct ocsim_context *, struct ocsim_generic_scenario *);
 int configuration_add_generic_scenario_case(struct ocsim_generic_scenario *, struct ocsim_generic_scenario_case *);
-uint8_t *configuration_get_ip(TALLOC_CTX *, const char *);
-uint32_t configuration_get_ip_count(uint8_t *, uint8_t *);
+struct ocsim_ip_range *configuration_get_ip_range(TALLOC_CTX *, const char *, const char *);
+struct ocsim_ip_range *configuration_get_ip_prefix(TALLOC_CTX *, const char *);
+bool configuration_get_ip_at(struct ocsim_ip_range *, uint32_t, char *, size_t);
+char **configuration_get_ip_prefixes(TALLOC_CTX *, struct ocsim_ip_range *, uint32_t, uint32_t);
+
+int configuration_add_var(struct ocsim_context *, const char *, const char *);
+const char *configuration_get_var(struct ocsim_context *, const char *);
+uint32_t configuration_get_var_int(struct ocsim_context *, const char *, uint32_t);
+int configuration_add_transaction(struct ocsim_context *, struct ocsim_transaction *);
+int configuration_add_transaction_step(struct ocsim_transaction *, const char *, const char *);
+int configuration_add_network(struct ocsim_context *, struct ocsim_network *);
 
 /* The following public definitions come from src/configuration_dump.c */
 int configuration_dump_servers(struct ocsim_context *);
 int configuration_dump_servers_list(struct ocsim_context *);
 int configuration_dump_scenarios(struct ocsim_context *);
+int configuration_dump_transactions(struct ocsim_context *);
+int configuration_dump_networks(struct ocsim_context *);
 struct ocsim_server *configuration_validate_server(struct ocsim_context *, const char *);
 struct ocsim_scenario *configuration_validate_scenario(struct ocsim_context *, const char *);
 
 /* The following public definitions come from src/openchangesim.c */
 void openchangesim_printlog(FILE *, const char *);
 int openchangesim_profile(struct mapi_context *, struct ocsim_context *, const char *);
-enum MAPISTATUS openchangesim_DuplicateProfile(struct mapi_context *, TALLOC_CTX *, char *, struct ocsim_server *);
-enum MAPISTATUS openchangesim_CreateProfile(struct mapi_context *, TALLOC_CTX *, struct ocsim_server *, char *, const char *);
+enum MAPISTATUS openchangesim_DuplicateProfile(struct mapi_context *, TALLOC_CTX *, char *, struct ocsim_server *, uint32_t);
+int openchangesim_SyntheticProfiles(struct mapi_context *, struct ocsim_context *, char *, struct ocsim_server *, uint32_t);
+enum MAPISTATUS openchangesim_CreateProfile(struct mapi_context *, TALLOC_CTX *, struct ocsim_server *, char *, const char *, const char *);
 uint32_t callback(struct SRowSet *, void *);
 
 /* The following public definitions come from src/openchangesim_interface.c */
 void openchangesim_interface_get_next_ip(struct ocsim_server *, bool);
+char *openchangesim_interface_get_ip(TALLOC_CTX *, struct ocsim_server *, uint32_t);
 void openchangesim_release_ip(struct ocsim_server *);
-int openchangesim_create_interface_tap(TALLOC_CTX *, int *, const char *);
-int openchangesim_delete_interface_tap(TALLOC_CTX *, int);
+int openchangesim_create_interface_tap(TALLOC_CTX *, struct ocsim_interface *, const char *);
+int openchangesim_delete_interface_tap(TALLOC_CTX *, struct ocsim_interface *);
+int openchangesim_create_interfaces(FILE *, struct ocsim_interface *, char **, uint32_t, uint32_t);
+int openchangesim_delete_interfaces_tap(FILE *, struct ocsim_interface *, uint32_t, uint32_t);
 int openchangesim_delete_interfaces(struct ocsim_context *, const char *);
 
+/* The following public definitions come from src/openchangesim_netlink.c */
+int openchangesim_netlink_init(struct ocsim_context *);
+bool openchangesim_netlink_enabled(void);
+int openchangesim_netlink_add(FILE *, struct ocsim_interface *, char **, uint32_t);
+int openchangesim_netlink_release(void);
+int openchangesim_netlink_cleanup(TALLOC_CTX *, const char *, bool, char **, uint32_t);
+
+/* The following public definitions come from src/openchangesim_network.c */
+int openchangesim_network_apply(struct ocsim_context *, const char *);
+int openchangesim_network_cleanup(const char *);
+int openchangesim_network_release(void);
+
+/* The following public definitions come from src/openchangesim_journal.c */
+int openchangesim_journal_open(struct ocsim_context *, const char *);
+void openchangesim_journal_record(const char *, const char *, const char *);
+void openchangesim_journal_close(bool);
+int openchangesim_journal_replay(struct ocsim_context *, const char *);
+
+/* The following public definitions come from src/openchangesim_content.c */
+int openchangesim_content_init(struct ocsim_context *, bool);
+void openchangesim_content_release(void);
+
+/* The following public definitions come from src/openchangesim_generator.c */
+struct ocsim_generator *openchangesim_generator_parse(TALLOC_CTX *, const char *);
+void openchangesim_generator_seed(struct ocsim_context *, uint32_t);
+bool openchangesim_generator_fill(struct ocsim_generator *, struct Binary_r *);
+const char *openchangesim_generator_extension(enum ocsim_generator_content);
+uint64_t openchangesim_generator_random(void);
+bool openchangesim_generator_large(const char *, struct ocsim_large_object *);
+void openchangesim_generator_chunk(struct ocsim_large_object *, uint8_t *, uint32_t);
+
+/* The following public definitions come from src/openchangesim_properties.c */
+struct ocsim_property_set *openchangesim_properties_build(TALLOC_CTX *, uint32_t, uint32_t, const char *);
+enum MAPISTATUS openchangesim_properties_resolve(struct ocsim_log *, struct mapi_session *, struct ocsim_property_set *);
+
+/* The following public definitions come from src/openchangesim_recipients.c */
+int openchangesim_recipients_init(struct ocsim_context *, struct ocsim_server *);
+enum MAPISTATUS openchangesim_recipients_resolve(TALLOC_CTX *, struct ocsim_log *, struct mapi_session *, const char **, struct SRowSet **);
+enum MAPISTATUS openchangesim_recipients_select(TALLOC_CTX *, struct ocsim_log *, struct mapi_session *, struct ocsim_scenario_sendmail *, struct SRowSet **);
+
+/* The following public definitions come from src/openchangesim_session.c */
+enum MAPISTATUS openchangesim_session_store(struct ocsim_log *, struct mapi_session *, mapi_object_t **);
+enum MAPISTATUS openchangesim_session_folder(struct ocsim_log *, struct mapi_session *, uint32_t, mapi_id_t *, mapi_object_t **);
+enum MAPISTATUS openchangesim_session_self(struct ocsim_log *, struct mapi_session *, struct SRowSet **);
+void openchangesim_session_invalidate(void);
+
+/* The following public definitions come from src/openchangesim_template.c */
+int openchangesim_template_compile(struct ocsim_scenario_sendmail *);
+enum MAPISTATUS openchangesim_template_prepare(struct ocsim_log *, struct mapi_session *, struct ocsim_scenario_sendmail *);
+
+/* The following public definitions come from src/openchangesim_daemon.c */
+int openchangesim_daemon_run(struct ocsim_context *, struct mapi_context *, const char *, const char *);
+int openchangesim_daemon_submit(const char *, const char *);
+
 /* The following public definitions come from src/openchangesim_fork.c */
 uint32_t openchangesim_fork_process_start(struct ocsim_context *, struct mapi_context *, const char *);
 uint32_t openchangesim_fork_process_end(struct ocsim_context *, const char *);
@@ -294,14 +896,81 @@ uint32_t module_get_ref_count(struct ocsim_module *);
 uint32_t module_set_ref_count(struct ocsim_module *, int);
 struct ocsim_scenario *module_get_scenario(struct ocsim_context *, const char *);
 struct ocsim_scenario_case *module_get_scenario_data(struct ocsim_context *, const char *);
+void openchangesim_module_chunk_init(struct ocsim_context *, struct ocsim_scenario *, const char *);
+uint32_t openchangesim_module_chunk_size(struct ocsim_scenario *);
+uint32_t openchangesim_register_transactions(struct ocsim_context *);
 uint32_t openchangesim_modules_run(struct ocsim_context *, struct mapi_context *, char *);
 
 /* The following public definitions come from src/openchangesim_logs.c */
 struct ocsim_log *openchangesim_log_init(TALLOC_CTX *);
 void openchangesim_log_start(struct ocsim_log *);
-void openchangesim_log_end(struct ocsim_log *, char *, char *, const char *);
+uint64_t openchangesim_log_end(struct ocsim_log *, char *, char *, const char *);
 void openchangesim_log_close(struct ocsim_log *);
 void openchangesim_log_string(const char *, ...);
+void openchangesim_log_call_start(struct ocsim_log *);
+void openchangesim_log_call_end(struct ocsim_log *, const char *, enum MAPISTATUS);
+void openchangesim_log_message(struct ocsim_log *, uint64_t, uint64_t);
+
+/* The following public definitions come from src/openchangesim_stats.c */
+int openchangesim_stats_init(struct ocsim_context *);
+void openchangesim_stats_release(void);
+void openchangesim_stats_start(void);
+void openchangesim_stats_reset(struct ocsim_context *);
+int openchangesim_stats_lookup(const char *);
+int openchangesim_stats_register(const char *);
+void openchangesim_stats_record(int, uint64_t, bool);
+void openchangesim_stats_record_name(const char *, uint64_t, bool);
+void openchangesim_stats_record_throttle(int, uint32_t, uint64_t);
+void openchangesim_stats_record_bytes(int, uint64_t, uint64_t);
+void openchangesim_stats_record_stream(const char *, uint32_t, bool, uint64_t, uint64_t, uint64_t, bool);
+uint64_t openchangesim_stats_cpu_usec(void);
+void openchangesim_stats_dump(void);
+uint64_t openchangesim_stats_elapsed(void);
+
+/* The following public definitions come from src/openchangesim_logon.c */
+int openchangesim_logon_register(void);
+int openchangesim_logon_tcp_probe(const char *, const char *);
+enum MAPISTATUS openchangesim_logon(struct mapi_context *, struct ocsim_log *, struct mapi_session **, const char *);
+void openchangesim_logoff(struct mapi_context *, struct mapi_session **);
+enum MAPISTATUS openchangesim_logon_store(struct ocsim_log *, struct mapi_session *, mapi_object_t *);
+
+/* The following public definitions come from src/openchangesim_throttle.c */
+void openchangesim_throttle_init(struct ocsim_context *);
+bool openchangesim_throttle_check(enum MAPISTATUS);
+bool openchangesim_throttle_backoff(struct ocsim_log *, uint32_t);
+
+/* The following public definitions come from src/openchangesim_host.c */
+int openchangesim_host_init(struct ocsim_context *, const char *);
+void openchangesim_host_sample(void);
+void openchangesim_host_wait(struct ocsim_context *);
+void openchangesim_host_dump(void);
+
+/* The following public definitions come from src/openchangesim_snapshot.c */
+int openchangesim_snapshot_compile(struct mapi_context *, struct ocsim_context *, const char *, const char *);
+int openchangesim_snapshot_load(const char *, uint32_t, uint32_t);
+void openchangesim_snapshot_release(void);
+bool openchangesim_snapshot_select(uint32_t, const char *);
+bool openchangesim_snapshot_fill(struct mapi_profile *, const char *);
+
+/* The following public definitions come from src/openchangesim_synthetic.c */
+bool openchangesim_synthetic_enabled(struct ocsim_context *);
+int openchangesim_synthetic_init(struct mapi_context *, struct ocsim_context *, struct ocsim_server *, const char *, char **);
+bool openchangesim_synthetic_select(uint32_t, const char *);
+bool openchangesim_synthetic_fill(struct mapi_profile *, const char *);
+
+/* The following public definitions come from src/openchangesim_roster.c */
+bool openchangesim_roster_enabled(void);
+int openchangesim_roster_init(struct ocsim_context *, const char *);
+uint32_t openchangesim_roster_addresses(void);
+const char *openchangesim_roster_get(uint32_t, enum ocsim_roster_field);
+char *openchangesim_roster_ip(TALLOC_CTX *, struct ocsim_server *, uint32_t);
+char **openchangesim_roster_prefixes(TALLOC_CTX *, struct ocsim_server *, struct ocsim_network *);
+void openchangesim_roster_release(void);
+
+/* The following public definitions come from src/openchangesim_tail.c */
+int openchangesim_tail_init(struct ocsim_context *, const char *);
+void openchangesim_tail_add(struct ocsim_log *, uint64_t, const char *, const char *, const char *);
+void openchangesim_tail_dump(void);
 
 /* The following public definitions come from src/modules/module_fetchmail.c */
 uint32_t module_fetchmail_init(struct ocsim_context *);
@@ -0,0 +1,281 @@
+/*
+   OpenChangeSim content cache
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_content.c
+
+   \brief Body and attachment files mapped once by the parent
+
+   The files referenced by the sendmail scenarios are mapped read-only
+   by the parent before the clients are forked. Each sendmail case
+   points to its contents in the mappings, so clients send them without
+   opening or reading any file, and the pages come from the page cache
+   shared by every client. A file referenced by several cases is mapped
+   once. The content generators, large attachments and extra
+   properties of the cases are prepared here as well, so that an
+   invalid one fails before the clients start, and each case is then
+   compiled into its message template.
+ */
+
+#include <fcntl.h>
+
+#include "src/openchangesim.h"
+
+struct ocsim_content_file
+{
+	const char	*path;
+	size_t		size;
+	uint8_t		*data;
+};
+
+struct ocsim_content
+{
+	struct ocsim_content_file	*files;
+	uint32_t			count;
+};
+
+static struct ocsim_content	*content = NULL;
+
+
+static struct ocsim_content_file *openchangesim_content_add(struct ocsim_content *loaded, const char *path)
+{
+	struct ocsim_content_file	*file;
+	struct stat			sb;
+	uint32_t			i;
+
+	for (i = 0; i < loaded->count; i++) {
+		if (!strcmp(loaded->files[i].path, path)) {
+			return &loaded->files[i];
+		}
+	}
+
+	if (stat(path, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, path, DEBUG_ERR_CONTENT_FILE));
+		return NULL;
+	}
+
+	file = talloc_realloc(loaded, loaded->files, struct ocsim_content_file, loaded->count + 1);
+	if (!file) return NULL;
+	loaded->files = file;
+
+	file = &loaded->files[loaded->count++];
+	file->path = talloc_strdup(loaded->files, path);
+	file->size = sb.st_size;
+	file->data = NULL;
+
+	return file;
+}
+
+
+static bool openchangesim_content_map(struct ocsim_content_file *file)
+{
+	void	*data;
+	int	fd;
+
+	if (!file->size) return true;
+
+	fd = open(file->path, O_RDONLY);
+	if (fd == -1) {
+		perror(file->path);
+		return false;
+	}
+
+	data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror(file->path);
+		return false;
+	}
+	file->data = data;
+
+	return true;
+}
+
+
+static void openchangesim_content_unmap(struct ocsim_content *loaded)
+{
+	uint32_t	i;
+
+	for (i = 0; i < loaded->count; i++) {
+		if (loaded->files[i].data) {
+			munmap(loaded->files[i].data, loaded->files[i].size);
+		}
+	}
+	talloc_free(loaded);
+}
+
+
+/**
+   \details Map the files referenced by the sendmail scenarios
+
+   Must be called by the parent before forking. The contents of a
+   previous call are released once the new ones are mapped.
+
+   \param ctx pointer to the OpenChangeSim context
+   \param check whether to only check the files exist, as --confcheck
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR if a file is
+   missing or can't be read
+ */
+int openchangesim_content_init(struct ocsim_context *ctx, bool check)
+{
+	struct ocsim_scenario		*el;
+	struct ocsim_scenario_case	*scase;
+	struct ocsim_scenario_sendmail	*sendmail;
+	struct ocsim_content		*loaded;
+	struct ocsim_content_file	*file;
+	struct Binary_r			*bin;
+	uint32_t			i;
+	size_t				size = 0;
+	char				logstr[128];
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+
+	loaded = talloc_zero(ctx->mem_ctx, struct ocsim_content);
+	OCSIM_RETVAL_IF(!loaded, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+
+	/* Collect the files of every sendmail case, each one once */
+	for (el = ctx->scenarios; el; el = el->next) {
+		if (!el->name || strcasecmp(el->name, SENDMAIL_MODULE_NAME)) continue;
+
+		for (scase = el->cases; scase; scase = scase->next) {
+			sendmail = (struct ocsim_scenario_sendmail *) scase->private_data;
+			if (!sendmail) continue;
+
+			if (sendmail->body_file && !openchangesim_content_add(loaded, sendmail->body_file)) {
+				goto error;
+			}
+			for (i = 0; i < sendmail->attachment_count; i++) {
+				if (!openchangesim_content_add(loaded, sendmail->attachments[i])) goto error;
+			}
+
+			/* Generated contents are produced by the clients */
+			talloc_free(sendmail->gen_body);
+			sendmail->gen_body = NULL;
+			if (sendmail->body_type == OCSIM_BODY_GENERATED) {
+				sendmail->gen_body = openchangesim_generator_parse(sendmail, sendmail->body_generator);
+				if (!sendmail->gen_body) goto error;
+				if (sendmail->gen_body->content == OCSIM_GENERATOR_RANDOM) {
+					DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, sendmail->body_generator,
+						  DEBUG_ERR_GENERATOR_BODY));
+					goto error;
+				}
+			}
+			talloc_free(sendmail->gen_attachments);
+			sendmail->gen_attachments = talloc_zero_array(sendmail, struct ocsim_generator *,
+								      sendmail->generator_count + 1);
+			if (!sendmail->gen_attachments) goto error;
+			for (i = 0; i < sendmail->generator_count; i++) {
+				sendmail->gen_attachments[i] = openchangesim_generator_parse(sendmail->gen_attachments,
+											     sendmail->generators[i]);
+				if (!sendmail->gen_attachments[i]) goto error;
+			}
+
+			/* Large attachments are streamed chunk by chunk */
+			talloc_free(sendmail->large_objects);
+			sendmail->large_objects = talloc_zero_array(sendmail, struct ocsim_large_object,
+								    sendmail->large_count + 1);
+			if (!sendmail->large_objects) goto error;
+			for (i = 0; i < sendmail->large_count; i++) {
+				if (!openchangesim_generator_large(sendmail->larges[i],
+								   &sendmail->large_objects[i])) goto error;
+			}
+
+			/* Extra properties are built once per case */
+			talloc_free(sendmail->properties);
+			sendmail->properties = NULL;
+			if (sendmail->property_count || sendmail->named_count) {
+				sendmail->properties = openchangesim_properties_build(sendmail, sendmail->property_count,
+										      sendmail->named_count,
+										      sendmail->property_profile);
+				if (!sendmail->properties) goto error;
+			}
+		}
+	}
+
+	for (i = 0; i < loaded->count; i++) {
+		size += loaded->files[i].size;
+		if (!check && !openchangesim_content_map(&loaded->files[i])) goto error;
+	}
+
+	if (check) {
+		openchangesim_content_unmap(loaded);
+		return OCSIM_SUCCESS;
+	}
+
+	/* Point every case to its contents */
+	for (el = ctx->scenarios; el; el = el->next) {
+		if (!el->name || strcasecmp(el->name, SENDMAIL_MODULE_NAME)) continue;
+
+		for (scase = el->cases; scase; scase = scase->next) {
+			sendmail = (struct ocsim_scenario_sendmail *) scase->private_data;
+			if (!sendmail) continue;
+
+			memset(&sendmail->body_content, 0, sizeof (struct Binary_r));
+			if (sendmail->body_file) {
+				file = openchangesim_content_add(loaded, sendmail->body_file);
+				sendmail->body_content.cb = file->size;
+				sendmail->body_content.lpb = file->data;
+			}
+
+			talloc_free(sendmail->attachment_contents);
+			sendmail->attachment_contents = talloc_zero_array(sendmail, struct Binary_r,
+									  sendmail->attachment_count + 1);
+			if (!sendmail->attachment_contents) goto error;
+			for (i = 0; i < sendmail->attachment_count; i++) {
+				file = openchangesim_content_add(loaded, sendmail->attachments[i]);
+				bin = &sendmail->attachment_contents[i];
+				bin->cb = file->size;
+				bin->lpb = file->data;
+			}
+
+			if (openchangesim_template_compile(sendmail) != OCSIM_SUCCESS) goto error;
+		}
+	}
+
+	openchangesim_content_release();
+	content = loaded;
+
+	if (loaded->count) {
+		snprintf(logstr, sizeof (logstr), "[*] %d content files mapped (%.2f MB)\n",
+			 loaded->count, size / 1048576.0);
+		openchangesim_printlog(stdout, logstr);
+	}
+
+	return OCSIM_SUCCESS;
+
+error:
+	openchangesim_content_unmap(loaded);
+	return OCSIM_ERROR;
+}
+
+
+/**
+   \details Release the contents mapped by openchangesim_content_init()
+ */
+void openchangesim_content_release(void)
+{
+	if (!content) return;
+
+	openchangesim_content_unmap(content);
+	content = NULL;
+}
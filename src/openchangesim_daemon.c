@@ -0,0 +1,453 @@
+/*
+   OpenChangeSim daemon mode
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_daemon.c
+
+   \brief Run successive jobs against the same profiles and interfaces
+
+   In daemon mode the parent performs the profile, interface, network
+   and snapshot steps once, then waits for jobs on a local socket
+   (daemon_socket). Each job forks a fresh set of clients from the
+   warm parent, so they inherit the MAPI context and the snapshot
+   without redoing any setup.
+
+   A client sends a single line:
+
+   - RUN [configuration file]: run a job. The configuration replaces
+     the scenarios, transactions and global variables of the previous
+     job; server and network blocks are ignored since they are set up
+     when the daemon starts. Without a file, the previous job is run
+     again.
+   - QUIT: stop the daemon and delete the interfaces.
+
+   The job output is sent back on the connection, followed by a final
+   "OK <duration in ms>" or "ERROR" line.
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include "src/openchangesim.h"
+
+struct ocsim_daemon_config
+{
+	struct ocsim_server		*servers;
+	struct ocsim_scenario		*scenarios;
+	struct ocsim_transaction	*transactions;
+	struct ocsim_module		*modules;
+	struct ocsim_network		*networks;
+	struct ocsim_var		*options;
+};
+
+
+static void openchangesim_daemon_save(struct ocsim_context *ctx, struct ocsim_daemon_config *config)
+{
+	config->servers = ctx->servers;
+	config->scenarios = ctx->scenarios;
+	config->transactions = ctx->transactions;
+	config->modules = ctx->modules;
+	config->networks = ctx->networks;
+	config->options = ctx->options;
+}
+
+
+static void openchangesim_daemon_restore(struct ocsim_context *ctx, struct ocsim_daemon_config *config)
+{
+	ctx->servers = config->servers;
+	ctx->scenarios = config->scenarios;
+	ctx->transactions = config->transactions;
+	ctx->modules = config->modules;
+	ctx->networks = config->networks;
+	ctx->options = config->options;
+}
+
+
+static void openchangesim_daemon_free(struct ocsim_daemon_config *config)
+{
+	struct ocsim_server		*server;
+	struct ocsim_scenario		*scenario;
+	struct ocsim_transaction	*transaction;
+	struct ocsim_module		*module;
+	struct ocsim_network		*network;
+	struct ocsim_var		*option;
+
+	while ((server = config->servers)) {
+		config->servers = server->next;
+		talloc_free(server);
+	}
+	while ((scenario = config->scenarios)) {
+		config->scenarios = scenario->next;
+		talloc_free(scenario);
+	}
+	while ((transaction = config->transactions)) {
+		config->transactions = transaction->next;
+		talloc_free(transaction);
+	}
+	while ((module = config->modules)) {
+		config->modules = module->next;
+		talloc_free(module);
+	}
+	while ((network = config->networks)) {
+		config->networks = network->next;
+		talloc_free(network);
+	}
+	while ((option = config->options)) {
+		config->options = option->next;
+		talloc_free(option);
+	}
+}
+
+
+/* The parser cursors are children of the server and scenario lists */
+static void openchangesim_daemon_cursors(struct ocsim_context *ctx)
+{
+	ctx->server_el = NULL;
+	ctx->scenario_el = NULL;
+	ctx->case_el = NULL;
+}
+
+
+static int openchangesim_daemon_load(struct ocsim_context *ctx, const char *filename)
+{
+	struct ocsim_daemon_config	previous;
+	struct ocsim_daemon_config	loaded;
+	int				ret = OCSIM_ERROR;
+
+	openchangesim_daemon_save(ctx, &previous);
+
+	/* The job variables replace those of the previous job */
+	ctx->servers = talloc_zero(ctx->mem_ctx, struct ocsim_server);
+	ctx->scenarios = talloc_zero(ctx->mem_ctx, struct ocsim_scenario);
+	ctx->transactions = NULL;
+	ctx->modules = NULL;
+	ctx->networks = NULL;
+	ctx->options = NULL;
+	ctx->lineno = 1;
+	openchangesim_daemon_cursors(ctx);
+
+	if (ctx->servers && ctx->scenarios) {
+		ret = openchangesim_parse_config(ctx, filename);
+	}
+	if (ctx->fp) {
+		fclose(ctx->fp);
+		ctx->fp = NULL;
+	}
+	if (ret == OCSIM_SUCCESS) {
+		ret = openchangesim_register_modules(ctx);
+	}
+	if (ret == OCSIM_SUCCESS) {
+		ret = openchangesim_content_init(ctx, false);
+	}
+
+	openchangesim_daemon_save(ctx, &loaded);
+	if (ret != OCSIM_SUCCESS) {
+		openchangesim_daemon_restore(ctx, &previous);
+		openchangesim_daemon_free(&loaded);
+		openchangesim_daemon_cursors(ctx);
+		return OCSIM_ERROR;
+	}
+
+	/* Servers and network groups are those the daemon started with */
+	ctx->servers = previous.servers;
+	ctx->networks = previous.networks;
+	previous.servers = loaded.servers;
+	previous.networks = loaded.networks;
+	openchangesim_daemon_free(&previous);
+	openchangesim_daemon_cursors(ctx);
+
+	return OCSIM_SUCCESS;
+}
+
+
+static int openchangesim_daemon_job(struct ocsim_context *ctx,
+				    struct mapi_context *mapi_ctx,
+				    const char *server,
+				    const char *filename,
+				    int fd)
+{
+	struct timeval	tv_start;
+	struct timeval	tv_end;
+	int		saved_stdout;
+	int		saved_stderr;
+	int		ret = OCSIM_SUCCESS;
+
+	/* Report the job output to the client */
+	fflush(stdout);
+	fflush(stderr);
+	saved_stdout = dup(STDOUT_FILENO);
+	saved_stderr = dup(STDERR_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
+
+	gettimeofday(&tv_start, NULL);
+	if (filename) {
+		ret = openchangesim_daemon_load(ctx, filename);
+	}
+
+	if (ret == OCSIM_SUCCESS) {
+		openchangesim_stats_reset(ctx);
+		openchangesim_host_init(ctx, server);
+		openchangesim_host_sample();
+		/* stdout is now fully buffered, don't duplicate it in the clients */
+		fflush(stdout);
+		ret = openchangesim_fork_process_start(ctx, mapi_ctx, server);
+		if (ret == OCSIM_SUCCESS) {
+			ret = openchangesim_fork_process_end(ctx, server);
+		}
+		if (ret == OCSIM_SUCCESS) {
+			openchangesim_stats_dump();
+			openchangesim_host_dump();
+		}
+	}
+	gettimeofday(&tv_end, NULL);
+
+	if (ret == OCSIM_SUCCESS) {
+		printf("%s %ld\n", OCSIM_DAEMON_OK, (long)((tv_end.tv_sec - tv_start.tv_sec) * 1000 +
+							  (tv_end.tv_usec - tv_start.tv_usec) / 1000));
+	} else {
+		printf("%s\n", OCSIM_DAEMON_ERROR);
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	dup2(saved_stdout, STDOUT_FILENO);
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stdout);
+	close(saved_stderr);
+
+	return ret;
+}
+
+
+static bool openchangesim_daemon_readline(int fd, char *line, size_t len)
+{
+	size_t	offset = 0;
+	ssize_t	n;
+
+	while (offset < len - 1) {
+		n = read(fd, line + offset, 1);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) break;
+		if (line[offset] == '\n') break;
+		offset++;
+	}
+	line[offset] = '\0';
+	if (offset && line[offset - 1] == '\r') {
+		line[offset - 1] = '\0';
+	}
+
+	return offset > 0;
+}
+
+
+static int openchangesim_daemon_socket(const char *path, bool listening)
+{
+	struct sockaddr_un	addr;
+	int			s;
+
+	if (strlen(path) >= sizeof (addr.sun_path)) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, path, "Socket path too long"));
+		return -1;
+	}
+
+	s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == -1) {
+		perror("socket");
+		return -1;
+	}
+	fcntl(s, F_SETFD, FD_CLOEXEC);
+
+	memset(&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof (addr.sun_path) - 1);
+
+	if (!listening) {
+		if (connect(s, (struct sockaddr *) &addr, sizeof (addr)) == -1) {
+			perror(path);
+			close(s);
+			return -1;
+		}
+		return s;
+	}
+
+	unlink(path);
+	if (bind(s, (struct sockaddr *) &addr, sizeof (addr)) == -1 ||
+	    chmod(path, 0600) == -1 || listen(s, SOMAXCONN) == -1) {
+		perror(path);
+		close(s);
+		return -1;
+	}
+
+	return s;
+}
+
+
+/**
+   \details Wait for jobs on the daemon socket and run them until a
+   QUIT request is received
+
+   The profiles, interfaces and snapshot must be set up before this
+   function is called.
+
+   \param ctx pointer to the OpenChangeSim context
+   \param mapi_ctx pointer to the MAPI context
+   \param server the server name
+   \param path the socket path
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_daemon_run(struct ocsim_context *ctx,
+			     struct mapi_context *mapi_ctx,
+			     const char *server,
+			     const char *path)
+{
+	char	line[OCSIM_DAEMON_LINE];
+	char	logstr[OCSIM_DAEMON_LINE + 64];
+	char	*filename;
+	bool	quit = false;
+	int	s;
+	int	fd;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+	OCSIM_RETVAL_IF(!path, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	s = openchangesim_daemon_socket(path, true);
+	if (s == -1) return OCSIM_ERROR;
+
+	/* A client leaving before the end of its job must not kill us */
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	snprintf(logstr, sizeof (logstr), "[*] Daemon waiting for jobs on %s\n", path);
+	openchangesim_printlog(stdout, logstr);
+
+	while (!quit) {
+		fd = accept(s, NULL, NULL);
+		if (fd == -1) {
+			/* SIGCHLD from the previous job */
+			if (errno == EINTR) continue;
+			perror("accept");
+			break;
+		}
+
+		if (!openchangesim_daemon_readline(fd, line, sizeof (line))) {
+			close(fd);
+			continue;
+		}
+
+		if (!strncmp(line, OCSIM_DAEMON_RUN, strlen(OCSIM_DAEMON_RUN)) &&
+		    (line[strlen(OCSIM_DAEMON_RUN)] == '\0' || line[strlen(OCSIM_DAEMON_RUN)] == ' ')) {
+			filename = line + strlen(OCSIM_DAEMON_RUN);
+			filename += strspn(filename, " ");
+			snprintf(logstr, sizeof (logstr), "[*] Daemon job: %s\n", *filename ? filename : "previous configuration");
+			openchangesim_printlog(stdout, logstr);
+			openchangesim_daemon_job(ctx, mapi_ctx, server, *filename ? filename : NULL, fd);
+		} else if (!strcmp(line, OCSIM_DAEMON_QUIT)) {
+			dprintf(fd, "%s\n", OCSIM_DAEMON_OK);
+			quit = true;
+		} else {
+			dprintf(fd, "%s unknown request\n", OCSIM_DAEMON_ERROR);
+		}
+		close(fd);
+	}
+
+	close(s);
+	unlink(path);
+
+	return quit ? OCSIM_SUCCESS : OCSIM_ERROR;
+}
+
+
+/**
+   \details Submit a job, or a QUIT request, to a running daemon and
+   copy its output to stdout
+
+   \param path the socket path
+   \param filename the job configuration file, NULL to run the
+   previous job again, or "QUIT" to stop the daemon
+
+   \return OCSIM_SUCCESS if the daemon reported success, otherwise
+   OCSIM_ERROR
+ */
+int openchangesim_daemon_submit(const char *path, const char *filename)
+{
+	char	buf[OCSIM_DAEMON_LINE];
+	char	last[OCSIM_DAEMON_LINE];
+	char	*resolved = NULL;
+	char	*p;
+	size_t	offset = 0;
+	ssize_t	n;
+	int	s;
+	int	ret;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!path, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	s = openchangesim_daemon_socket(path, false);
+	if (s == -1) return OCSIM_ERROR;
+
+	if (filename && !strcmp(filename, OCSIM_DAEMON_QUIT)) {
+		ret = dprintf(s, "%s\n", OCSIM_DAEMON_QUIT);
+	} else if (filename) {
+		/* The daemon doesn't share our working directory */
+		resolved = realpath(filename, NULL);
+		if (!resolved) {
+			perror(filename);
+			close(s);
+			return OCSIM_ERROR;
+		}
+		ret = dprintf(s, "%s %s\n", OCSIM_DAEMON_RUN, resolved);
+		free(resolved);
+	} else {
+		ret = dprintf(s, "%s\n", OCSIM_DAEMON_RUN);
+	}
+	if (ret < 0) {
+		perror(path);
+		close(s);
+		return OCSIM_ERROR;
+	}
+
+	/* Keep the last line to find the job status */
+	last[0] = '\0';
+	while ((n = read(s, buf, sizeof (buf))) != 0) {
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		fwrite(buf, 1, n, stdout);
+		for (p = buf; p < buf + n; p++) {
+			if (*p == '\n') {
+				last[offset] = '\0';
+				offset = 0;
+			} else if (offset < sizeof (last) - 1) {
+				last[offset++] = *p;
+			}
+		}
+	}
+	fflush(stdout);
+	close(s);
+
+	return strncmp(last, OCSIM_DAEMON_OK, strlen(OCSIM_DAEMON_OK)) ? OCSIM_ERROR : OCSIM_SUCCESS;
+}
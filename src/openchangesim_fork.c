@@ -110,6 +110,11 @@ uint32_t openchangesim_fork_process_start(struct ocsim_context *ctx, struct mapi
 
 	ctx->pid = talloc_array(ctx, pid_t, range);
 
+	/* Population the sendmail recipients are drawn from */
+	if (openchangesim_recipients_init(ctx, el) != OCSIM_SUCCESS) {
+		return OCSIM_ERROR;
+	}
+
 	ctx->childs = 0;
 	ctx->active_childs = 0;
 	c = ctx;
@@ -138,6 +143,9 @@ uint32_t openchangesim_fork_process_start(struct ocsim_context *ctx, struct mapi
 				mem_ctx = talloc_named(NULL, 0, "fork");
 				profname = talloc_asprintf(mem_ctx, PROFNAME_TEMPLATE_NB,
 							   el->name, el->generic_user, index, el->realm);
+				openchangesim_snapshot_select(index, profname);
+				openchangesim_synthetic_select(index, profname);
+				openchangesim_generator_seed(ctx, index);
 				openchangesim_modules_run(ctx, mapi_ctx, profname);
 				talloc_free(mem_ctx);
 				exit (0);
@@ -160,6 +168,6 @@ uint32_t openchangesim_fork_process_end(struct ocsim_context *ctx, const char *s
 
 	range = el->range_end - el->range_start;
 
-	while(ctx->active_childs);
+	openchangesim_host_wait(ctx);
 	return OCSIM_SUCCESS;
 }
@@ -0,0 +1,518 @@
+/*
+   OpenChangeSim content generator
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_generator.c
+
+   \brief Message bodies and attachments generated on the fly
+
+   A generator is described by "content:distribution":
+
+   - content is text, html, compressible (a short pattern repeated) or
+     random (incompressible data)
+   - distribution is fixed:SIZE, uniform:MIN-MAX,
+     lognormal:MEDIAN:SIGMA or histogram:FILE, FILE having one "SIZE
+     WEIGHT" pair per line
+
+   Sizes and contents are drawn from a xorshift generator seeded with
+   generator_seed and the user index, so a user sends the same
+   sequence of messages on every run. Text is copied from a block of
+   words built once per client and each generator reuses its buffer,
+   which only grows, for every message.
+
+   Large attachments ("content:SIZE") are not generated as a whole but
+   one stream chunk at a time, so their size is not bounded by memory.
+ */
+
+#include <ctype.h>
+#include <math.h>
+
+#include "src/openchangesim.h"
+
+static const char	*openchangesim_generator_words[] = {
+	"the", "meeting", "report", "quarter", "budget", "project", "review", "team",
+	"please", "find", "attached", "update", "schedule", "customer", "and", "of",
+	"to", "for", "with", "next", "week", "regards", "thanks", "status",
+	"draft", "final", "agenda", "notes", "action", "items", "on", "a"
+};
+
+static const char	*openchangesim_generator_extensions[] = { "txt", "html", "dat", "bin" };
+
+struct ocsim_generator_state
+{
+	uint64_t	seed;
+	bool		built;
+	uint8_t		block[OCSIM_GENERATOR_BLOCK];
+};
+
+static struct ocsim_generator_state	*state = NULL;
+
+
+static inline uint64_t openchangesim_generator_next(void)
+{
+	state->seed ^= state->seed >> 12;
+	state->seed ^= state->seed << 25;
+	state->seed ^= state->seed >> 27;
+	return state->seed * 0x2545F4914F6CDD1DULL;
+}
+
+
+static bool openchangesim_generator_number(const char *str, char **end, uint32_t *value)
+{
+	unsigned long long	n;
+
+	if (!str || *str < '0' || *str > '9') return false;
+	errno = 0;
+	n = strtoull(str, end, 10);
+	if (errno || n > OCSIM_GENERATOR_MAX_SIZE) return false;
+	*value = n;
+
+	return true;
+}
+
+
+static bool openchangesim_generator_histogram(struct ocsim_generator *gen, const char *filename)
+{
+	FILE		*f;
+	char		line[256];
+	char		*p;
+	uint32_t	size;
+	uint32_t	weight;
+	uint64_t	total = 0;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		perror(filename);
+		return false;
+	}
+
+	while (fgets(line, sizeof (line), f)) {
+		p = line + strspn(line, " \t");
+		if (*p == '#' || *p == '\n' || *p == '\r' || !*p) continue;
+
+		if (!openchangesim_generator_number(p, &p, &size)) goto error;
+		p += strspn(p, " \t,");
+		weight = 1;
+		if (*p && *p != '\n' && *p != '\r' &&
+		    (!openchangesim_generator_number(p, &p, &weight) || !weight)) goto error;
+
+		gen->sizes = talloc_realloc(gen, gen->sizes, uint32_t, gen->bins + 1);
+		gen->weights = talloc_realloc(gen, gen->weights, uint64_t, gen->bins + 1);
+		if (!gen->sizes || !gen->weights) goto error;
+
+		total += weight;
+		gen->sizes[gen->bins] = size;
+		gen->weights[gen->bins] = total;
+		gen->bins++;
+	}
+	fclose(f);
+
+	return gen->bins != 0;
+
+error:
+	fclose(f);
+	return false;
+}
+
+
+static const char *openchangesim_generator_content_name(const char *spec,
+							enum ocsim_generator_content *content)
+{
+	if (!strncasecmp(spec, "text:", 5)) {
+		*content = OCSIM_GENERATOR_TEXT;
+	} else if (!strncasecmp(spec, "html:", 5)) {
+		*content = OCSIM_GENERATOR_HTML;
+	} else if (!strncasecmp(spec, "compressible:", 13)) {
+		*content = OCSIM_GENERATOR_COMPRESSIBLE;
+	} else if (!strncasecmp(spec, "random:", 7)) {
+		*content = OCSIM_GENERATOR_RANDOM;
+	} else {
+		return NULL;
+	}
+
+	return strchr(spec, ':') + 1;
+}
+
+
+/**
+   \details Parse a content generator description
+
+   \param mem_ctx pointer to the memory context
+   \param spec the generator description
+
+   \return allocated generator on success, otherwise NULL
+ */
+struct ocsim_generator *openchangesim_generator_parse(TALLOC_CTX *mem_ctx, const char *spec)
+{
+	struct ocsim_generator	*gen;
+	const char		*params;
+	char			*end;
+
+	if (!spec) return NULL;
+
+	gen = talloc_zero(mem_ctx, struct ocsim_generator);
+	if (!gen) return NULL;
+
+	params = openchangesim_generator_content_name(spec, &gen->content);
+	if (!params) goto error;
+
+	if (!strncasecmp(params, "fixed:", 6)) {
+		gen->distribution = OCSIM_GENERATOR_FIXED;
+		if (!openchangesim_generator_number(params + 6, &end, &gen->size) || *end) goto error;
+	} else if (!strncasecmp(params, "uniform:", 8)) {
+		gen->distribution = OCSIM_GENERATOR_UNIFORM;
+		if (!openchangesim_generator_number(params + 8, &end, &gen->size) || *end != '-') goto error;
+		if (!openchangesim_generator_number(end + 1, &end, &gen->max) || *end) goto error;
+		if (gen->max < gen->size) goto error;
+	} else if (!strncasecmp(params, "lognormal:", 10)) {
+		gen->distribution = OCSIM_GENERATOR_LOGNORMAL;
+		if (!openchangesim_generator_number(params + 10, &end, &gen->size) || *end != ':') goto error;
+		gen->sigma = strtod(end + 1, &end);
+		if (*end || gen->sigma < 0 || gen->sigma > 10) goto error;
+	} else if (!strncasecmp(params, "histogram:", 10)) {
+		gen->distribution = OCSIM_GENERATOR_HISTOGRAM;
+		if (!openchangesim_generator_histogram(gen, params + 10)) goto error;
+	} else {
+		goto error;
+	}
+
+	return gen;
+
+error:
+	DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, spec, DEBUG_ERR_GENERATOR));
+	talloc_free(gen);
+	return NULL;
+}
+
+
+static void openchangesim_generator_reset(uint64_t seed)
+{
+	if (!state) {
+		state = talloc_zero(NULL, struct ocsim_generator_state);
+		if (!state) return;
+	}
+
+	/* splitmix64, so that close seeds give unrelated sequences */
+	seed += 0x9E3779B97F4A7C15ULL;
+	seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+	seed ^= seed >> 31;
+	state->seed = seed ? seed : 1;
+	state->built = false;
+}
+
+
+/**
+   \details Seed the generators of a client
+
+   \param ctx pointer to the OpenChangeSim context
+   \param index the user index
+ */
+void openchangesim_generator_seed(struct ocsim_context *ctx, uint32_t index)
+{
+	uint64_t	seed;
+
+	seed = configuration_get_var_int(ctx, OCSIM_VAR_GENERATOR_SEED, OCSIM_GENERATOR_DFLT_SEED);
+	openchangesim_generator_reset((seed << 32) | index);
+}
+
+
+static void openchangesim_generator_build(void)
+{
+	const char	*word;
+	uint32_t	nwords = sizeof (openchangesim_generator_words) / sizeof (char *);
+	uint32_t	offset = 0;
+	uint32_t	column = 0;
+	size_t		len;
+
+	while (offset < OCSIM_GENERATOR_BLOCK) {
+		word = openchangesim_generator_words[openchangesim_generator_next() % nwords];
+		len = strlen(word);
+		if (offset + len + 1 > OCSIM_GENERATOR_BLOCK) break;
+
+		memcpy(state->block + offset, word, len);
+		offset += len;
+		column += len + 1;
+		state->block[offset++] = (column > 72) ? '\n' : ' ';
+		if (column > 72) column = 0;
+	}
+	memset(state->block + offset, ' ', OCSIM_GENERATOR_BLOCK - offset);
+	state->built = true;
+}
+
+
+static void openchangesim_generator_text(uint8_t *dst, uint32_t len)
+{
+	uint32_t	offset;
+	uint32_t	n;
+
+	offset = openchangesim_generator_next() % OCSIM_GENERATOR_BLOCK;
+	while (len) {
+		n = OCSIM_GENERATOR_BLOCK - offset;
+		if (n > len) n = len;
+		memcpy(dst, state->block + offset, n);
+		dst += n;
+		len -= n;
+		offset = 0;
+	}
+}
+
+
+static uint32_t openchangesim_generator_size(struct ocsim_generator *gen)
+{
+	double		u1;
+	double		u2;
+	double		size;
+	uint64_t	r;
+	uint32_t	low;
+	uint32_t	high;
+	uint32_t	mid;
+
+	switch (gen->distribution) {
+	case OCSIM_GENERATOR_FIXED:
+		return gen->size;
+	case OCSIM_GENERATOR_UNIFORM:
+		return gen->size + openchangesim_generator_next() % ((uint64_t) gen->max - gen->size + 1);
+	case OCSIM_GENERATOR_LOGNORMAL:
+		/* Box-Muller on two uniforms in ]0,1] */
+		u1 = ((openchangesim_generator_next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+		u2 = ((openchangesim_generator_next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+		size = gen->size * exp(gen->sigma * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+		return (size > OCSIM_GENERATOR_MAX_SIZE) ? OCSIM_GENERATOR_MAX_SIZE : (uint32_t) size;
+	case OCSIM_GENERATOR_HISTOGRAM:
+		r = openchangesim_generator_next() % gen->weights[gen->bins - 1];
+		for (low = 0, high = gen->bins - 1; low < high;) {
+			mid = (low + high) / 2;
+			if (gen->weights[mid] > r) {
+				high = mid;
+			} else {
+				low = mid + 1;
+			}
+		}
+		return gen->sizes[low];
+	}
+
+	return 0;
+}
+
+
+static void openchangesim_generator_content(enum ocsim_generator_content content,
+					    uint8_t *dst, uint32_t size)
+{
+	uint64_t	r;
+	uint32_t	i;
+
+	switch (content) {
+	case OCSIM_GENERATOR_TEXT:
+	case OCSIM_GENERATOR_HTML:
+		openchangesim_generator_text(dst, size);
+		break;
+	case OCSIM_GENERATOR_COMPRESSIBLE:
+		/* A random pattern, then doubled until the buffer is full */
+		for (i = 0; i < size && i < OCSIM_GENERATOR_PATTERN; i++) {
+			dst[i] = 'A' + openchangesim_generator_next() % 26;
+		}
+		for (; i < size; i *= 2) {
+			memcpy(dst + i, dst, (size - i < i) ? size - i : i);
+		}
+		break;
+	case OCSIM_GENERATOR_RANDOM:
+		for (i = 0; i + sizeof (uint64_t) <= size; i += sizeof (uint64_t)) {
+			r = openchangesim_generator_next();
+			memcpy(dst + i, &r, sizeof (uint64_t));
+		}
+		for (r = openchangesim_generator_next(); i < size; i++, r >>= 8) {
+			dst[i] = r & 0xff;
+		}
+		break;
+	}
+}
+
+
+/**
+   \details Generate the content of the next message
+
+   The returned content is valid until the next call on the same
+   generator.
+
+   \param gen pointer to the generator
+   \param bin pointer to the binary set to the content
+
+   \return true on success, otherwise false
+ */
+bool openchangesim_generator_fill(struct ocsim_generator *gen, struct Binary_r *bin)
+{
+	static const char	header[] = "<html><body>\n<p>";
+	static const char	footer[] = "</p>\n</body></html>\n";
+	uint8_t			*buffer;
+	uint32_t		size;
+
+	if (!gen || !bin) return false;
+
+	if (!state) {
+		openchangesim_generator_reset((uint64_t) OCSIM_GENERATOR_DFLT_SEED << 32);
+		if (!state) return false;
+	}
+	if (!state->built) {
+		openchangesim_generator_build();
+	}
+
+	size = openchangesim_generator_size(gen);
+	if (size > gen->allocated) {
+		buffer = talloc_realloc(gen, gen->buffer, uint8_t, size);
+		if (!buffer) return false;
+		gen->buffer = buffer;
+		gen->allocated = size;
+	}
+
+	switch (gen->content) {
+	case OCSIM_GENERATOR_TEXT:
+	case OCSIM_GENERATOR_COMPRESSIBLE:
+	case OCSIM_GENERATOR_RANDOM:
+		openchangesim_generator_content(gen->content, gen->buffer, size);
+		break;
+	case OCSIM_GENERATOR_HTML:
+		if (size < sizeof (header) + sizeof (footer) - 2) {
+			openchangesim_generator_text(gen->buffer, size);
+			break;
+		}
+		memcpy(gen->buffer, header, sizeof (header) - 1);
+		openchangesim_generator_text(gen->buffer + sizeof (header) - 1,
+					     size - (sizeof (header) - 1) - (sizeof (footer) - 1));
+		memcpy(gen->buffer + size - (sizeof (footer) - 1), footer, sizeof (footer) - 1);
+		break;
+	}
+
+	bin->cb = size;
+	bin->lpb = gen->buffer;
+
+	return true;
+}
+
+
+/**
+   \details Retrieve the file extension of the generated attachments
+
+   \param content the generated content
+
+   \return the extension
+ */
+const char *openchangesim_generator_extension(enum ocsim_generator_content content)
+{
+	if (content > OCSIM_GENERATOR_RANDOM) return "bin";
+
+	return openchangesim_generator_extensions[content];
+}
+
+
+/**
+   \details Draw the next number of the client generator
+
+   Other random choices of the client (recipients) use it, so that
+   they are reproducible as well.
+
+   \return a 64 bits random number
+ */
+uint64_t openchangesim_generator_random(void)
+{
+	if (!state) {
+		openchangesim_generator_reset((uint64_t) OCSIM_GENERATOR_DFLT_SEED << 32);
+		if (!state) return (uint64_t) random();
+	}
+
+	return openchangesim_generator_next();
+}
+
+
+/**
+   \details Parse a large attachment description
+
+   The description is either a file name, or "content:SIZE" with SIZE
+   in bytes, optionally followed by K, M, G or T.
+
+   \param spec the large attachment description
+   \param large pointer to the large object to set
+
+   \return true on success, otherwise false
+ */
+bool openchangesim_generator_large(const char *spec, struct ocsim_large_object *large)
+{
+	const char		*params;
+	char			*end;
+	struct stat		sb;
+	unsigned long long	size;
+	const char		units[] = "KMGT";
+	const char		*unit;
+	uint32_t		shift;
+
+	if (!spec || !large) return false;
+
+	memset(large, 0, sizeof (struct ocsim_large_object));
+	params = openchangesim_generator_content_name(spec, &large->content);
+	if (!params) {
+		if (stat(spec, &sb) == -1 || !S_ISREG(sb.st_mode)) goto error;
+		large->path = spec;
+		large->size = sb.st_size;
+		return true;
+	}
+
+	if (*params < '0' || *params > '9') goto error;
+	errno = 0;
+	size = strtoull(params, &end, 10);
+	if (errno) goto error;
+	if (*end && (unit = strchr(units, toupper(*end)))) {
+		shift = 10 * (unit - units + 1);
+		if (size > (OCSIM_LARGE_MAX_SIZE >> shift)) goto error;
+		size <<= shift;
+		end++;
+	}
+	if (*end || !size || size > OCSIM_LARGE_MAX_SIZE) goto error;
+	large->size = size;
+
+	return true;
+
+error:
+	DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, spec, DEBUG_ERR_LARGE_OBJECT));
+	return false;
+}
+
+
+/**
+   \details Generate a chunk of a large attachment
+
+   \param large pointer to the large object
+   \param dst the buffer to fill
+   \param len the chunk length
+ */
+void openchangesim_generator_chunk(struct ocsim_large_object *large, uint8_t *dst, uint32_t len)
+{
+	if (!large || !dst) return;
+
+	if (!state) {
+		openchangesim_generator_reset((uint64_t) OCSIM_GENERATOR_DFLT_SEED << 32);
+		if (!state) return;
+	}
+	if (!state->built) {
+		openchangesim_generator_build();
+	}
+
+	openchangesim_generator_content(large->content, dst, len);
+}
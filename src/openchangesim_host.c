@@ -0,0 +1,521 @@
+/*
+   OpenChangeSim host resource sampler
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_host.c
+
+   \brief Driver host resource sampling on the run time axis
+
+   While the clients are running, the parent samples the resources of
+   the host running the simulation from /proc: CPU usage per core,
+   context switches, available memory, traffic and drops on the tap
+   interfaces and on the configured uplink interfaces, socket counts,
+   TCP retransmissions and the conntrack table usage. Each sample is
+   written to syslog with its offset from the start of the run so it
+   can be correlated with the statistics time series. Peaks are
+   reported once all clients have completed.
+ */
+
+#include "src/openchangesim.h"
+
+struct ocsim_host_nic
+{
+	char		name[OCSIM_IFNAMSIZ];
+	uint64_t	rx_bytes;
+	uint64_t	tx_bytes;
+	uint64_t	rx_drop;
+	uint64_t	tx_drop;
+	uint64_t	drops;
+};
+
+struct ocsim_host
+{
+	uint32_t		interval;
+	uint64_t		next;
+	uint64_t		last;
+	bool			primed;
+	/* tap interfaces created for the clients, sorted by name */
+	char			**taps;
+	uint32_t		tap_count;
+	struct ocsim_host_nic	tap;
+	struct ocsim_host_nic	nics[OCSIM_HOST_MAX_IFACES];
+	uint32_t		nic_count;
+	/* previous counters */
+	uint32_t		cpu_count;
+	uint64_t		cpu_busy[OCSIM_HOST_MAX_CPUS];
+	uint64_t		cpu_total[OCSIM_HOST_MAX_CPUS];
+	uint64_t		all_total;
+	uint64_t		all_iowait;
+	uint64_t		all_softirq;
+	uint64_t		ctxt;
+	uint64_t		retrans;
+	uint64_t		out_segs;
+	/* peaks */
+	double			peak_cpu;
+	uint32_t		peak_cpu_core;
+	uint64_t		mem_total;
+	uint64_t		min_mem_avail;
+	uint64_t		peak_tcp_inuse;
+	uint64_t		peak_conntrack;
+	uint64_t		conntrack_max;
+	uint64_t		retrans_total;
+};
+
+static struct ocsim_host	*host = NULL;
+
+
+static int openchangesim_host_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+/**
+   \details Initialize the host sampler
+
+   Must be called by the parent once the tap interfaces have been
+   created.
+
+   \param ctx pointer to the OpenChangeSim context
+   \param server the server name the run targets
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_host_init(struct ocsim_context *ctx, const char *server)
+{
+	struct ocsim_server	*el;
+	const char		*ifaces;
+	char			*list;
+	char			*tok;
+	char			*saveptr = NULL;
+	uint32_t		i;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+
+	talloc_free(host);
+	host = talloc_zero(ctx->mem_ctx, struct ocsim_host);
+	OCSIM_RETVAL_IF(!host, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+
+	host->interval = configuration_get_var_int(ctx, OCSIM_VAR_HOST_INTERVAL, OCSIM_HOST_DFLT_INTERVAL);
+	host->min_mem_avail = UINT64_MAX;
+	strncpy(host->tap.name, "tap", sizeof (host->tap.name) - 1);
+
+	el = configuration_validate_server(ctx, server);
+	if (el && el->interfaces) {
+		host->taps = talloc_array(host, char *, el->range_end - el->range_start);
+		OCSIM_RETVAL_IF(!host->taps, OCSIM_ERROR, OCSIM_MEMORY_ERROR, host);
+		for (i = 0; i < el->range_end - el->range_start; i++) {
+			if (el->interfaces[i].name[0]) {
+				host->taps[host->tap_count++] = el->interfaces[i].name;
+			}
+		}
+		qsort(host->taps, host->tap_count, sizeof (char *), openchangesim_host_cmp);
+	}
+
+	ifaces = configuration_get_var(ctx, OCSIM_VAR_HOST_INTERFACES);
+	if (ifaces) {
+		list = talloc_strdup(host, ifaces);
+		for (tok = strtok_r(list, ", ", &saveptr); tok && host->nic_count < OCSIM_HOST_MAX_IFACES;
+		     tok = strtok_r(NULL, ", ", &saveptr)) {
+			strncpy(host->nics[host->nic_count++].name, tok, OCSIM_IFNAMSIZ - 1);
+		}
+		talloc_free(list);
+	}
+
+	return OCSIM_SUCCESS;
+}
+
+
+static bool openchangesim_host_read_u64(const char *path, uint64_t *value)
+{
+	FILE			*f;
+	unsigned long long	v;
+	bool			ret;
+
+	f = fopen(path, "r");
+	if (!f) return false;
+	ret = (fscanf(f, "%llu", &v) == 1);
+	fclose(f);
+
+	if (ret) *value = v;
+	return ret;
+}
+
+
+static void openchangesim_host_nic_update(struct ocsim_host_nic *nic, uint64_t *cur, double dt,
+					  bool log, double elapsed)
+{
+	uint64_t	rx_drop;
+	uint64_t	tx_drop;
+
+	if (host->primed && log) {
+		rx_drop = cur[2] - nic->rx_drop;
+		tx_drop = cur[3] - nic->tx_drop;
+		nic->drops += rx_drop + tx_drop;
+		openchangesim_log_string("host: t=%.1fs nic %s: rx=%.2fMbit/s tx=%.2fMbit/s rx_drop=%llu tx_drop=%llu",
+					 elapsed, nic->name,
+					 (cur[0] - nic->rx_bytes) * 8 / dt / 1000000.0,
+					 (cur[1] - nic->tx_bytes) * 8 / dt / 1000000.0,
+					 (unsigned long long) rx_drop, (unsigned long long) tx_drop);
+	}
+	nic->rx_bytes = cur[0];
+	nic->tx_bytes = cur[1];
+	nic->rx_drop = cur[2];
+	nic->tx_drop = cur[3];
+}
+
+
+static void openchangesim_host_sample_nics(double dt, double elapsed)
+{
+	FILE			*f;
+	char			line[512];
+	char			*name;
+	char			*colon;
+	unsigned long long	v[12];
+	uint64_t		cur[4];
+	uint64_t		tap[4] = { 0, 0, 0, 0 };
+	uint32_t		i;
+
+	f = fopen("/proc/net/dev", "r");
+	if (!f) return;
+
+	while (fgets(line, sizeof (line), f)) {
+		colon = strchr(line, ':');
+		if (!colon) continue;
+		*colon = '\0';
+		for (name = line; *name == ' '; name++);
+
+		if (sscanf(colon + 1, "%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+			   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7],
+			   &v[8], &v[9], &v[10], &v[11]) != 12) {
+			continue;
+		}
+		cur[0] = v[0];
+		cur[1] = v[8];
+		cur[2] = v[3];
+		cur[3] = v[11];
+
+		if (host->tap_count && bsearch(&name, host->taps, host->tap_count, sizeof (char *),
+					       openchangesim_host_cmp)) {
+			for (i = 0; i < 4; i++) {
+				tap[i] += cur[i];
+			}
+			continue;
+		}
+
+		for (i = 0; i < host->nic_count; i++) {
+			if (!strcmp(host->nics[i].name, name)) {
+				openchangesim_host_nic_update(&host->nics[i], cur, dt, true, elapsed);
+				break;
+			}
+		}
+	}
+	fclose(f);
+
+	openchangesim_host_nic_update(&host->tap, tap, dt, host->tap_count != 0, elapsed);
+}
+
+
+static void openchangesim_host_sample_cpu(TALLOC_CTX *mem_ctx, double dt, double elapsed)
+{
+	FILE			*f;
+	char			line[512];
+	char			*cores;
+	unsigned long long	v[8];
+	unsigned long long	ctxt = 0;
+	unsigned int		cpu;
+	uint64_t		total;
+	uint64_t		busy;
+	uint64_t		dtotal;
+	double			pct;
+	double			sum = 0;
+	double			iowait = 0;
+	double			softirq = 0;
+	double			max = 0;
+	uint32_t		max_core = 0;
+	uint32_t		count = 0;
+
+	f = fopen("/proc/stat", "r");
+	if (!f) return;
+
+	cores = talloc_strdup(mem_ctx, "");
+	memset(v, 0, sizeof (v));
+	while (fgets(line, sizeof (line), f)) {
+		if (!strncmp(line, "cpu ", 4)) {
+			if (sscanf(line + 4, "%llu %llu %llu %llu %llu %llu %llu %llu",
+				   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 4) {
+				continue;
+			}
+			total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+			dtotal = total - host->all_total;
+			if (host->primed && dtotal) {
+				iowait = 100.0 * (v[4] - host->all_iowait) / dtotal;
+				softirq = 100.0 * (v[6] - host->all_softirq) / dtotal;
+			}
+			host->all_total = total;
+			host->all_iowait = v[4];
+			host->all_softirq = v[6];
+		} else if (!strncmp(line, "cpu", 3)) {
+			memset(v, 0, sizeof (v));
+			if (sscanf(line + 3, "%u %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+				   &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 5) {
+				continue;
+			}
+			if (cpu >= OCSIM_HOST_MAX_CPUS) continue;
+
+			total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+			busy = total - v[3] - v[4];
+			if (host->primed && total > host->cpu_total[cpu]) {
+				pct = 100.0 * (busy - host->cpu_busy[cpu]) / (total - host->cpu_total[cpu]);
+				cores = talloc_asprintf_append(cores, " %.0f", pct);
+				sum += pct;
+				count++;
+				if (pct > max) {
+					max = pct;
+					max_core = cpu;
+				}
+			}
+			host->cpu_busy[cpu] = busy;
+			host->cpu_total[cpu] = total;
+			if (cpu + 1 > host->cpu_count) {
+				host->cpu_count = cpu + 1;
+			}
+		} else if (sscanf(line, "ctxt %llu", &ctxt) == 1) {
+			break;
+		}
+	}
+	fclose(f);
+
+	if (host->primed && count) {
+		openchangesim_log_string("host: t=%.1fs cpu=%.1f%% max=%.1f%% (cpu%d) iowait=%.1f%% softirq=%.1f%% ctxsw/s=%.0f",
+					 elapsed, sum / count, max, max_core, iowait, softirq,
+					 (ctxt - host->ctxt) / dt);
+		openchangesim_log_string("host: t=%.1fs cores:%s", elapsed, cores);
+		if (max > host->peak_cpu) {
+			host->peak_cpu = max;
+			host->peak_cpu_core = max_core;
+		}
+	}
+	host->ctxt = ctxt;
+	talloc_free(cores);
+}
+
+
+static void openchangesim_host_sample_mem(double elapsed)
+{
+	FILE			*f;
+	char			line[256];
+	unsigned long long	v;
+	uint64_t		total = 0;
+	uint64_t		avail = 0;
+
+	f = fopen("/proc/meminfo", "r");
+	if (!f) return;
+
+	while (fgets(line, sizeof (line), f)) {
+		if (sscanf(line, "MemTotal: %llu kB", &v) == 1) {
+			total = v;
+		} else if (sscanf(line, "MemAvailable: %llu kB", &v) == 1) {
+			avail = v;
+			break;
+		}
+	}
+	fclose(f);
+
+	host->mem_total = total;
+	if (avail < host->min_mem_avail) {
+		host->min_mem_avail = avail;
+	}
+	if (host->primed) {
+		openchangesim_log_string("host: t=%.1fs mem_avail=%lluMB/%lluMB", elapsed,
+					 (unsigned long long) avail / 1024, (unsigned long long) total / 1024);
+	}
+}
+
+
+static void openchangesim_host_sample_net(double dt, double elapsed)
+{
+	FILE			*f;
+	char			line[1024];
+	char			header[1024];
+	char			*tok;
+	char			*htok;
+	char			*saveptr = NULL;
+	char			*hsaveptr = NULL;
+	unsigned long long	sockets = 0;
+	unsigned long long	inuse = 0;
+	unsigned long long	orphan = 0;
+	unsigned long long	tw = 0;
+	unsigned long long	alloc = 0;
+	uint64_t		retrans = 0;
+	uint64_t		out_segs = 0;
+	uint64_t		estab = 0;
+	uint64_t		conntrack = 0;
+	bool			has_header = false;
+
+	f = fopen("/proc/net/sockstat", "r");
+	if (f) {
+		while (fgets(line, sizeof (line), f)) {
+			if (sscanf(line, "sockets: used %llu", &sockets) == 1) continue;
+			sscanf(line, "TCP: inuse %llu orphan %llu tw %llu alloc %llu", &inuse, &orphan, &tw, &alloc);
+		}
+		fclose(f);
+	}
+
+	/* Tcp: appears twice, field names first then values */
+	f = fopen("/proc/net/snmp", "r");
+	if (f) {
+		while (fgets(line, sizeof (line), f)) {
+			if (strncmp(line, "Tcp:", 4)) continue;
+			if (!has_header) {
+				strncpy(header, line, sizeof (header) - 1);
+				header[sizeof (header) - 1] = '\0';
+				has_header = true;
+				continue;
+			}
+			for (htok = strtok_r(header, " \n", &hsaveptr), tok = strtok_r(line, " \n", &saveptr);
+			     htok && tok; htok = strtok_r(NULL, " \n", &hsaveptr), tok = strtok_r(NULL, " \n", &saveptr)) {
+				if (!strcmp(htok, "RetransSegs")) {
+					retrans = strtoull(tok, NULL, 10);
+				} else if (!strcmp(htok, "OutSegs")) {
+					out_segs = strtoull(tok, NULL, 10);
+				} else if (!strcmp(htok, "CurrEstab")) {
+					estab = strtoull(tok, NULL, 10);
+				}
+			}
+			break;
+		}
+		fclose(f);
+	}
+
+	if (openchangesim_host_read_u64("/proc/sys/net/netfilter/nf_conntrack_count", &conntrack)) {
+		openchangesim_host_read_u64("/proc/sys/net/netfilter/nf_conntrack_max", &host->conntrack_max);
+		if (conntrack > host->peak_conntrack) {
+			host->peak_conntrack = conntrack;
+		}
+	}
+	if (inuse > host->peak_tcp_inuse) {
+		host->peak_tcp_inuse = inuse;
+	}
+
+	if (host->primed) {
+		host->retrans_total += retrans - host->retrans;
+		openchangesim_log_string("host: t=%.1fs sockets=%llu tcp_inuse=%llu tcp_orphan=%llu tcp_tw=%llu tcp_alloc=%llu estab=%llu retrans/s=%.1f (%.2f%%) conntrack=%llu/%llu",
+					 elapsed, sockets, inuse, orphan, tw, alloc, (unsigned long long) estab,
+					 (retrans - host->retrans) / dt,
+					 (out_segs > host->out_segs) ?
+					 100.0 * (retrans - host->retrans) / (out_segs - host->out_segs) : 0.0,
+					 (unsigned long long) conntrack, (unsigned long long) host->conntrack_max);
+	}
+	host->retrans = retrans;
+	host->out_segs = out_segs;
+}
+
+
+/**
+   \details Take a sample of the host resources
+
+   The first sample only records the baseline counters.
+ */
+void openchangesim_host_sample(void)
+{
+	TALLOC_CTX	*mem_ctx;
+	uint64_t	now;
+	double		dt;
+	double		elapsed;
+
+	if (!host) return;
+
+	now = openchangesim_stats_elapsed();
+	dt = (now > host->last) ? (now - host->last) / 1000000.0 : 1;
+	elapsed = now / 1000000.0;
+
+	mem_ctx = talloc_new(host);
+	openchangesim_host_sample_cpu(mem_ctx, dt, elapsed);
+	openchangesim_host_sample_mem(elapsed);
+	openchangesim_host_sample_nics(dt, elapsed);
+	openchangesim_host_sample_net(dt, elapsed);
+	talloc_free(mem_ctx);
+
+	host->primed = true;
+	host->last = now;
+	host->next = now + (uint64_t) host->interval * 1000000;
+}
+
+
+/**
+   \details Wait for all forked clients to complete, sampling the host
+   resources every host_sample_interval seconds
+
+   \param ctx pointer to the OpenChangeSim context
+ */
+void openchangesim_host_wait(struct ocsim_context *ctx)
+{
+	while (ctx->active_childs) {
+		if (host && host->interval && openchangesim_stats_elapsed() >= host->next) {
+			openchangesim_host_sample();
+		}
+		usleep(OCSIM_HOST_POLL_USEC);
+	}
+}
+
+
+/**
+   \details Dump the peak host resource usage to stdout and syslog
+   and warn about resources which may have limited the run
+ */
+void openchangesim_host_dump(void)
+{
+	uint64_t	drops;
+	uint32_t	i;
+
+	if (!host || !host->primed) return;
+
+	drops = host->tap.drops;
+	for (i = 0; i < host->nic_count; i++) {
+		drops += host->nics[i].drops;
+	}
+
+	DEBUG(0, ("[*] Host: peak cpu %.1f%% (cpu%d), min available memory %lluMB/%lluMB, peak tcp sockets %llu\n",
+		  host->peak_cpu, host->peak_cpu_core,
+		  (unsigned long long) host->min_mem_avail / 1024, (unsigned long long) host->mem_total / 1024,
+		  (unsigned long long) host->peak_tcp_inuse));
+	DEBUG(0, ("[*] Host: nic drops %llu, tcp retransmits %llu, peak conntrack %llu/%llu\n",
+		  (unsigned long long) drops, (unsigned long long) host->retrans_total,
+		  (unsigned long long) host->peak_conntrack, (unsigned long long) host->conntrack_max));
+	openchangesim_log_string("host: peak cpu=%.1f%% (cpu%d) min_mem_avail=%lluMB tcp_inuse=%llu drops=%llu retrans=%llu conntrack=%llu/%llu",
+				 host->peak_cpu, host->peak_cpu_core,
+				 (unsigned long long) host->min_mem_avail / 1024,
+				 (unsigned long long) host->peak_tcp_inuse, (unsigned long long) drops,
+				 (unsigned long long) host->retrans_total,
+				 (unsigned long long) host->peak_conntrack, (unsigned long long) host->conntrack_max);
+
+	if (host->peak_cpu >= 95.0) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_WARN, "A driver CPU core was saturated during the run"));
+	}
+	if (drops) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_WARN, "Packets were dropped on the driver interfaces"));
+	}
+	if (host->conntrack_max && host->peak_conntrack * 10 >= host->conntrack_max * 9) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_WARN, "The driver conntrack table was nearly full"));
+	}
+}
@@ -22,6 +22,9 @@
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <linux/if_tun.h>
+#include <netinet/in.h>
+#include <linux/ipv6.h>
+#include <pthread.h>
 
 #include "src/openchangesim.h"
 
@@ -41,31 +44,38 @@
 void openchangesim_interface_get_next_ip(struct ocsim_server *el, bool status)
 {
 	if (status == true) {
-		el->ip_current[0] = el->ip_start[0];
-		el->ip_current[1] = el->ip_start[1];
-		el->ip_current[2] = el->ip_start[2];
-		el->ip_current[3] = el->ip_start[3];
 		el->ip_used = 0;
 	} else {
-		/* We are not in the same subnet */
-		if (el->ip_current[2] < el->ip_end[2]) {
-			el->ip_current[3] += 1;
-			if (el->ip_current[3] == 255) {
-				el->ip_current[3] = 0;
-				el->ip_current[2] += 1;
-			}
-		} else if (el->ip_current[2] == el->ip_end[2]) {
-			if (el->ip_current[3] < el->ip_end[3]) {
-				el->ip_current[3] += 1;
-			} else {
-				DEBUG(0, (DEBUG_FORMAT_STRING_ERR, DEBUG_ERR_OUT_OF_ADDRESS));
-				exit (1);
-			}
+		if (el->ip_used + 1 >= el->ip_number) {
+			DEBUG(0, (DEBUG_FORMAT_STRING_ERR, DEBUG_ERR_OUT_OF_ADDRESS));
+			exit (1);
 		}
 		el->ip_used += 1;
 	}
 }
 
+/**
+   \details Retrieve the IP address at a given index of the server
+   pool
+
+   \param mem_ctx pointer to the memory context
+   \param el pointer to the openchangesim server context
+   \param index the index of the address in the pool
+
+   \return allocated IP address string on success, otherwise NULL
+ */
+char *openchangesim_interface_get_ip(TALLOC_CTX *mem_ctx, struct ocsim_server *el, uint32_t index)
+{
+	char	buf[INET6_ADDRSTRLEN];
+
+	if (!configuration_get_ip_at(el->ip_range, index, buf, sizeof (buf))) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_ERR, DEBUG_ERR_OUT_OF_ADDRESS));
+		return NULL;
+	}
+
+	return talloc_strdup(mem_ctx, buf);
+}
+
 /**
    \Release the last affected IP address.
 
@@ -75,28 +85,34 @@ void openchangesim_release_ip(struct ocsim_server *el) {
 }
 
 /**
-   \details Create a virtual tap interface and assign an IPv4 IP
-   address
+   \details Create a virtual tap interface and assign an IPv4 or
+   IPv6 address
 
    \param mem_ctx pointer to the memory context
-   \param tap_number the tap interface number to use
+   \param iface pointer to the interface to fill with the tap file
+   descriptor and name
    \param ip_addr the IP address to assign to the interface
 
    \return 0 on success, otherwise -1
  */
 int openchangesim_create_interface_tap(TALLOC_CTX *mem_ctx, 
-				       int * _tap_fd,
+				       struct ocsim_interface *iface,
 				       const char *ip_addr)
 {
 	struct ifreq		ifr;
+	struct in6_ifreq	ifr6;
 	struct addrinfo		*result = NULL;
+	void			*req;
 	char			*tap = "";
-	char			*name;
+	char			*name = NULL;
 	char			*file = "/dev/net/tun";
 	uid_t			owner = -1;
 	int			tap_fd = -1;
 	int			s;
-	*_tap_fd = -1;
+	bool			persist = false;
+
+	iface->fd = -1;
+	iface->name[0] = '\0';
 
 	if ((tap_fd = open(file, O_RDWR)) < 0) {
 		fprintf(stderr, "Failed to open '%s'\n", file);
@@ -111,98 +127,322 @@ int openchangesim_create_interface_tap(TALLOC_CTX *mem_ctx,
 	if (ioctl(tap_fd, TUNSETIFF, (void *) &ifr) < 0) {
 		fprintf(stderr, "ioctl failed\n");
 		perror("TUNSETIFF");
-		return -1;
+		goto fail;
 	}
 	name = talloc_strdup(mem_ctx, ifr.ifr_name);
+	openchangesim_journal_record(OCSIM_JOURNAL_TAP, name, ip_addr);
 
 	owner = geteuid();
 	if (owner != -1) {
 		if (ioctl(tap_fd, TUNSETOWNER, owner) < 0) {
 			perror("TUNSETOWNER");
-			return -1;
+			goto fail;
 		}
 	}
 
 	if (ioctl(tap_fd, TUNSETPERSIST, 1) < 0) {
 		perror("enabling TUNSETPERSIST");
-		return -1;
+		goto fail;
 	}
+	persist = true;
 
 	memset(&ifr, 0, sizeof (ifr));
 	strncpy(ifr.ifr_name, name, sizeof (ifr.ifr_name));
-	getaddrinfo(ip_addr, "0", NULL, &result);
-	ifr.ifr_addr.sa_family = result->ai_addr->sa_family;
-	memcpy(ifr.ifr_addr.sa_data, result->ai_addr->sa_data, sizeof (ifr.ifr_addr.sa_data));
+	if (getaddrinfo(ip_addr, "0", NULL, &result) || !result) {
+		fprintf(stderr, "Invalid address '%s'\n", ip_addr);
+		goto fail;
+	}
+	if (result->ai_family == AF_INET6) {
+		/* IPv6 addresses are set by interface index */
+		memset(&ifr6, 0, sizeof (ifr6));
+		ifr6.ifr6_addr = ((struct sockaddr_in6 *) result->ai_addr)->sin6_addr;
+		ifr6.ifr6_prefixlen = 128;
+		ifr6.ifr6_ifindex = if_nametoindex(name);
+		req = &ifr6;
+		s = socket(AF_INET6, SOCK_DGRAM, 0);
+	} else {
+		ifr.ifr_addr.sa_family = result->ai_addr->sa_family;
+		memcpy(ifr.ifr_addr.sa_data, result->ai_addr->sa_data, sizeof (ifr.ifr_addr.sa_data));
+		req = &ifr;
+		s = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+	}
 	freeaddrinfo(result);
-	s = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+	if (s == -1) {
+		perror("socket");
+		goto fail;
+	}
 
-	if (ioctl(s, SIOCSIFADDR, (void *) &ifr) < 0) {
+	if (ioctl(s, SIOCSIFADDR, req) < 0) {
 		perror("SIOCSIFADDR");
+		close(s);
+		goto fail;
+	}
+
+	close(s);
+
+	iface->fd = tap_fd;
+	strncpy(iface->name, name, sizeof (iface->name) - 1);
+	iface->name[sizeof (iface->name) - 1] = '\0';
+	talloc_free(name);
+
+	return OCSIM_SUCCESS;
 
+fail:
+	/* Don't leave a persistent tap device behind */
+	if (persist) {
 		DEBUG(0, ("Deleting interface"));
 		if (ioctl(tap_fd, TUNSETPERSIST, 0) < 0) {
-		  perror("TUNSETPERSIST");
-		  return OCSIM_ERROR;
+			perror("TUNSETPERSIST");
 		}
-		return OCSIM_ERROR;
 	}
+	close(tap_fd);
+	talloc_free(name);
 
-	*_tap_fd = tap_fd;
-	return OCSIM_SUCCESS;
+	return OCSIM_ERROR;
+}
+
+
+struct ocsim_interface_pool
+{
+	struct ocsim_interface	*interfaces;
+	char			**ip_addresses;
+	uint32_t		count;
+	uint32_t		next;
+	uint32_t		done;
+	bool			failed;
+	bool			remove;
+};
+
+
+static void *openchangesim_create_interfaces_worker(void *private_data)
+{
+	struct ocsim_interface_pool	*pool = (struct ocsim_interface_pool *) private_data;
+	TALLOC_CTX			*mem_ctx;
+	uint32_t			idx;
+
+	/* talloc is not thread safe, each worker owns its context */
+	mem_ctx = talloc_named(NULL, 0, "interface_worker");
+
+	while ((idx = __sync_fetch_and_add(&pool->next, 1)) < pool->count) {
+		if (pool->remove) {
+			/* Keep deleting the other interfaces on failure */
+			if (openchangesim_delete_interface_tap(mem_ctx, &pool->interfaces[idx]) != OCSIM_SUCCESS) {
+				pool->failed = true;
+			}
+		} else if (pool->ip_addresses[idx] && !pool->failed) {
+			if (openchangesim_create_interface_tap(mem_ctx, &pool->interfaces[idx],
+							       pool->ip_addresses[idx]) < 0) {
+				pool->failed = true;
+			}
+		}
+		__sync_fetch_and_add(&pool->done, 1);
+	}
+
+	talloc_free(mem_ctx);
+	return NULL;
+}
+
+
+static int openchangesim_interfaces_run(FILE *f, struct ocsim_interface_pool *pool,
+					uint32_t workers, const char *action)
+{
+	pthread_t			threads[OCSIM_PROVISION_MAX_WORKERS];
+	uint32_t			started = 0;
+	uint32_t			done;
+	uint32_t			i;
+	char				logstr[128];
+
+	if (workers > OCSIM_PROVISION_MAX_WORKERS) workers = OCSIM_PROVISION_MAX_WORKERS;
+	if (workers > pool->count) workers = pool->count;
+
+	for (i = 0; i < workers; i++) {
+		if (pthread_create(&threads[i], NULL, openchangesim_create_interfaces_worker, pool)) {
+			perror("pthread_create");
+			break;
+		}
+		started++;
+	}
+
+	/* Fallback to the calling thread if no worker could be started */
+	if (!started) {
+		openchangesim_create_interfaces_worker(pool);
+	}
+
+	do {
+		done = pool->done;
+		snprintf(logstr, sizeof (logstr), "[*] %s interface %d/%d", action, done, pool->count);
+		openchangesim_printlog(f, logstr);
+		if (done < pool->count) {
+			usleep(100000);
+		}
+	} while (done < pool->count && started);
+
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	openchangesim_printlog(f, "\n");
+
+	return pool->failed ? OCSIM_ERROR : OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Create virtual tap interfaces in parallel
+
+   Entries without an IP address are skipped. Progress is reported on
+   the given stream while the workers are running. When the address
+   pool is enabled, the addresses are added to the pool interface
+   instead.
+
+   \param f the stream to report progress on
+   \param interfaces array of interfaces to fill
+   \param ip_addresses array of IP addresses to assign
+   \param count the number of entries in both arrays
+   \param workers the number of worker threads to use
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_create_interfaces(FILE *f,
+				    struct ocsim_interface *interfaces,
+				    char **ip_addresses,
+				    uint32_t count,
+				    uint32_t workers)
+{
+	struct ocsim_interface_pool	pool;
+
+	if (!interfaces || !ip_addresses || !count) return OCSIM_SUCCESS;
+
+	if (openchangesim_netlink_enabled()) {
+		return openchangesim_netlink_add(f, interfaces, ip_addresses, count);
+	}
+
+	memset(&pool, 0, sizeof (struct ocsim_interface_pool));
+	pool.interfaces = interfaces;
+	pool.ip_addresses = ip_addresses;
+	pool.count = count;
+
+	return openchangesim_interfaces_run(f, &pool, workers, "Creating");
 }
 
 
 /**
    \details Delete a virtual interface
 
+   Interfaces without a file descriptor but with a name are persistent
+   interfaces left by a previous run, they are attached again by name.
+
    \param mem_ctx pointer to the memory context
-   \param tap_number tap interface number to delete
+   \param iface pointer to the interface to delete
 
    \return 0 on success, otherwise -1
  */
 int openchangesim_delete_interface_tap(TALLOC_CTX *mem_ctx,
-				       int tap_fd)
+				       struct ocsim_interface *iface)
 {
-	if (tap_fd == 0) {
-		return OCSIM_SUCCESS;
+	struct ifreq		ifr;
+	char			*file = "/dev/net/tun";
+
+	if (iface->fd <= 0) {
+		/* TUNSETIFF would create a missing interface */
+		if (!iface->name[0] || !if_nametoindex(iface->name)) {
+			return OCSIM_SUCCESS;
+		}
+
+		if ((iface->fd = open(file, O_RDWR)) < 0) {
+			perror(file);
+			return OCSIM_ERROR;
+		}
+		memset(&ifr, 0, sizeof (ifr));
+		ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+		strncpy(ifr.ifr_name, iface->name, sizeof (ifr.ifr_name) - 1);
+		if (ioctl(iface->fd, TUNSETIFF, (void *) &ifr) < 0) {
+			perror("TUNSETIFF");
+			close(iface->fd);
+			iface->fd = -1;
+			return OCSIM_ERROR;
+		}
 	}
 
-	if (ioctl(tap_fd, TUNSETPERSIST, 0) < 0) {
+	if (ioctl(iface->fd, TUNSETPERSIST, 0) < 0) {
 		perror("TUNSETPERSIST");
 		return OCSIM_ERROR;
 	}
-	
+
+	/* The interface is unregistered when its last descriptor is closed */
+	close(iface->fd);
+	iface->fd = -1;
+
 	return OCSIM_SUCCESS;
 }
 
+
+/**
+   \details Delete virtual tap interfaces in parallel
+
+   \param f the stream to report progress on
+   \param interfaces array of interfaces to delete
+   \param count the number of interfaces
+   \param workers the number of worker threads to use
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_delete_interfaces_tap(FILE *f,
+					struct ocsim_interface *interfaces,
+					uint32_t count,
+					uint32_t workers)
+{
+	struct ocsim_interface_pool	pool;
+
+	if (!interfaces || !count) return OCSIM_SUCCESS;
+
+	memset(&pool, 0, sizeof (struct ocsim_interface_pool));
+	pool.interfaces = interfaces;
+	pool.count = count;
+	pool.remove = true;
+
+	return openchangesim_interfaces_run(f, &pool, workers, "Deleting");
+}
+
+
+/**
+   \details Delete the virtual interfaces and network groups of a
+   server, and the interface journal once they are all gone
+
+   \param ctx pointer to the OpenChangeSim context
+   \param server the server name
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
 int openchangesim_delete_interfaces(struct ocsim_context *ctx, 
 				    const char *server)
 {
-	FILE			*f;
 	struct ocsim_server	*el;
-	int			i;
+	uint32_t		count;
+	uint32_t		workers;
 	int			ret;
-	char			*logstr;
 
 	el = configuration_validate_server(ctx, server);
 	if (!el) return OCSIM_ERROR;
 
-	f = fdopen(STDOUT_FILENO, "r+");
+	openchangesim_network_release();
 
-	for (i = 0; i <= el->ip_used; i++) {
-		ret = openchangesim_delete_interface_tap(ctx->mem_ctx, el->interfaces_fd[i]);
-		logstr = talloc_asprintf(ctx->mem_ctx,
-				"[*] Interface tap%d (fd %d) deleted\n",
-				i, el->interfaces_fd[i]);
-		openchangesim_printlog(f, logstr);
-		talloc_free(logstr);
+	if (openchangesim_netlink_enabled()) {
+		talloc_free(el->interfaces);
+		el->interfaces = NULL;
+		ret = openchangesim_netlink_release();
+		openchangesim_journal_close(ret == OCSIM_SUCCESS);
+		return ret;
 	}
-	logstr = talloc_asprintf(ctx->mem_ctx, "[*] All %d virtual interfaces pending physical deletion\n",
-				 el->ip_used+1);
-	talloc_free(el->interfaces_fd);
-	openchangesim_printlog(f, logstr);
-	talloc_free(logstr);
-	printf("\n");
 
-	return OCSIM_SUCCESS;
+	/* One entry per user: roster users may not take their address from the IP range */
+	count = el->interfaces ? el->range_end - el->range_start : 0;
+	workers = configuration_get_var_int(ctx, OCSIM_VAR_PROVISION_WORKERS, sysconf(_SC_NPROCESSORS_ONLN));
+	ret = openchangesim_delete_interfaces_tap(stdout, el->interfaces, count, workers);
+	printf("[*] %d virtual interfaces deleted\n", count);
+
+	talloc_free(el->interfaces);
+	el->interfaces = NULL;
+	openchangesim_journal_close(ret == OCSIM_SUCCESS);
+
+	return ret;
 }
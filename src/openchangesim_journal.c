@@ -0,0 +1,255 @@
+/*
+   OpenChangeSim interface journal
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_journal.c
+
+   \brief On-disk journal of the interfaces and addresses created
+
+   Every tap interface, pool address and shaped interface is appended
+   to the journal before it is used, one line per entry. The journal
+   is removed once the interfaces are deleted: if the parent is
+   killed, the next run finds it and refuses to start until
+   --cleanup-stale replayed it.
+
+   Lines are written with a single write(2) on a descriptor opened
+   with O_APPEND, so the provisioning workers can share it. The journal
+   is not synced: persistent interfaces don't survive a reboot either.
+ */
+
+#include <fcntl.h>
+
+#include "src/openchangesim.h"
+
+struct ocsim_journal
+{
+	int		fd;
+	char		*path;
+};
+
+static struct ocsim_journal	*journal = NULL;
+
+struct ocsim_journal_pool
+{
+	char		ifname[OCSIM_IFNAMSIZ];
+	bool		created;
+	char		**ip_addresses;
+	uint32_t	count;
+};
+
+
+/**
+   \details Create the interface journal
+
+   \param ctx pointer to the OpenChangeSim context
+   \param path the journal path
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR if the
+   journal couldn't be created or a previous run left a journal behind
+ */
+int openchangesim_journal_open(struct ocsim_context *ctx, const char *path)
+{
+	struct stat	sb;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+	OCSIM_RETVAL_IF(!path, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	if (stat(path, &sb) == 0 && sb.st_size > 0) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_ERR, DEBUG_ERR_STALE_JOURNAL));
+		DEBUG(0, (HELP_FORMAT_STRING, HELP_CLEANUP_STALE));
+		return OCSIM_ERROR;
+	}
+
+	talloc_free(journal);
+	journal = talloc_zero(ctx->mem_ctx, struct ocsim_journal);
+	OCSIM_RETVAL_IF(!journal, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+
+	journal->path = talloc_strdup(journal, path);
+	journal->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+	if (journal->fd == -1) {
+		perror(path);
+		talloc_free(journal);
+		journal = NULL;
+		return OCSIM_ERROR;
+	}
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Append an entry to the interface journal
+
+   \param type the entry type
+   \param ifname the interface name
+   \param ip_address the address assigned to the interface, may be NULL
+ */
+void openchangesim_journal_record(const char *type, const char *ifname, const char *ip_address)
+{
+	char	line[128];
+	int	len;
+
+	if (!journal || !type || !ifname) return;
+
+	len = snprintf(line, sizeof (line), "%s %s %s\n", type, ifname, ip_address ? ip_address : "-");
+	if (len <= 0 || len >= (int) sizeof (line)) return;
+
+	if (write(journal->fd, line, len) != len) {
+		perror("journal write");
+	}
+}
+
+
+/**
+   \details Close the interface journal
+
+   \param clean whether all the journaled interfaces were deleted, in
+   which case the journal is removed
+ */
+void openchangesim_journal_close(bool clean)
+{
+	if (!journal) return;
+
+	close(journal->fd);
+	if (clean) {
+		unlink(journal->path);
+	}
+	talloc_free(journal);
+	journal = NULL;
+}
+
+
+static struct ocsim_journal_pool *openchangesim_journal_pool(TALLOC_CTX *mem_ctx,
+							     struct ocsim_journal_pool **pools,
+							     uint32_t *count,
+							     const char *ifname)
+{
+	struct ocsim_journal_pool	*p;
+	uint32_t			i;
+
+	for (i = 0; i < *count; i++) {
+		if (!strcmp((*pools)[i].ifname, ifname)) {
+			return &(*pools)[i];
+		}
+	}
+
+	p = talloc_realloc(mem_ctx, *pools, struct ocsim_journal_pool, *count + 1);
+	if (!p) return NULL;
+	*pools = p;
+
+	p = &(*pools)[(*count)++];
+	memset(p, 0, sizeof (struct ocsim_journal_pool));
+	strncpy(p->ifname, ifname, sizeof (p->ifname) - 1);
+
+	return p;
+}
+
+
+/**
+   \details Delete the interfaces and addresses recorded in a journal
+   left behind by an interrupted run
+
+   \param ctx pointer to the OpenChangeSim context
+   \param path the journal path
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_journal_replay(struct ocsim_context *ctx, const char *path)
+{
+	TALLOC_CTX			*mem_ctx;
+	FILE				*f;
+	struct ocsim_interface		*interfaces = NULL;
+	struct ocsim_journal_pool	*pools = NULL;
+	struct ocsim_journal_pool	*p;
+	uint32_t			tap_count = 0;
+	uint32_t			pool_count = 0;
+	uint32_t			workers;
+	uint32_t			i;
+	char				line[128];
+	char				type[16];
+	char				ifname[OCSIM_IFNAMSIZ];
+	char				ip_address[64];
+	char				**ips;
+	int				ret = OCSIM_SUCCESS;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+	OCSIM_RETVAL_IF(!path, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	f = fopen(path, "r");
+	if (!f) {
+		printf("[*] No stale interfaces to delete\n");
+		return OCSIM_SUCCESS;
+	}
+
+	mem_ctx = talloc_named(ctx->mem_ctx, 0, "openchangesim_journal_replay");
+	while (fgets(line, sizeof (line), f)) {
+		if (sscanf(line, "%15s %15s %63s", type, ifname, ip_address) != 3) continue;
+
+		if (!strcmp(type, OCSIM_JOURNAL_TAP)) {
+			interfaces = talloc_realloc(mem_ctx, interfaces, struct ocsim_interface, tap_count + 1);
+			if (!interfaces) break;
+			interfaces[tap_count].fd = -1;
+			strncpy(interfaces[tap_count].name, ifname, sizeof (interfaces[tap_count].name) - 1);
+			interfaces[tap_count].name[sizeof (interfaces[tap_count].name) - 1] = '\0';
+			tap_count++;
+			continue;
+		}
+
+		if (!strcmp(type, OCSIM_JOURNAL_QDISC)) {
+			openchangesim_network_cleanup(ifname);
+			continue;
+		}
+
+		p = openchangesim_journal_pool(mem_ctx, &pools, &pool_count, ifname);
+		if (!p) break;
+		if (!strcmp(type, OCSIM_JOURNAL_LINK)) {
+			p->created = true;
+		} else if (!strcmp(type, OCSIM_JOURNAL_ADDR)) {
+			ips = talloc_realloc(pools, p->ip_addresses, char *, p->count + 1);
+			if (!ips) break;
+			p->ip_addresses = ips;
+			p->ip_addresses[p->count++] = talloc_strdup(pools, ip_address);
+		}
+	}
+	fclose(f);
+
+	workers = configuration_get_var_int(ctx, OCSIM_VAR_PROVISION_WORKERS, sysconf(_SC_NPROCESSORS_ONLN));
+	if (openchangesim_delete_interfaces_tap(stdout, interfaces, tap_count, workers) != OCSIM_SUCCESS) {
+		ret = OCSIM_ERROR;
+	}
+
+	for (i = 0; i < pool_count; i++) {
+		if (openchangesim_netlink_cleanup(mem_ctx, pools[i].ifname, pools[i].created,
+						  pools[i].ip_addresses, pools[i].count) != OCSIM_SUCCESS) {
+			ret = OCSIM_ERROR;
+		}
+	}
+
+	if (ret == OCSIM_SUCCESS) {
+		unlink(path);
+		printf("[*] %d stale interfaces and %d address pools deleted\n", tap_count, pool_count);
+	}
+	talloc_free(mem_ctx);
+
+	return ret;
+}
@@ -0,0 +1,299 @@
+/*
+   OpenChangeSim logon API
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_logon.c
+
+   \brief Logon path split into measured phases
+
+   MapiLogonEx() is performed as its two underlying provider logons so
+   that the NSPI (directory) and EMSMDB (CAS/store) connections are
+   measured separately. Each provider logon covers the RPC bind, the
+   NTLM/Kerberos authentication and the provider connect call, which
+   libmapi does not expose individually. A plain TCP connect to the
+   endpoint mapper is timed from the client source address to isolate
+   network latency, and opening the message store is timed last.
+
+   When the client profile is available in memory, from the profile
+   snapshot or the synthetic profile provider, the session is built
+   from it instead of the profile database.
+ */
+
+#include <poll.h>
+#include <arpa/inet.h>
+
+#include "src/openchangesim.h"
+
+static uint64_t openchangesim_logon_elapsed(struct timeval *start)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)(tv.tv_sec - start->tv_sec) * 1000000 +
+		(tv.tv_usec - start->tv_usec);
+}
+
+
+/**
+   \details Log onto a provider, building the MAPI session from the
+   in-memory profile of the client when available
+
+   The first logon creates the session as MapiLogonProvider() would,
+   without querying the profile database. Clients without an
+   in-memory profile fall back on MapiLogonProvider().
+
+   \param mapi_ctx pointer to the MAPI context
+   \param session pointer on pointer to the MAPI session
+   \param profname the profile name
+   \param provider_id the provider to log onto
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+static enum MAPISTATUS openchangesim_logon_provider(struct mapi_context *mapi_ctx,
+						    struct mapi_session **session,
+						    const char *profname,
+						    enum PROVIDER_ID provider_id)
+{
+	enum MAPISTATUS		retval;
+	struct mapi_session	*el;
+	struct mapi_profile	*profile;
+
+	/* A session is either built here or fully set up by a previous logon */
+	OPENCHANGE_RETVAL_IF(*session && (!(*session)->profile || !(*session)->mapi_ctx),
+			     MAPI_E_INVALID_PARAMETER, NULL);
+
+	if (!*session) {
+		el = talloc_zero(mapi_ctx->mem_ctx, struct mapi_session);
+		OPENCHANGE_RETVAL_IF(!el, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+		el->mapi_ctx = mapi_ctx;
+		el->emsmdb = talloc_zero(el, struct mapi_provider);
+		el->nspi = talloc_zero(el, struct mapi_provider);
+		el->profile = profile = talloc_zero(el, struct mapi_profile);
+		OPENCHANGE_RETVAL_IF(!el->emsmdb || !el->nspi || !profile, MAPI_E_NOT_ENOUGH_MEMORY, el);
+		profile->mapi_ctx = mapi_ctx;
+
+		if (!openchangesim_snapshot_fill(profile, profname) &&
+		    !openchangesim_synthetic_fill(profile, profname)) {
+			talloc_free(el);
+			return MapiLogonProvider(mapi_ctx, session, profname, NULL, provider_id);
+		}
+
+		retval = LoadProfile(mapi_ctx, profile);
+		OPENCHANGE_RETVAL_IF(retval != MAPI_E_SUCCESS, retval, el);
+
+		DLIST_ADD(mapi_ctx->session, el);
+		*session = el;
+	}
+
+	switch (provider_id) {
+	case PROVIDER_ID_EMSMDB:
+		return Logon(*session, (*session)->emsmdb, PROVIDER_ID_EMSMDB);
+	case PROVIDER_ID_NSPI:
+		return Logon(*session, (*session)->nspi, PROVIDER_ID_NSPI);
+	default:
+		return MAPI_E_INVALID_PARAMETER;
+	}
+}
+
+
+/**
+   \details Register the logon phases histograms
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_logon_register(void)
+{
+	const char	*phases[] = { OCSIM_STATS_LOGON_TCP, OCSIM_STATS_LOGON_NSPI,
+				      OCSIM_STATS_LOGON_EMSMDB, OCSIM_STATS_LOGON_STORE,
+				      OCSIM_STATS_PROFILE_NSPI, OCSIM_STATS_PROFILE_NETWORK,
+				      NULL };
+	int		i;
+
+	for (i = 0; phases[i]; i++) {
+		if (openchangesim_stats_register(phases[i]) == -1) {
+			return OCSIM_ERROR;
+		}
+	}
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Time a TCP connection to the server endpoint mapper from
+   the given source address
+
+   \param server the server hostname or IP address
+   \param localaddr the source address to bind, NULL for any
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_logon_tcp_probe(const char *server, const char *localaddr)
+{
+	struct addrinfo		hints;
+	struct addrinfo		*result = NULL;
+	struct addrinfo		*local = NULL;
+	struct pollfd		pfd;
+	struct timeval		tv;
+	socklen_t		len;
+	int			s;
+	int			err = 0;
+	int			ret = OCSIM_ERROR;
+
+	/* Sanity checks */
+	if (!server) return OCSIM_ERROR;
+
+	memset(&hints, 0, sizeof (struct addrinfo));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(server, OCSIM_LOGON_TCP_PORT, &hints, &result) || !result) {
+		return OCSIM_ERROR;
+	}
+
+	s = socket(result->ai_family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+	if (s == -1) {
+		freeaddrinfo(result);
+		return OCSIM_ERROR;
+	}
+
+	if (localaddr && *localaddr) {
+		hints.ai_family = result->ai_family;
+		hints.ai_flags = AI_NUMERICHOST;
+		if (!getaddrinfo(localaddr, "0", &hints, &local) && local) {
+			bind(s, local->ai_addr, local->ai_addrlen);
+			freeaddrinfo(local);
+		}
+	}
+
+	gettimeofday(&tv, NULL);
+	if (connect(s, result->ai_addr, result->ai_addrlen) == -1 && errno != EINPROGRESS) {
+		goto end;
+	}
+
+	pfd.fd = s;
+	pfd.events = POLLOUT;
+	if (poll(&pfd, 1, OCSIM_LOGON_TCP_TIMEOUT) != 1) {
+		goto end;
+	}
+
+	len = sizeof (err);
+	getsockopt(s, SOL_SOCKET, SO_ERROR, &err, &len);
+	openchangesim_stats_record_name(OCSIM_STATS_LOGON_TCP, openchangesim_logon_elapsed(&tv), !err);
+	ret = err ? OCSIM_ERROR : OCSIM_SUCCESS;
+
+end:
+	close(s);
+	freeaddrinfo(result);
+
+	return ret;
+}
+
+
+/**
+   \details Open a MAPI session on the given profile, measuring each
+   logon phase
+
+   \param mapi_ctx pointer to the MAPI context
+   \param log pointer to the current operation log, NULL if none
+   \param session pointer on pointer to the MAPI session
+   \param profname the profile name
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+enum MAPISTATUS openchangesim_logon(struct mapi_context *mapi_ctx,
+				    struct ocsim_log *log,
+				    struct mapi_session **session,
+				    const char *profname)
+{
+	enum MAPISTATUS		retval;
+	struct timeval		tv;
+
+	/* Objects opened on the previous session don't survive a logon */
+	openchangesim_session_invalidate();
+
+	gettimeofday(&tv, NULL);
+	openchangesim_log_call_start(log);
+	retval = openchangesim_logon_provider(mapi_ctx, session, profname, PROVIDER_ID_NSPI);
+	openchangesim_log_call_end(log, "MapiLogonProvider(NSPI)", retval);
+	openchangesim_stats_record_name(OCSIM_STATS_LOGON_NSPI, openchangesim_logon_elapsed(&tv),
+					retval == MAPI_E_SUCCESS);
+	if (retval != MAPI_E_SUCCESS) return retval;
+
+	if ((*session)->profile) {
+		openchangesim_logon_tcp_probe((*session)->profile->server,
+					      (*session)->profile->localaddr);
+	}
+
+	gettimeofday(&tv, NULL);
+	openchangesim_log_call_start(log);
+	retval = openchangesim_logon_provider(mapi_ctx, session, profname, PROVIDER_ID_EMSMDB);
+	openchangesim_log_call_end(log, "MapiLogonProvider(EMSMDB)", retval);
+	openchangesim_stats_record_name(OCSIM_STATS_LOGON_EMSMDB, openchangesim_logon_elapsed(&tv),
+					retval == MAPI_E_SUCCESS);
+
+	return retval;
+}
+
+
+/**
+   \details Release a MAPI session opened by openchangesim_logon()
+
+   The cached objects of the session are released first, then the
+   session is removed from the MAPI context and freed.
+
+   \param mapi_ctx pointer to the MAPI context
+   \param session pointer on pointer to the MAPI session, set to NULL
+ */
+void openchangesim_logoff(struct mapi_context *mapi_ctx, struct mapi_session **session)
+{
+	openchangesim_session_invalidate();
+
+	if (!mapi_ctx || !session || !*session) return;
+
+	DLIST_REMOVE(mapi_ctx->session, *session);
+	talloc_free(*session);
+	*session = NULL;
+}
+
+
+/**
+   \details Open the message store of a session, measuring the store
+   logon phase
+
+   \param log pointer to the current operation log, NULL if none
+   \param session pointer to the MAPI session
+   \param obj_store pointer to the store object to open
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+enum MAPISTATUS openchangesim_logon_store(struct ocsim_log *log,
+					  struct mapi_session *session,
+					  mapi_object_t *obj_store)
+{
+	enum MAPISTATUS		retval;
+	struct timeval		tv;
+
+	gettimeofday(&tv, NULL);
+	OCSIM_LOG_CALL(log, retval, OpenMsgStore, (session, obj_store));
+	openchangesim_stats_record_name(OCSIM_STATS_LOGON_STORE, openchangesim_logon_elapsed(&tv),
+					retval == MAPI_E_SUCCESS);
+
+	return retval;
+}
@@ -21,6 +21,16 @@
 
 #include "src/openchangesim.h"
 
+/**
+   \details Compute the number of microseconds elapsed between two
+   timevals
+ */
+static uint64_t openchangesim_log_elapsed(struct timeval *start, struct timeval *end)
+{
+	return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000 +
+		(end->tv_usec - start->tv_usec);
+}
+
 struct ocsim_log *openchangesim_log_init(TALLOC_CTX *mem_ctx)
 {
 	struct ocsim_log	*log = NULL;
@@ -42,31 +52,131 @@ void openchangesim_log_start(struct ocsim_log *log)
 	/* Sanity checks */
 	if (!log) return;
 
+	log->retval = MAPI_E_SUCCESS;
+	log->throttled = 0;
+	log->throttle_pending = false;
+	log->throttle_usec = 0;
+	log->call_count = 0;
+	log->call_dropped = 0;
+	log->msg_count = 0;
+	log->msg_bytes = 0;
+
 	gettimeofday(&log->tv_start, NULL);
 
 	return;
 }
 
-void openchangesim_log_end(struct ocsim_log *log,
-			   char *scenario, 
-			   char *case_name,
-			   const char *clientIP) 
+/**
+   \details Mark the beginning of a MAPI call within the current
+   operation
+
+   \param log pointer to the operation log
+ */
+void openchangesim_log_call_start(struct ocsim_log *log)
+{
+	/* Sanity checks */
+	if (!log) return;
+
+	gettimeofday(&log->tv_call, NULL);
+}
+
+/**
+   \details Record the duration and status of a MAPI call within the
+   current operation. Calls sharing the same name are aggregated so
+   the record remains bounded whatever the number of calls.
+
+   \param log pointer to the operation log
+   \param name the MAPI call name
+   \param retval the status returned by the call
+ */
+void openchangesim_log_call_end(struct ocsim_log *log, const char *name, enum MAPISTATUS retval)
+{
+	struct timeval		tv;
+	struct ocsim_log_call	*call = NULL;
+	uint64_t		usec;
+	uint32_t		i;
+
+	/* Sanity checks */
+	if (!log || !name) return;
+
+	gettimeofday(&tv, NULL);
+	usec = openchangesim_log_elapsed(&log->tv_call, &tv);
+
+	if (openchangesim_throttle_check(retval)) {
+		log->throttled++;
+		log->throttle_pending = true;
+	}
+
+	for (i = 0; i < log->call_count; i++) {
+		if (log->calls[i].name == name || !strcmp(log->calls[i].name, name)) {
+			call = &log->calls[i];
+			break;
+		}
+	}
+
+	if (!call) {
+		if (log->call_count == OCSIM_LOG_MAX_CALLS) {
+			log->call_dropped++;
+			return;
+		}
+		call = &log->calls[log->call_count++];
+		memset(call, 0, sizeof (struct ocsim_log_call));
+		call->name = name;
+	}
+
+	call->count++;
+	call->usec += usec;
+	if (usec > call->max_usec) {
+		call->max_usec = usec;
+	}
+	if (retval != MAPI_E_SUCCESS) {
+		call->retval = retval;
+		if (log->retval == MAPI_E_SUCCESS) {
+			log->retval = retval;
+		}
+	}
+}
+
+/**
+   \details Record a message processed by the current operation
+
+   \param log pointer to the operation log
+   \param mid the message identifier
+   \param size the message size in bytes
+ */
+void openchangesim_log_message(struct ocsim_log *log, uint64_t mid, uint64_t size)
+{
+	/* Sanity checks */
+	if (!log) return;
+
+	if (log->msg_count < OCSIM_LOG_MAX_MSGS) {
+		log->msg_id[log->msg_count] = mid;
+		log->msg_size[log->msg_count] = size;
+	}
+	log->msg_count++;
+	log->msg_bytes += size;
+}
+
+/**
+   \details Close the current operation, log its duration, record it
+   into the scenario histogram and offer it to the tail sampler
+
+   \return the operation duration in microseconds
+ */
+uint64_t openchangesim_log_end(struct ocsim_log *log,
+			       char *scenario, 
+			       char *case_name,
+			       const char *clientIP) 
 {
+	uint64_t	duration;
 	uint64_t	sec;
 	uint64_t	usec;
+	int		id;
 
 	gettimeofday(&log->tv_end, NULL);
-	sec = log->tv_end.tv_sec - log->tv_start.tv_sec;
-	if ((log->tv_end.tv_usec - log->tv_start.tv_usec) < 0) {
-		sec -= 1;
-		usec = log->tv_end.tv_usec + log->tv_start.tv_usec;
-		while (usec > 1000000) {
-			usec -= 1000000;
-			sec += 1;
-		}
-	} else {
-		usec = log->tv_end.tv_usec - log->tv_start.tv_usec;
-	}
+	duration = openchangesim_log_elapsed(&log->tv_start, &log->tv_end);
+	sec = duration / 1000000;
+	usec = duration % 1000000;
 
 	if (case_name) {
 		syslog(LOG_INFO, "%s: %s \"%s\": %ld seconds %ld microseconds", scenario, clientIP, 
@@ -76,10 +186,15 @@ void openchangesim_log_end(struct ocsim_log *log,
 		       (long int) sec, (long int) usec);
 	}
 
+	id = openchangesim_stats_lookup(scenario);
+	openchangesim_stats_record(id, duration, log->retval == MAPI_E_SUCCESS);
+	openchangesim_stats_record_throttle(id, log->throttled, log->throttle_usec);
+	openchangesim_tail_add(log, duration, scenario, case_name, clientIP);
+
 	memset(&log->tv_start, 0, sizeof (struct timeval));
 	memset(&log->tv_end, 0, sizeof (struct timeval));
 
-	return;
+	return duration;
 }
 
 void openchangesim_log_close(struct ocsim_log *log)
@@ -29,6 +29,10 @@ uint32_t openchangesim_register_modules(struct ocsim_context *ctx)
 	ret = module_sendmail_init(ctx);
 	ret = module_fetchmail_init(ctx);
 
+	if (openchangesim_register_transactions(ctx) == OCSIM_ERROR) {
+		return OCSIM_ERROR;
+	}
+
 	return ret;
 }
 
@@ -58,6 +62,7 @@ uint32_t openchangesim_module_register(struct ocsim_context *ctx,
 	}
 
 	DLIST_ADD_END(ctx->modules, module, struct ocsim_module *);
+	openchangesim_stats_register(module->name);
 	DEBUG(0, (DEBUG_FORMAT_STRING_MODULE, module->name, "Module loaded"));
 
 	return OCSIM_SUCCESS;
@@ -170,43 +175,270 @@ struct ocsim_scenario_case *module_get_scenario_data(struct ocsim_context *ctx,
 	return NULL;
 }
 
+static struct ocsim_module *openchangesim_module_lookup(struct ocsim_context *ctx, const char *name)
+{
+	struct ocsim_module	*el;
+
+	for (el = ctx->modules; el; el = el->next) {
+		if (el->name && !strcmp(el->name, name)) {
+			return el;
+		}
+	}
+
+	return NULL;
+}
+
+static struct ocsim_scenario_case *openchangesim_module_lookup_case(struct ocsim_module *module,
+								    const char *name)
+{
+	struct ocsim_scenario_case	*el;
+
+	for (el = module->cases; el; el = el->next) {
+		if (el->name && !strcmp(el->name, name)) {
+			return el;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+   \details Validate the transactions defined in the configuration and
+   register their histograms
+
+   Transaction steps can only refer to registered modules, i.e. a
+   scenario block must exist for each module used by a transaction. Its
+   repeat value can be 0 if the module should only run as part of
+   transactions.
+
+   \param ctx pointer to the openchangesim context
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+uint32_t openchangesim_register_transactions(struct ocsim_context *ctx)
+{
+	struct ocsim_transaction	*el;
+	struct ocsim_transaction_step	*step;
+	struct ocsim_module		*module;
+
+	/* Sanity checks */
+	if (!ctx || !ctx->mem_ctx) return OCSIM_ERROR;
+
+	for (el = ctx->transactions; el; el = el->next) {
+		if (openchangesim_module_lookup(ctx, el->name)) {
+			DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, el->name, DEBUG_ERR_DUPLICATE_TRANSACTION));
+			return OCSIM_ERROR;
+		}
+		for (step = el->steps; step; step = step->next) {
+			module = openchangesim_module_lookup(ctx, step->module);
+			if (!module || (step->case_name && !openchangesim_module_lookup_case(module, step->case_name))) {
+				DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, el->name, DEBUG_ERR_INVALID_STEP));
+				return OCSIM_ERROR;
+			}
+		}
+		openchangesim_stats_register(el->name);
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE, el->name, "Transaction loaded"));
+	}
+
+	return OCSIM_SUCCESS;
+}
+
+static bool openchangesim_transaction_ref_count(struct ocsim_context *ctx)
+{
+	struct ocsim_transaction	*el;
+
+	for (el = ctx->transactions; el; el = el->next) {
+		if (el->repeat > 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+   \details Run all the steps of a transaction and log its end-to-end
+   latency under the transaction name
+
+   The steps share the client session. It is logged on if needed and
+   released when a step fails, so that the next run logs on again.
+ */
+static uint32_t openchangesim_transaction_run(TALLOC_CTX *mem_ctx,
+					      struct ocsim_context *ctx,
+					      struct mapi_context *mapi_ctx,
+					      struct ocsim_transaction *transaction,
+					      char *profname,
+					      struct mapi_session **session)
+{
+	struct ocsim_transaction_step	*step;
+	struct ocsim_module		*module;
+	struct ocsim_scenario_case	single;
+	struct ocsim_scenario_case	*cases;
+	struct ocsim_log		*log;
+	enum MAPISTATUS			retval;
+	uint32_t			ret = OCSIM_SUCCESS;
+	char				*addr = NULL;
+
+	log = openchangesim_log_init(mem_ctx);
+	openchangesim_log_start(log);
+	for (step = transaction->steps; step; step = step->next) {
+		module = openchangesim_module_lookup(ctx, step->module);
+
+		cases = module->cases;
+		if (step->case_name) {
+			single = *openchangesim_module_lookup_case(module, step->case_name);
+			single.prev = NULL;
+			single.next = NULL;
+			cases = &single;
+		}
+
+		if (!*session) {
+			retval = openchangesim_logon(mapi_ctx, log, session, profname);
+			if (retval) {
+				openchangesim_log_string("Opening session for %s failed", profname);
+				openchangesim_logoff(mapi_ctx, session);
+				ret = OCSIM_ERROR;
+				break;
+			}
+		}
+		if (!addr) {
+			addr = talloc_strdup(mem_ctx, (*session)->profile->localaddr);
+		}
+
+		if (module->run(ctx, cases, *session) != OCSIM_SUCCESS) {
+			if (log->retval == MAPI_E_SUCCESS) {
+				log->retval = MAPI_E_CALL_FAILED;
+			}
+			openchangesim_logoff(mapi_ctx, session);
+			ret = OCSIM_ERROR;
+			break;
+		}
+	}
+	openchangesim_log_end(log, (char *)transaction->name, NULL, addr ? addr : profname);
+	openchangesim_log_close(log);
+	talloc_free(addr);
+
+	return ret;
+}
+
 uint32_t openchangesim_modules_run(struct ocsim_context *ctx, struct mapi_context *mapi_ctx, char *profname)
 {
-	TALLOC_CTX		*mem_ctx;
-	struct mapi_session	*session;
-	struct ocsim_module	*el = NULL;
-	enum MAPISTATUS 	retval;
+	TALLOC_CTX			*mem_ctx;
+	struct mapi_session		*session = NULL;
+	struct ocsim_module		*el = NULL;
+	struct ocsim_transaction	*transaction;
+	enum MAPISTATUS 		retval;
+	bool				reuse;
 
 	mem_ctx = talloc_named(NULL, 0, "openchangesim_modules_run");
-	session = talloc_zero(mem_ctx, struct mapi_session);
 	if (!mem_ctx) {
 		DEBUG(0, ("No more memory available\n"));
 		return OCSIM_ERROR;
 	}
 
+	openchangesim_tail_init(ctx, profname);
+	openchangesim_throttle_init(ctx);
+	reuse = (configuration_get_var_int(ctx, OCSIM_VAR_SESSION_REUSE, 0) != 0);
+
 	do {
 		for (el = ctx->modules; el; el = el->next) {
 			if (el->get_ref_count(el) > 0) {
-				retval = MapiLogonEx(mapi_ctx, &session, profname, NULL);
-				if (retval) {
-					openchangesim_log_string("Opening session for %s failed", profname);
-					return OCSIM_ERROR;
+				if (!session) {
+					retval = openchangesim_logon(mapi_ctx, NULL, &session, profname);
+					if (retval) {
+						openchangesim_log_string("Opening session for %s failed", profname);
+						openchangesim_tail_dump();
+						openchangesim_logoff(mapi_ctx, &session);
+						talloc_free(mem_ctx);
+						return OCSIM_ERROR;
+					}
+				}
+				/* A failed module may have lost the connection, log on again */
+				if (el->run(ctx, el->cases, session) != OCSIM_SUCCESS || !reuse) {
+					openchangesim_logoff(mapi_ctx, &session);
 				}
-				el->run(ctx, el->cases, session);
 				el->set_ref_count(el, -1);
 			}
 		}
-	} while (openchangesim_module_ref_count(ctx) == true);
+		for (transaction = ctx->transactions; transaction; transaction = transaction->next) {
+			if (transaction->repeat > 0) {
+				openchangesim_transaction_run(mem_ctx, ctx, mapi_ctx, transaction,
+							      profname, &session);
+				if (!reuse) {
+					openchangesim_logoff(mapi_ctx, &session);
+				}
+				transaction->repeat--;
+			}
+		}
+	} while (openchangesim_module_ref_count(ctx) == true ||
+		 openchangesim_transaction_ref_count(ctx) == true);
 
-	retval = MapiLogonEx(mapi_ctx, &session, profname, NULL);
-	if (retval) {
-		openchangesim_log_string("Opening session for %s failed", profname);
-		return OCSIM_ERROR;
+	openchangesim_tail_dump();
+
+	if (!session) {
+		retval = openchangesim_logon(mapi_ctx, NULL, &session, profname);
+		if (retval) {
+			openchangesim_log_string("Opening session for %s failed", profname);
+			openchangesim_logoff(mapi_ctx, &session);
+			talloc_free(mem_ctx);
+			return OCSIM_ERROR;
+		}
 	}
 
 	module_cleanup_run(ctx, session);
-	talloc_free(session);
+	openchangesim_logoff(mapi_ctx, &session);
 	talloc_free(mem_ctx);
 
 	return OCSIM_SUCCESS;
 }
+
+
+/**
+   \details Resolve the stream chunk sizes of a scenario and register
+   the histograms of a chunk size sweep
+
+   Must be called by the parent when the module is initialized. A
+   scenario without chunk_size uses the stream_chunk_size variable.
+
+   \param ctx pointer to the OpenChangeSim context
+   \param el pointer to the scenario
+   \param name the stream histogram name
+ */
+void openchangesim_module_chunk_init(struct ocsim_context *ctx, struct ocsim_scenario *el, const char *name)
+{
+	char		sname[OCSIM_STATS_NAME_LEN];
+	uint32_t	i;
+
+	if (!el) return;
+
+	if (!el->chunk_count) {
+		el->chunk_sizes[0] = configuration_get_var_int(ctx, OCSIM_VAR_STREAM_CHUNK_SIZE, MAX_READ_SIZE);
+		if (!el->chunk_sizes[0] || el->chunk_sizes[0] > OCSIM_STREAM_MAX_CHUNK) {
+			el->chunk_sizes[0] = OCSIM_STREAM_MAX_CHUNK;
+		}
+		el->chunk_count = 1;
+	}
+	el->chunk_next = 0;
+
+	openchangesim_stats_register(name);
+	for (i = 0; el->chunk_count > 1 && i < el->chunk_count; i++) {
+		snprintf(sname, sizeof (sname), OCSIM_STREAM_STATS_NAME, name, el->chunk_sizes[i]);
+		openchangesim_stats_register(sname);
+	}
+}
+
+
+/**
+   \details Retrieve the stream chunk size of the next message of a
+   scenario, cycling through the sizes of a sweep
+
+   \param el pointer to the scenario
+
+   \return the chunk size in bytes
+ */
+uint32_t openchangesim_module_chunk_size(struct ocsim_scenario *el)
+{
+	if (!el || !el->chunk_count) return MAX_READ_SIZE;
+
+	return el->chunk_sizes[el->chunk_next++ % el->chunk_count];
+}
@@ -0,0 +1,455 @@
+/*
+   OpenChangeSim netlink address pool
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_netlink.c
+
+   \brief Client source addresses assigned to a single interface
+
+   Instead of one tap device per user, all source IPv4 and IPv6
+   addresses are added to a single dummy or loopback interface named
+   by address_pool. The
+   interface is created as a dummy link when it doesn't exist.
+   Addresses are added and removed with rtnetlink messages batched in
+   large buffers, only the last message of a batch is acknowledged.
+ */
+
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#include <linux/if_link.h>
+
+#include "src/openchangesim.h"
+
+struct ocsim_netlink_addr
+{
+	uint8_t		family;
+	uint8_t		data[16];
+};
+
+struct ocsim_netlink
+{
+	char		ifname[OCSIM_IFNAMSIZ];
+	int		ifindex;
+	bool		created;
+	uint32_t	seq;
+	struct ocsim_netlink_addr	*addrs;
+	uint32_t	count;
+};
+
+static struct ocsim_netlink	*pool = NULL;
+
+
+/**
+   \details Enable the address pool if configured
+
+   \param ctx pointer to the OpenChangeSim context
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_netlink_init(struct ocsim_context *ctx)
+{
+	const char	*ifname;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+
+	ifname = configuration_get_var(ctx, OCSIM_VAR_ADDRESS_POOL);
+	if (!ifname || !*ifname) return OCSIM_SUCCESS;
+
+	talloc_free(pool);
+	pool = talloc_zero(ctx->mem_ctx, struct ocsim_netlink);
+	OCSIM_RETVAL_IF(!pool, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+	strncpy(pool->ifname, ifname, sizeof (pool->ifname) - 1);
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Check whether the address pool replaces tap interfaces
+
+   \return true if enabled, otherwise false
+ */
+bool openchangesim_netlink_enabled(void)
+{
+	return pool != NULL;
+}
+
+
+static int openchangesim_netlink_open(void)
+{
+	struct sockaddr_nl	sa;
+	int			s;
+	int			size = OCSIM_NETLINK_BUFSIZE * 4;
+
+	s = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (s == -1) {
+		perror("netlink socket");
+		return -1;
+	}
+	setsockopt(s, SOL_SOCKET, SO_SNDBUF, &size, sizeof (size));
+	if (setsockopt(s, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof (size)) == -1) {
+		setsockopt(s, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+	}
+
+	memset(&sa, 0, sizeof (struct sockaddr_nl));
+	sa.nl_family = AF_NETLINK;
+	if (bind(s, (struct sockaddr *) &sa, sizeof (sa)) == -1) {
+		perror("netlink bind");
+		close(s);
+		return -1;
+	}
+
+	return s;
+}
+
+
+static struct rtattr *openchangesim_netlink_attr(struct nlmsghdr *nlh, uint16_t type,
+						 const void *data, size_t len)
+{
+	struct rtattr	*rta;
+
+	rta = (struct rtattr *)((char *) nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	if (len) {
+		memcpy(RTA_DATA(rta), data, len);
+	}
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+
+	return rta;
+}
+
+
+/**
+   Send a batch of requests with sequence numbers first to last. Only
+   the last request asks for an acknowledgement, the kernel still
+   reports the failure of any other request. Errors matching ignore
+   (e.g. EEXIST) are not counted as failures.
+ */
+static uint32_t openchangesim_netlink_send(int s, char *buf, size_t len,
+					   uint32_t first, uint32_t last, int ignore)
+{
+	struct nlmsghdr		*nlh;
+	struct nlmsgerr		*err;
+	char			reply[OCSIM_NETLINK_BUFSIZE];
+	ssize_t			n;
+	uint32_t		failed = 0;
+
+	if (send(s, buf, len, 0) != (ssize_t) len) {
+		perror("netlink send");
+		return last - first + 1;
+	}
+
+	for (;;) {
+		n = recv(s, reply, sizeof (reply), 0);
+		if (n <= 0) {
+			if (n == -1 && errno == EINTR) continue;
+			perror("netlink recv");
+			return failed + 1;
+		}
+
+		for (nlh = (struct nlmsghdr *) reply; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+			/* Skip replies left over from a previous batch */
+			if (nlh->nlmsg_type != NLMSG_ERROR || nlh->nlmsg_seq < first || nlh->nlmsg_seq > last) {
+				continue;
+			}
+			err = (struct nlmsgerr *) NLMSG_DATA(nlh);
+			if (err->error && -err->error != ignore) {
+				failed++;
+			}
+			if (nlh->nlmsg_seq == last) {
+				return failed;
+			}
+		}
+	}
+}
+
+
+static int openchangesim_netlink_link(int s, int type, uint16_t flags, int ifindex, bool kind)
+{
+	struct {
+		struct nlmsghdr		nlh;
+		struct ifinfomsg	ifi;
+		char			attrs[256];
+	} req;
+	struct rtattr	*linkinfo;
+
+	memset(&req, 0, sizeof (req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof (struct ifinfomsg));
+	req.nlh.nlmsg_type = type;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	req.nlh.nlmsg_seq = ++pool->seq;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+
+	if (kind) {
+		openchangesim_netlink_attr(&req.nlh, IFLA_IFNAME, pool->ifname, strlen(pool->ifname) + 1);
+		linkinfo = openchangesim_netlink_attr(&req.nlh, IFLA_LINKINFO, NULL, 0);
+		openchangesim_netlink_attr(&req.nlh, IFLA_INFO_KIND, "dummy", strlen("dummy"));
+		linkinfo->rta_len = (char *) &req + req.nlh.nlmsg_len - (char *) linkinfo;
+	} else if (type == RTM_NEWLINK) {
+		req.ifi.ifi_flags = IFF_UP;
+		req.ifi.ifi_change = IFF_UP;
+	}
+
+	return openchangesim_netlink_send(s, (char *) &req, req.nlh.nlmsg_len, pool->seq, pool->seq, 0) ?
+		OCSIM_ERROR : OCSIM_SUCCESS;
+}
+
+
+static bool openchangesim_netlink_parse(const char *ip_address, struct ocsim_netlink_addr *addr)
+{
+	if (inet_pton(AF_INET, ip_address, addr->data) == 1) {
+		addr->family = AF_INET;
+	} else if (inet_pton(AF_INET6, ip_address, addr->data) == 1) {
+		addr->family = AF_INET6;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+
+static uint32_t openchangesim_netlink_addresses(int s, int type, struct ocsim_netlink_addr *addrs, uint32_t count)
+{
+	struct nlmsghdr		*nlh;
+	struct ifaddrmsg	*ifa;
+	char			*buf;
+	size_t			len = 0;
+	uint32_t		first = pool->seq + 1;
+	uint32_t		failed = 0;
+	uint32_t		i;
+	size_t			alen;
+	int			ignore = (type == RTM_NEWADDR) ? EEXIST : EADDRNOTAVAIL;
+
+	buf = talloc_zero_array(pool, char, OCSIM_NETLINK_BUFSIZE);
+	if (!buf) return count;
+
+	for (i = 0; i < count; i++) {
+		nlh = (struct nlmsghdr *)(buf + len);
+		memset(nlh, 0, NLMSG_SPACE(sizeof (struct ifaddrmsg)) + 2 * RTA_SPACE(sizeof (addrs[i].data)));
+		nlh->nlmsg_len = NLMSG_LENGTH(sizeof (struct ifaddrmsg));
+		nlh->nlmsg_type = type;
+		nlh->nlmsg_flags = NLM_F_REQUEST;
+		if (type == RTM_NEWADDR) {
+			nlh->nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+		}
+		nlh->nlmsg_seq = ++pool->seq;
+
+		ifa = (struct ifaddrmsg *) NLMSG_DATA(nlh);
+		alen = (addrs[i].family == AF_INET) ? 4 : 16;
+		ifa->ifa_family = addrs[i].family;
+		ifa->ifa_prefixlen = alen * 8;
+		ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+		ifa->ifa_index = pool->ifindex;
+		/* Skip duplicate address detection, addresses are usable at once */
+		if (addrs[i].family == AF_INET6) {
+			ifa->ifa_flags = IFA_F_NODAD;
+		}
+
+		openchangesim_netlink_attr(nlh, IFA_LOCAL, addrs[i].data, alen);
+		openchangesim_netlink_attr(nlh, IFA_ADDRESS, addrs[i].data, alen);
+		len += NLMSG_ALIGN(nlh->nlmsg_len);
+
+		if (len + OCSIM_NETLINK_MSGSIZE > OCSIM_NETLINK_BUFSIZE || i == count - 1) {
+			nlh->nlmsg_flags |= NLM_F_ACK;
+			failed += openchangesim_netlink_send(s, buf, len, first, pool->seq, ignore);
+			first = pool->seq + 1;
+			len = 0;
+		}
+	}
+	talloc_free(buf);
+
+	return failed;
+}
+
+
+/**
+   \details Add client source addresses to the pool interface
+
+   The interface is created as a dummy link and brought up if needed.
+
+   \param f the stream to report progress on
+   \param interfaces array of interfaces to fill, may be NULL
+   \param ip_addresses array of IP addresses to add, NULL entries are
+   skipped
+   \param count the number of entries in both arrays
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_netlink_add(FILE *f, struct ocsim_interface *interfaces,
+			      char **ip_addresses, uint32_t count)
+{
+	struct ocsim_netlink_addr	*addrs;
+	uint32_t	n = 0;
+	uint32_t	i;
+	uint32_t	failed;
+	char		logstr[128];
+	int		s;
+
+	if (!pool) return OCSIM_ERROR;
+
+	s = openchangesim_netlink_open();
+	if (s == -1) return OCSIM_ERROR;
+
+	if (!pool->ifindex) {
+		pool->ifindex = if_nametoindex(pool->ifname);
+		if (!pool->ifindex) {
+			openchangesim_journal_record(OCSIM_JOURNAL_LINK, pool->ifname, NULL);
+			if (openchangesim_netlink_link(s, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, 0, true)) {
+				DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, pool->ifname, "Unable to create dummy interface"));
+				close(s);
+				return OCSIM_ERROR;
+			}
+			pool->ifindex = if_nametoindex(pool->ifname);
+			if (!pool->ifindex) {
+				DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, pool->ifname, "Unable to find the dummy interface"));
+				close(s);
+				return OCSIM_ERROR;
+			}
+			pool->created = true;
+		}
+		if (openchangesim_netlink_link(s, RTM_NEWLINK, 0, pool->ifindex, false)) {
+			DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, pool->ifname, "Unable to bring the interface up"));
+			if (pool->created) {
+				openchangesim_netlink_link(s, RTM_DELLINK, 0, pool->ifindex, false);
+			}
+			pool->ifindex = 0;
+			pool->created = false;
+			close(s);
+			return OCSIM_ERROR;
+		}
+	}
+
+	addrs = talloc_realloc(pool, pool->addrs, struct ocsim_netlink_addr, pool->count + count);
+	if (!addrs) {
+		close(s);
+		return OCSIM_ERROR;
+	}
+	pool->addrs = addrs;
+
+	for (i = 0; i < count; i++) {
+		if (!ip_addresses[i]) continue;
+		if (!openchangesim_netlink_parse(ip_addresses[i], &addrs[pool->count + n])) {
+			DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, ip_addresses[i], "Invalid address"));
+			continue;
+		}
+		openchangesim_journal_record(OCSIM_JOURNAL_ADDR, pool->ifname, ip_addresses[i]);
+		if (interfaces) {
+			interfaces[i].fd = -1;
+			strncpy(interfaces[i].name, pool->ifname, sizeof (interfaces[i].name) - 1);
+		}
+		n++;
+	}
+
+	failed = openchangesim_netlink_addresses(s, RTM_NEWADDR, &addrs[pool->count], n);
+	pool->count += n;
+	close(s);
+
+	snprintf(logstr, sizeof (logstr), "[*] %d addresses added to %s\n", n - failed, pool->ifname);
+	openchangesim_printlog(f, logstr);
+
+	return failed ? OCSIM_ERROR : OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Remove the client source addresses from the pool
+   interface, deleting the interface if it was created by us
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_netlink_release(void)
+{
+	uint32_t	failed = 0;
+	int		s;
+
+	if (!pool || !pool->ifindex) return OCSIM_SUCCESS;
+
+	s = openchangesim_netlink_open();
+	if (s == -1) return OCSIM_ERROR;
+
+	if (pool->created) {
+		failed = openchangesim_netlink_link(s, RTM_DELLINK, 0, pool->ifindex, false);
+	} else {
+		failed = openchangesim_netlink_addresses(s, RTM_DELADDR, pool->addrs, pool->count);
+	}
+	close(s);
+
+	printf("[*] %d addresses removed from %s\n", pool->count, pool->ifname);
+	talloc_free(pool->addrs);
+	pool->addrs = NULL;
+	pool->count = 0;
+	pool->ifindex = 0;
+	pool->created = false;
+
+	return failed ? OCSIM_ERROR : OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Remove the addresses a previous run left on a pool
+   interface
+
+   \param mem_ctx pointer to the memory context
+   \param ifname the pool interface name
+   \param created whether the previous run created the interface, in
+   which case it is deleted
+   \param ip_addresses array of IP addresses to remove
+   \param count the number of addresses
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_netlink_cleanup(TALLOC_CTX *mem_ctx, const char *ifname, bool created,
+				  char **ip_addresses, uint32_t count)
+{
+	uint32_t	i;
+	int		ret;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ifname, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	talloc_free(pool);
+	pool = talloc_zero(mem_ctx, struct ocsim_netlink);
+	OCSIM_RETVAL_IF(!pool, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+	strncpy(pool->ifname, ifname, sizeof (pool->ifname) - 1);
+	pool->ifindex = if_nametoindex(ifname);
+	pool->created = created;
+
+	pool->addrs = talloc_array(pool, struct ocsim_netlink_addr, count);
+	for (i = 0; pool->addrs && i < count; i++) {
+		if (openchangesim_netlink_parse(ip_addresses[i], &pool->addrs[pool->count])) {
+			pool->count++;
+		}
+	}
+
+	/* Nothing is sent when the interface is already gone */
+	ret = (count && !pool->addrs) ? OCSIM_ERROR : openchangesim_netlink_release();
+	talloc_free(pool);
+	pool = NULL;
+
+	return ret;
+}
@@ -0,0 +1,367 @@
+/*
+   OpenChangeSim network conditions emulation
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_network.c
+
+   \brief Latency, jitter, loss and bandwidth per group of users
+
+   Client traffic leaves the host through the interface routing to the
+   server, not through the per-user interfaces. Each network group is
+   an htb class on that interface, with a netem qdisc for latency,
+   jitter and loss, selected by u32 filters on the source prefixes of
+   the group users. Latency is applied once, on egress, so it is the
+   round trip time added.
+
+   With a users_file, a group is made of the users whose group field
+   is the group name, in addition to its users range, and is matched
+   on the address of each user.
+
+   Downstream bandwidth is shaped on an ifb interface (network_ifb)
+   the ingress traffic is redirected to, with filters on the
+   destination prefixes. Without it, only upstream bandwidth is
+   limited.
+
+   The rules are loaded with a single tc -batch invocation. They
+   replace the root and ingress qdiscs of the interfaces, which fall
+   back on the kernel defaults once released. An interface found from
+   the route to the server is only used while it has the default
+   qdiscs; setting network_device explicitly allows replacing a
+   configuration of the host.
+ */
+
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <arpa/inet.h>
+
+#include "src/openchangesim.h"
+
+struct ocsim_network_state
+{
+	char		device[OCSIM_IFNAMSIZ];
+	char		ifb[OCSIM_IFNAMSIZ];
+};
+
+static struct ocsim_network_state	*network = NULL;
+
+
+static bool openchangesim_network_device(TALLOC_CTX *mem_ctx, const char *address,
+					 char *device, size_t len)
+{
+	struct addrinfo		hints;
+	struct addrinfo		*result = NULL;
+	char			buf[INET6_ADDRSTRLEN];
+	char			line[256];
+	char			*cmd;
+	char			*p;
+	FILE			*f;
+	bool			found = false;
+
+	memset(&hints, 0, sizeof (struct addrinfo));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(address, NULL, &hints, &result) || !result) return false;
+
+	if (result->ai_family == AF_INET6) {
+		inet_ntop(AF_INET6, &((struct sockaddr_in6 *) result->ai_addr)->sin6_addr, buf, sizeof (buf));
+	} else {
+		inet_ntop(AF_INET, &((struct sockaddr_in *) result->ai_addr)->sin_addr, buf, sizeof (buf));
+	}
+	freeaddrinfo(result);
+
+	cmd = talloc_asprintf(mem_ctx, OCSIM_NETWORK_ROUTE, buf);
+	f = popen(cmd, "r");
+	talloc_free(cmd);
+	if (!f) return false;
+
+	if (fgets(line, sizeof (line), f) && (p = strstr(line, " dev "))) {
+		device[0] = '\0';
+		strncat(device, p + 5, len - 1);
+		device[strcspn(device, " \n")] = '\0';
+		found = (device[0] != '\0');
+	}
+	pclose(f);
+
+	return found;
+}
+
+
+static bool openchangesim_network_default(TALLOC_CTX *mem_ctx, const char *device)
+{
+	char	line[256];
+	char	*cmd;
+	char	*p;
+	FILE	*f;
+	bool	ret = true;
+
+	cmd = talloc_asprintf(mem_ctx, OCSIM_NETWORK_QDISC, device);
+	f = popen(cmd, "r");
+	talloc_free(cmd);
+	if (!f) return false;
+
+	/* Qdiscs set by the kernel are the only ones with handle 0: */
+	while (fgets(line, sizeof (line), f)) {
+		if (strncmp(line, "qdisc ", 6)) continue;
+		p = strchr(line + 6, ' ');
+		if (!p || strncmp(p + 1, "0: ", 3)) {
+			ret = false;
+		}
+	}
+	if (pclose(f)) {
+		ret = false;
+	}
+
+	return ret;
+}
+
+
+static int openchangesim_network_up(const char *ifname)
+{
+	struct ifreq	ifr;
+	int		s;
+	int		ret = OCSIM_SUCCESS;
+
+	s = socket(AF_INET, SOCK_DGRAM, 0);
+	if (s == -1) return OCSIM_ERROR;
+
+	memset(&ifr, 0, sizeof (ifr));
+	strncpy(ifr.ifr_name, ifname, sizeof (ifr.ifr_name) - 1);
+	if (ioctl(s, SIOCGIFFLAGS, &ifr) < 0) {
+		perror(ifname);
+		ret = OCSIM_ERROR;
+	} else if (!(ifr.ifr_flags & IFF_UP)) {
+		ifr.ifr_flags |= IFF_UP;
+		if (ioctl(s, SIOCSIFFLAGS, &ifr) < 0) {
+			perror(ifname);
+			ret = OCSIM_ERROR;
+		}
+	}
+	close(s);
+
+	return ret;
+}
+
+
+static void openchangesim_network_tree(FILE *f, TALLOC_CTX *mem_ctx,
+				       struct ocsim_context *ctx,
+				       struct ocsim_server *el,
+				       const char *dev, const char *match,
+				       bool netem)
+{
+	struct ocsim_network	*net;
+	bool			ipv6;
+	char			**prefixes;
+	char			rate[32];
+	uint32_t		classid;
+	uint32_t		first;
+	uint32_t		last;
+	uint32_t		i;
+
+	fprintf(f, "qdisc add dev %s root handle 1: htb default 1\n", dev);
+	fprintf(f, "class add dev %s parent 1: classid 1:1 htb rate %s quantum %d\n",
+		dev, OCSIM_NETWORK_LINE_RATE, OCSIM_NETWORK_QUANTUM);
+
+	for (net = ctx->networks, classid = OCSIM_NETWORK_CLASSID; net; net = net->next, classid++) {
+		if (openchangesim_roster_enabled()) {
+			prefixes = openchangesim_roster_prefixes(mem_ctx, el, net);
+		} else {
+			/* Users of the group which belong to the server range */
+			first = (net->range_start > el->range_start) ? net->range_start : el->range_start;
+			last = (net->range_end < el->range_end - 1) ? net->range_end : el->range_end - 1;
+			if (first > last) continue;
+
+			prefixes = configuration_get_ip_prefixes(mem_ctx, el->ip_range, first - el->range_start,
+								 last - first + 1);
+		}
+		if (!prefixes) continue;
+
+		if (net->bandwidth) {
+			snprintf(rate, sizeof (rate), "%ukbit", net->bandwidth);
+		} else {
+			snprintf(rate, sizeof (rate), "%s", OCSIM_NETWORK_LINE_RATE);
+		}
+		fprintf(f, "class add dev %s parent 1: classid 1:%x htb rate %s quantum %d\n",
+			dev, classid, rate, OCSIM_NETWORK_QUANTUM);
+
+		if (netem && (net->latency || net->loss)) {
+			fprintf(f, "qdisc add dev %s parent 1:%x handle %x: netem limit %d",
+				dev, classid, classid, OCSIM_NETWORK_NETEM_LIMIT);
+			if (net->latency) {
+				fprintf(f, " delay %ums %ums", net->latency, net->jitter);
+			}
+			if (net->loss) {
+				fprintf(f, " loss %s%%", net->loss);
+			}
+			fprintf(f, "\n");
+		}
+
+		for (i = 0; prefixes[i]; i++) {
+			ipv6 = (strchr(prefixes[i], ':') != NULL);
+			fprintf(f, "filter add dev %s parent 1: protocol %s prio 1 u32 match %s %s %s flowid 1:%x\n",
+				dev, ipv6 ? "ipv6" : "ip", ipv6 ? "ip6" : "ip", match, prefixes[i], classid);
+		}
+		talloc_free(prefixes);
+	}
+}
+
+
+/**
+   \details Apply the network conditions of the configured network
+   groups to the users of a server
+
+   \param ctx pointer to the OpenChangeSim context
+   \param server the server name
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_network_apply(struct ocsim_context *ctx, const char *server)
+{
+	TALLOC_CTX		*mem_ctx;
+	struct ocsim_server	*el;
+	const char		*device;
+	const char		*ifb;
+	FILE			*f;
+	char			logstr[128];
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+
+	if (!ctx->networks) return OCSIM_SUCCESS;
+
+	el = configuration_validate_server(ctx, server);
+	OCSIM_RETVAL_IF(!el, OCSIM_ERROR, OCSIM_INVALID_SERVER, NULL);
+
+	if (!el->range || (!el->ip_range && !openchangesim_roster_enabled())) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_WARN, "Network groups require a user range and an IP range"));
+		return OCSIM_SUCCESS;
+	}
+
+	talloc_free(network);
+	network = talloc_zero(ctx->mem_ctx, struct ocsim_network_state);
+	OCSIM_RETVAL_IF(!network, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+	mem_ctx = talloc_named(network, 0, "openchangesim_network_apply");
+
+	device = configuration_get_var(ctx, OCSIM_VAR_NETWORK_DEVICE);
+	if (device) {
+		strncpy(network->device, device, sizeof (network->device) - 1);
+	} else if (!openchangesim_network_device(mem_ctx, el->address, network->device,
+						 sizeof (network->device))) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, el->address, "Unable to find the route to the server"));
+		talloc_free(network);
+		network = NULL;
+		return OCSIM_ERROR;
+	} else if (!openchangesim_network_default(mem_ctx, network->device)) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, network->device, DEBUG_ERR_NETWORK_QDISC));
+		talloc_free(network);
+		network = NULL;
+		return OCSIM_ERROR;
+	}
+
+	ifb = configuration_get_var(ctx, OCSIM_VAR_NETWORK_IFB);
+	if (ifb && openchangesim_network_up(ifb) == OCSIM_SUCCESS) {
+		strncpy(network->ifb, ifb, sizeof (network->ifb) - 1);
+	}
+
+	/* Replace the default or explicitly given qdiscs of the interfaces */
+	openchangesim_network_cleanup(network->device);
+	openchangesim_journal_record(OCSIM_JOURNAL_QDISC, network->device, NULL);
+	if (network->ifb[0]) {
+		openchangesim_network_cleanup(network->ifb);
+		openchangesim_journal_record(OCSIM_JOURNAL_QDISC, network->ifb, NULL);
+	}
+
+	f = popen(OCSIM_NETWORK_TC, "w");
+	if (!f) {
+		perror(OCSIM_NETWORK_TC);
+		talloc_free(network);
+		network = NULL;
+		return OCSIM_ERROR;
+	}
+
+	openchangesim_network_tree(f, mem_ctx, ctx, el, network->device, "src", true);
+	if (network->ifb[0]) {
+		fprintf(f, "qdisc add dev %s handle ffff: ingress\n", network->device);
+		fprintf(f, "filter add dev %s parent ffff: protocol all u32 match u32 0 0 "
+			"action mirred egress redirect dev %s\n", network->device, network->ifb);
+		openchangesim_network_tree(f, mem_ctx, ctx, el, network->ifb, "dst", false);
+	}
+	talloc_free(mem_ctx);
+
+	if (pclose(f)) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, network->device, "Unable to apply network groups"));
+		openchangesim_network_release();
+		return OCSIM_ERROR;
+	}
+
+	snprintf(logstr, sizeof (logstr), "[*] Network groups applied on %s%s%s\n", network->device,
+		 network->ifb[0] ? " and " : "", network->ifb);
+	openchangesim_printlog(stdout, logstr);
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Remove the queueing disciplines set on an interface
+
+   \param ifname the interface name
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_network_cleanup(const char *ifname)
+{
+	FILE	*f;
+
+	if (!ifname) return OCSIM_ERROR;
+
+	f = popen(OCSIM_NETWORK_TC_FORCE, "w");
+	if (!f) {
+		perror(OCSIM_NETWORK_TC_FORCE);
+		return OCSIM_ERROR;
+	}
+
+	/* Errors are expected when no qdisc was set */
+	fprintf(f, "qdisc del dev %s root\n", ifname);
+	fprintf(f, "qdisc del dev %s ingress\n", ifname);
+	pclose(f);
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Remove the network groups applied by
+   openchangesim_network_apply()
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_network_release(void)
+{
+	if (!network) return OCSIM_SUCCESS;
+
+	openchangesim_network_cleanup(network->device);
+	if (network->ifb[0]) {
+		openchangesim_network_cleanup(network->ifb);
+	}
+	talloc_free(network);
+	network = NULL;
+
+	return OCSIM_SUCCESS;
+}
@@ -0,0 +1,296 @@
+/*
+   OpenChangeSim message properties
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_properties.c
+
+   \brief Extra standard and named properties of the sendmail messages
+
+   The properties of a sendmail case are built once by the parent:
+   each one gets a type drawn from the case property_profile and a
+   value of the profile size. Standard properties use consecutive
+   identifiers from OCSIM_PROPERTY_ID_BASE, named properties are
+   string names of the PS_PUBLIC_STRINGS set.
+
+   A client resolves the named properties of a case with a single
+   GetIDsFromNames call on its first message. The mapping is kept by
+   the mailbox, so it stays valid for the life of the client.
+ */
+
+#include <time.h>
+
+#include "src/openchangesim.h"
+
+struct ocsim_property_type
+{
+	const char	*name;
+	uint16_t	type;
+};
+
+static const struct ocsim_property_type	openchangesim_property_types[] = {
+	{ "string",	PT_UNICODE },
+	{ "long",	PT_LONG },
+	{ "boolean",	PT_BOOLEAN },
+	{ "time",	PT_SYSTIME },
+	{ "double",	PT_DOUBLE },
+	{ "binary",	PT_BINARY },
+	{ NULL,		0 }
+};
+
+#define	OCSIM_PROPERTY_TYPES	(sizeof (openchangesim_property_types) / sizeof (struct ocsim_property_type) - 1)
+
+struct ocsim_property_entry
+{
+	uint16_t	type;
+	uint32_t	weight;		/* cumulative */
+	uint32_t	min;
+	uint32_t	max;
+};
+
+
+static uint32_t openchangesim_properties_profile(const char *profile, struct ocsim_property_entry *entries)
+{
+	const char	*p = profile;
+	char		*end;
+	uint32_t	count = 0;
+	uint32_t	total = 0;
+	uint32_t	weight;
+	size_t		len;
+	uint32_t	i;
+
+	while (*p) {
+		p += strspn(p, " \t,");
+		if (!*p) break;
+		if (count == OCSIM_PROPERTY_TYPES) return 0;
+
+		for (i = 0; openchangesim_property_types[i].name; i++) {
+			len = strlen(openchangesim_property_types[i].name);
+			if (!strncasecmp(p, openchangesim_property_types[i].name, len) && p[len] == ':') break;
+		}
+		if (!openchangesim_property_types[i].name) return 0;
+		p += strlen(openchangesim_property_types[i].name) + 1;
+
+		weight = strtoul(p, &end, 10);
+		if (end == p || !weight) return 0;
+		p = end;
+
+		entries[count].type = openchangesim_property_types[i].type;
+		entries[count].min = 16;
+		entries[count].max = 16;
+		if (*p == ':') {
+			entries[count].min = strtoul(p + 1, &end, 10);
+			if (end == p + 1) return 0;
+			entries[count].max = entries[count].min;
+			if (*end == '-') {
+				p = end + 1;
+				entries[count].max = strtoul(p, &end, 10);
+				if (end == p) return 0;
+			}
+			p = end;
+			if (entries[count].max < entries[count].min ||
+			    entries[count].max > OCSIM_PROPERTY_MAX_SIZE) return 0;
+		}
+		if (*p && *p != ',' && *p != ' ' && *p != '\t') return 0;
+
+		total += weight;
+		entries[count++].weight = total;
+	}
+
+	return count;
+}
+
+
+static bool openchangesim_properties_value(TALLOC_CTX *mem_ctx, struct SPropValue *prop,
+					   struct ocsim_property_entry *entry)
+{
+	uint64_t	r;
+	uint32_t	len;
+	uint32_t	i;
+	char		*str;
+	uint8_t		*bin;
+
+	len = entry->min;
+	if (entry->max > entry->min) {
+		len += openchangesim_generator_random() % (entry->max - entry->min + 1);
+	}
+
+	switch (entry->type) {
+	case PT_UNICODE:
+		str = talloc_array(mem_ctx, char, len + 1);
+		if (!str) return false;
+		for (i = 0; i < len; i++) {
+			r = openchangesim_generator_random() % 27;
+			str[i] = r ? 'a' + r - 1 : ' ';
+		}
+		str[len] = '\0';
+		prop->value.lpszW = str;
+		break;
+	case PT_LONG:
+		prop->value.l = (uint32_t) openchangesim_generator_random();
+		break;
+	case PT_BOOLEAN:
+		prop->value.b = (uint8_t) (openchangesim_generator_random() & 1);
+		break;
+	case PT_SYSTIME:
+		/* Within the last year, in 100ns intervals since 1601 */
+		r = (uint64_t) time(NULL) - openchangesim_generator_random() % (365 * 86400);
+		r = (r + 11644473600ULL) * 10000000;
+		prop->value.ft.dwLowDateTime = r & 0xFFFFFFFF;
+		prop->value.ft.dwHighDateTime = r >> 32;
+		break;
+	case PT_DOUBLE:
+		prop->value.dbl = (openchangesim_generator_random() >> 11) * (1.0 / 9007199254740992.0);
+		break;
+	case PT_BINARY:
+		bin = talloc_array(mem_ctx, uint8_t, len ? len : 1);
+		if (!bin) return false;
+		for (i = 0; i < len; i++) {
+			bin[i] = openchangesim_generator_random() & 0xFF;
+		}
+		prop->value.bin.cb = len;
+		prop->value.bin.lpb = bin;
+		break;
+	}
+
+	return true;
+}
+
+
+/**
+   \details Build the extra properties of a sendmail case
+
+   \param mem_ctx pointer to the memory context
+   \param count the number of standard properties
+   \param named_count the number of named properties
+   \param profile the property profile, NULL for the default one
+
+   \return allocated property set on success, otherwise NULL
+ */
+struct ocsim_property_set *openchangesim_properties_build(TALLOC_CTX *mem_ctx, uint32_t count,
+							  uint32_t named_count, const char *profile)
+{
+	struct ocsim_property_set	*set;
+	struct ocsim_property_entry	entries[OCSIM_PROPERTY_TYPES];
+	struct ocsim_property_entry	*entry;
+	struct SPropValue		*prop;
+	uint32_t			nentries;
+	uint32_t			r;
+	uint32_t			i;
+	uint32_t			j;
+
+	if (!profile) {
+		profile = OCSIM_PROPERTY_DFLT_PROFILE;
+	}
+
+	nentries = openchangesim_properties_profile(profile, entries);
+	if (!nentries) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, profile, DEBUG_ERR_PROPERTY_PROFILE));
+		return NULL;
+	}
+
+	set = talloc_zero(mem_ctx, struct ocsim_property_set);
+	if (!set) return NULL;
+	set->count = count;
+	set->named_count = named_count;
+	set->props = talloc_zero_array(set, struct SPropValue, count + named_count + 1);
+	set->names = talloc_zero_array(set, const char *, named_count + 1);
+	if (!set->props || !set->names) goto error;
+
+	for (i = 0; i < count + named_count; i++) {
+		r = openchangesim_generator_random() % entries[nentries - 1].weight;
+		for (j = 0; entries[j].weight <= r; j++);
+		entry = &entries[j];
+
+		prop = &set->props[i];
+		if (i < count) {
+			prop->ulPropTag = ((OCSIM_PROPERTY_ID_BASE + i) << 16) | entry->type;
+		} else {
+			/* The identifier is set by openchangesim_properties_resolve() */
+			prop->ulPropTag = entry->type;
+			set->names[i - count] = talloc_asprintf(set->names, OCSIM_PROPERTY_NAME,
+								entry->type, i - count);
+			if (!set->names[i - count]) goto error;
+		}
+		if (!openchangesim_properties_value(set, prop, entry)) goto error;
+	}
+
+	return set;
+
+error:
+	talloc_free(set);
+	return NULL;
+}
+
+
+/**
+   \details Resolve the named properties of a property set on the
+   client mailbox, creating them if needed
+
+   Only the first call does a GetIDsFromNames round trip.
+
+   \param log pointer to the current operation log, NULL if none
+   \param session pointer to the MAPI session
+   \param set pointer to the property set
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+enum MAPISTATUS openchangesim_properties_resolve(struct ocsim_log *log,
+						 struct mapi_session *session,
+						 struct ocsim_property_set *set)
+{
+	enum MAPISTATUS		retval;
+	mapi_object_t		*obj_store;
+	struct mapi_nameid	*nameid;
+	struct SPropTagArray	*SPropTagArray = NULL;
+	struct SPropValue	*prop;
+	uint32_t		i;
+
+	if (!set || !set->named_count || set->resolved) return MAPI_E_SUCCESS;
+
+	retval = openchangesim_session_store(log, session, &obj_store);
+	if (retval != MAPI_E_SUCCESS) return retval;
+
+	nameid = mapi_nameid_new(set);
+	OPENCHANGE_RETVAL_IF(!nameid, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+	for (i = 0; i < set->named_count; i++) {
+		prop = &set->props[set->count + i];
+		retval = mapi_nameid_custom_string_add(nameid, set->names[i], prop->ulPropTag & 0xFFFF,
+						       PS_PUBLIC_STRINGS);
+		OPENCHANGE_RETVAL_IF(retval, retval, nameid);
+	}
+
+	OCSIM_LOG_CALL(log, retval, GetIDsFromNames, (obj_store, nameid->count, nameid->nameid,
+						      MAPI_CREATE, &SPropTagArray));
+	talloc_free(nameid);
+	if (retval != MAPI_E_SUCCESS) return retval;
+	OPENCHANGE_RETVAL_IF(!SPropTagArray || SPropTagArray->cValues != set->named_count,
+			     MAPI_E_NOT_FOUND, SPropTagArray);
+
+	for (i = 0; i < set->named_count; i++) {
+		OPENCHANGE_RETVAL_IF(!(SPropTagArray->aulPropTag[i] & 0xFFFF0000), MAPI_E_NOT_FOUND, SPropTagArray);
+		prop = &set->props[set->count + i];
+		prop->ulPropTag = (SPropTagArray->aulPropTag[i] & 0xFFFF0000) | (prop->ulPropTag & 0xFFFF);
+	}
+	MAPIFreeBuffer(SPropTagArray);
+	set->resolved = true;
+
+	return MAPI_E_SUCCESS;
+}
@@ -0,0 +1,288 @@
+/*
+   OpenChangeSim recipients selection
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_recipients.c
+
+   \brief Recipients of the sendmail messages
+
+   A sendmail case addresses its messages to the sending user (self),
+   or to recipient_count distinct users of the server drawn uniformly
+   or along a Zipf distribution, the first users of the range being
+   the most popular mailboxes. The distribution_list names of the case
+   are added to every message.
+
+   The recipients of a message are resolved with a single ResolveNames
+   call. The Zipf cumulative weights are computed once by the parent
+   for the server population.
+ */
+
+#include <math.h>
+
+#include "src/openchangesim.h"
+
+struct ocsim_recipients
+{
+	uint32_t	range_start;
+	uint32_t	count;
+	char		*generic_user;
+};
+
+static struct ocsim_recipients	*population = NULL;
+
+
+/**
+   \details Set the users recipients are drawn from
+
+   Must be called by the parent before forking, once the server user
+   range is known.
+
+   \param ctx pointer to the OpenChangeSim context
+   \param el pointer to the server the clients run on
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_recipients_init(struct ocsim_context *ctx, struct ocsim_server *el)
+{
+	struct ocsim_scenario		*scenario;
+	struct ocsim_scenario_case	*scase;
+	struct ocsim_scenario_sendmail	*sendmail;
+	double				total;
+	uint32_t			i;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+	OCSIM_RETVAL_IF(!el, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	talloc_free(population);
+	population = talloc_zero(ctx->mem_ctx, struct ocsim_recipients);
+	OCSIM_RETVAL_IF(!population, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+
+	population->range_start = el->range_start;
+	population->count = el->range_end - el->range_start;
+	population->generic_user = talloc_strdup(population, el->generic_user);
+
+	for (scenario = ctx->scenarios; scenario; scenario = scenario->next) {
+		if (!scenario->name || strcasecmp(scenario->name, SENDMAIL_MODULE_NAME)) continue;
+
+		for (scase = scenario->cases; scase; scase = scase->next) {
+			sendmail = (struct ocsim_scenario_sendmail *) scase->private_data;
+			if (!sendmail) continue;
+
+			talloc_free(sendmail->zipf_weights);
+			sendmail->zipf_weights = NULL;
+			if (sendmail->recipient_policy != OCSIM_RECIPIENT_ZIPF || !population->count) continue;
+
+			sendmail->zipf_weights = talloc_array(sendmail, double, population->count);
+			OCSIM_RETVAL_IF(!sendmail->zipf_weights, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+			for (i = 0, total = 0; i < population->count; i++) {
+				total += 1.0 / pow(i + 1, sendmail->zipf_exponent);
+				sendmail->zipf_weights[i] = total;
+			}
+		}
+	}
+
+	return OCSIM_SUCCESS;
+}
+
+
+static uint32_t openchangesim_recipients_draw(struct ocsim_scenario_sendmail *sendmail)
+{
+	double		r;
+	uint32_t	low;
+	uint32_t	high;
+	uint32_t	mid;
+
+	if (sendmail->recipient_policy != OCSIM_RECIPIENT_ZIPF || !sendmail->zipf_weights) {
+		return openchangesim_generator_random() % population->count;
+	}
+
+	r = (openchangesim_generator_random() >> 11) * (1.0 / 9007199254740992.0) *
+		sendmail->zipf_weights[population->count - 1];
+	for (low = 0, high = population->count - 1; low < high;) {
+		mid = (low + high) / 2;
+		if (sendmail->zipf_weights[mid] > r) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+
+	return low;
+}
+
+
+/**
+   \details Resolve a list of names in a single ResolveNames call
+
+   Unresolved names are skipped. The resolved rows are set as MAPI_TO
+   recipients, ready to be passed to ModifyRecipients().
+
+   \param mem_ctx pointer to the memory context
+   \param log pointer to the current operation log, NULL if none
+   \param session pointer to the MAPI session
+   \param names NULL terminated list of names
+   \param rowset pointer on pointer to the row set allocated on mem_ctx
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+enum MAPISTATUS openchangesim_recipients_resolve(TALLOC_CTX *mem_ctx,
+						 struct ocsim_log *log,
+						 struct mapi_session *session,
+						 const char **names,
+						 struct SRowSet **rowset)
+{
+	enum MAPISTATUS			retval;
+	static struct SPropTagArray	*SPropTagArray = NULL;
+	struct PropertyRowSet_r		*RowSet = NULL;
+	struct PropertyTagArray_r	*flaglist = NULL;
+	struct SPropValue		SPropValue;
+	struct SRowSet			*SRowSet;
+	uint32_t			i;
+
+	OPENCHANGE_RETVAL_IF(!session || !names || !names[0] || !rowset, MAPI_E_INVALID_PARAMETER, NULL);
+
+	/* The columns never change, build them once per process */
+	if (!SPropTagArray) {
+		SPropTagArray = set_SPropTagArray(NULL, 0xA,
+						  PR_ENTRYID,
+						  PR_DISPLAY_NAME_UNICODE,
+						  PR_OBJECT_TYPE,
+						  PR_DISPLAY_TYPE,
+						  PR_TRANSMITTABLE_DISPLAY_NAME_UNICODE,
+						  PR_EMAIL_ADDRESS_UNICODE,
+						  PR_ADDRTYPE_UNICODE,
+						  PR_SEND_RICH_INFO,
+						  PR_7BIT_DISPLAY_NAME_UNICODE,
+						  PR_SMTP_ADDRESS_UNICODE);
+		OPENCHANGE_RETVAL_IF(!SPropTagArray, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+	}
+
+	OCSIM_LOG_CALL(log, retval, ResolveNames, (session, names, SPropTagArray,
+						   &RowSet, &flaglist, MAPI_UNICODE));
+	MAPIFreeBuffer(flaglist);
+	if (retval != MAPI_E_SUCCESS) return retval;
+	OPENCHANGE_RETVAL_IF(!RowSet || !RowSet->cRows, MAPI_E_NOT_FOUND, RowSet);
+
+	SRowSet = talloc_zero(mem_ctx, struct SRowSet);
+	OPENCHANGE_RETVAL_IF(!SRowSet, MAPI_E_NOT_ENOUGH_MEMORY, RowSet);
+	cast_PropertyRowSet_to_SRowSet(SRowSet, RowSet, SRowSet);
+	MAPIFreeBuffer(RowSet);
+
+	for (i = 0; i < SRowSet->cRows; i++) {
+		SetRecipientType(&(SRowSet->aRow[i]), MAPI_TO);
+	}
+	SPropValue.ulPropTag = PR_SEND_INTERNET_ENCODING;
+	SPropValue.value.l = 0;
+	SRowSet_propcpy(SRowSet, SRowSet, SPropValue);
+
+	*rowset = SRowSet;
+	return MAPI_E_SUCCESS;
+}
+
+
+/**
+   \details Select and resolve the recipients of the next message of
+   a sendmail case
+
+   Self only recipients return the row cached for the session,
+   otherwise the row set is allocated on mem_ctx.
+
+   \param mem_ctx pointer to the memory context
+   \param log pointer to the current operation log, NULL if none
+   \param session pointer to the MAPI session
+   \param sendmail pointer to the sendmail case
+   \param rowset pointer on pointer to the recipients row set
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+enum MAPISTATUS openchangesim_recipients_select(TALLOC_CTX *mem_ctx,
+						struct ocsim_log *log,
+						struct mapi_session *session,
+						struct ocsim_scenario_sendmail *sendmail,
+						struct SRowSet **rowset)
+{
+	enum MAPISTATUS		retval;
+	const char		**names;
+	const char		*username;
+	uint32_t		*drawn;
+	uint32_t		count = 0;
+	uint32_t		wanted = 0;
+	uint32_t		attempts;
+	uint32_t		index;
+	uint32_t		i;
+	uint32_t		j;
+
+	OPENCHANGE_RETVAL_IF(!session || !sendmail || !rowset, MAPI_E_INVALID_PARAMETER, NULL);
+
+	if (sendmail->recipient_policy != OCSIM_RECIPIENT_SELF && population && population->count) {
+		wanted = sendmail->recipient_count;
+		if (wanted > population->count) {
+			wanted = population->count;
+		}
+	}
+
+	if (!wanted && !sendmail->list_count) {
+		return openchangesim_session_self(log, session, rowset);
+	}
+
+	names = talloc_zero_array(mem_ctx, const char *, wanted + sendmail->list_count + 2);
+	drawn = talloc_zero_array(mem_ctx, uint32_t, wanted + 1);
+	OPENCHANGE_RETVAL_IF(!names || !drawn, MAPI_E_NOT_ENOUGH_MEMORY, names);
+
+	if (!wanted) {
+		names[count++] = session->profile->mailbox;
+	}
+
+	/* Distinct users, a few extra draws absorb the collisions */
+	for (i = 0, attempts = 0; i < wanted && attempts < wanted * 4; attempts++) {
+		index = openchangesim_recipients_draw(sendmail);
+		for (j = 0; j < i && drawn[j] != index; j++);
+		if (j < i) continue;
+		drawn[i++] = index;
+
+		index += population->range_start;
+		if (openchangesim_roster_enabled()) {
+			username = openchangesim_roster_get(index, OCSIM_ROSTER_USERNAME);
+			if (!username) continue;
+			names[count++] = talloc_strdup(names, username);
+		} else {
+			names[count++] = talloc_asprintf(names, PROFNAME_USER, population->generic_user, index);
+		}
+	}
+
+	for (i = 0; i < sendmail->list_count; i++) {
+		names[count++] = sendmail->lists[i];
+	}
+	names[count] = NULL;
+
+	if (!count) {
+		talloc_free(drawn);
+		talloc_free(names);
+		return openchangesim_session_self(log, session, rowset);
+	}
+
+	retval = openchangesim_recipients_resolve(mem_ctx, log, session, names, rowset);
+	talloc_free(drawn);
+	talloc_free(names);
+
+	return retval;
+}
@@ -0,0 +1,391 @@
+/*
+   OpenChangeSim user roster
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_roster.c
+
+   \brief Users read from a CSV file instead of the generic user
+   pattern
+
+   The users_file server parameter points to a CSV file with one user
+   per line:
+
+   username,password,mailbox,source address,group
+
+   Only the username is mandatory. An empty password falls back on the
+   reference profile one, an empty mailbox is derived from the
+   reference profile mailbox DN, users without a source address are
+   assigned the next address of ip_range and the group selects the
+   network block of the same name. Fields may be double quoted, blank
+   lines, lines starting with # and a leading "username,..." header
+   are ignored.
+
+   The parent only keeps the offset of each line: the first user of the
+   file is the reference profile, the other users are synthetic
+   profiles whose line is read and parsed by the client the user is
+   assigned to, line N of the file being user range_start + N.
+ */
+
+#include <fcntl.h>
+
+#include "src/openchangesim.h"
+
+struct ocsim_roster
+{
+	int		fd;
+	uint64_t	*offsets;
+	uint32_t	count;
+	uint32_t	range_start;
+	uint32_t	addresses;
+	uint32_t	allocated;
+	/* last parsed user */
+	bool		parsed;
+	uint32_t	index;
+	char		line[OCSIM_ROSTER_LINE];
+	char		*fields[OCSIM_ROSTER_FIELDS];
+};
+
+static struct ocsim_roster	*roster = NULL;
+
+
+/**
+   \details Split a CSV line in place
+
+   Empty fields are set to NULL.
+ */
+static void openchangesim_roster_parse(char *line, char **fields)
+{
+	char		*src = line;
+	char		*dst = line;
+	char		*end;
+	char		*keep;
+	char		c;
+	bool		quoted;
+	uint32_t	n;
+
+	line[strcspn(line, "\r\n")] = '\0';
+	memset(fields, 0, sizeof (char *) * OCSIM_ROSTER_FIELDS);
+
+	for (n = 0; n < OCSIM_ROSTER_FIELDS; n++) {
+		src += strspn(src, " \t");
+		fields[n] = keep = dst;
+		quoted = false;
+
+		while (*src && (quoted || *src != ',')) {
+			if (*src == '"') {
+				if (quoted && src[1] == '"') {
+					*dst++ = '"';
+					src += 2;
+					continue;
+				}
+				quoted = !quoted;
+				src++;
+				keep = dst;
+				continue;
+			}
+			*dst++ = *src++;
+		}
+
+		/* Trim the spaces following the value, not those quoted */
+		for (end = dst; end > keep && (end[-1] == ' ' || end[-1] == '\t'); end--);
+		c = *src;
+		*end = '\0';
+		if (!*fields[n]) {
+			fields[n] = NULL;
+		}
+
+		if (c != ',') break;
+		src++;
+		dst = end + 1;
+	}
+}
+
+
+/**
+   \details Check whether the users are read from a roster
+
+   \return true if a roster is loaded, otherwise false
+ */
+bool openchangesim_roster_enabled(void)
+{
+	return roster != NULL;
+}
+
+
+/**
+   \details Index the users_file of a server
+
+   Must be called by the parent before the profile operations. The
+   server user range is set to the users of the file, or to the first
+   users of the file if a generic_user_range is also configured.
+
+   \param ctx pointer to the OpenChangeSim context
+   \param server the server name
+
+   \return OCSIM_SUCCESS on success or if the server has no users_file,
+   otherwise OCSIM_ERROR
+ */
+int openchangesim_roster_init(struct ocsim_context *ctx, const char *server)
+{
+	struct ocsim_server	*el;
+	FILE			*f;
+	char			line[OCSIM_ROSTER_LINE];
+	char			*fields[OCSIM_ROSTER_FIELDS];
+	char			logstr[256];
+	uint64_t		*offsets;
+	uint64_t		offset = 0;
+	uint64_t		start;
+	uint32_t		lineno = 0;
+	uint32_t		limit;
+	uint32_t		size = 0;
+	size_t			len;
+	const char		*p;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+
+	el = configuration_validate_server(ctx, server);
+	if (!el || !el->users_file) return OCSIM_SUCCESS;
+
+	f = fopen(el->users_file, "r");
+	if (!f) {
+		perror(el->users_file);
+		return OCSIM_ERROR;
+	}
+
+	talloc_free(roster);
+	roster = talloc_zero(ctx->mem_ctx, struct ocsim_roster);
+	OCSIM_RETVAL_IF(!roster, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+	roster->fd = -1;
+
+	limit = el->range ? el->range_end - el->range_start : UINT32_MAX;
+	while (roster->count < limit && fgets(line, sizeof (line), f)) {
+		len = strlen(line);
+		start = offset;
+		offset += len;
+		lineno++;
+
+		if (len == sizeof (line) - 1 && line[len - 1] != '\n') {
+			snprintf(logstr, sizeof (logstr), "line %u is too long", lineno);
+			DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, el->users_file, logstr));
+			goto error;
+		}
+
+		p = line + strspn(line, " \t");
+		if (*p == '#' || *p == '\r' || *p == '\n' || !*p) continue;
+
+		openchangesim_roster_parse(line, fields);
+		if (!roster->count && fields[OCSIM_ROSTER_USERNAME] &&
+		    !strcasecmp(fields[OCSIM_ROSTER_USERNAME], OCSIM_ROSTER_HEADER)) {
+			continue;
+		}
+		if (!fields[OCSIM_ROSTER_USERNAME]) {
+			snprintf(logstr, sizeof (logstr), "line %u has no username", lineno);
+			DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, el->users_file, logstr));
+			goto error;
+		}
+
+		if (roster->count == size) {
+			size = size ? size * 2 : 1024;
+			offsets = talloc_realloc(roster, roster->offsets, uint64_t, size);
+			if (!offsets) goto error;
+			roster->offsets = offsets;
+		}
+		roster->offsets[roster->count++] = start;
+		if (!fields[OCSIM_ROSTER_SOURCE_IP]) {
+			roster->addresses++;
+		}
+	}
+	fclose(f);
+	f = NULL;
+
+	if (!roster->count) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, el->users_file, "No user found"));
+		goto error;
+	}
+
+	roster->fd = open(el->users_file, O_RDONLY);
+	if (roster->fd == -1) {
+		perror(el->users_file);
+		goto error;
+	}
+
+	if (!el->range) {
+		el->range = true;
+		el->range_start = 1;
+	}
+	el->range_end = el->range_start + roster->count;
+	roster->range_start = el->range_start;
+
+	snprintf(logstr, sizeof (logstr), "[*] %u users indexed from %s\n", roster->count, el->users_file);
+	openchangesim_printlog(stdout, logstr);
+
+	return OCSIM_SUCCESS;
+
+error:
+	if (f) fclose(f);
+	talloc_free(roster);
+	roster = NULL;
+	return OCSIM_ERROR;
+}
+
+
+/**
+   \details Retrieve the number of roster users without a source
+   address, which are assigned one from the server ip_range
+
+   \return the number of addresses needed from the IP range
+ */
+uint32_t openchangesim_roster_addresses(void)
+{
+	return roster ? roster->addresses : 0;
+}
+
+
+/**
+   \details Retrieve a field of a roster user
+
+   The line of the user is read and parsed on first use. The returned
+   string is only valid until a different user is requested.
+
+   \param index the user index in the range
+   \param field the field to retrieve
+
+   \return the field value, NULL if empty or if the user doesn't exist
+ */
+const char *openchangesim_roster_get(uint32_t index, enum ocsim_roster_field field)
+{
+	ssize_t		n;
+	char		*p;
+
+	if (!roster || field >= OCSIM_ROSTER_FIELDS) return NULL;
+	if (index < roster->range_start || index - roster->range_start >= roster->count) return NULL;
+
+	if (!roster->parsed || roster->index != index) {
+		roster->parsed = false;
+		n = pread(roster->fd, roster->line, sizeof (roster->line) - 1,
+			  roster->offsets[index - roster->range_start]);
+		if (n <= 0) return NULL;
+		roster->line[n] = '\0';
+		if ((p = strchr(roster->line, '\n'))) {
+			*p = '\0';
+		}
+		openchangesim_roster_parse(roster->line, roster->fields);
+		roster->index = index;
+		roster->parsed = true;
+	}
+
+	return roster->fields[field];
+}
+
+
+/**
+   \details Retrieve the source address of a roster user, assigning
+   the next address of the server IP range when the user has none
+
+   Must be called by the parent once per user, in the user order.
+
+   \param mem_ctx pointer to the memory context
+   \param el pointer to the server element
+   \param index the user index in the range
+
+   \return allocated IP address string on success, otherwise NULL
+ */
+char *openchangesim_roster_ip(TALLOC_CTX *mem_ctx, struct ocsim_server *el, uint32_t index)
+{
+	const char	*ip_address;
+
+	if (!roster || !el) return NULL;
+
+	ip_address = openchangesim_roster_get(index, OCSIM_ROSTER_SOURCE_IP);
+	if (ip_address) {
+		return talloc_strdup(mem_ctx, ip_address);
+	}
+
+	openchangesim_interface_get_next_ip(el, roster->allocated++ == 0);
+	return openchangesim_interface_get_ip(mem_ctx, el, el->ip_used);
+}
+
+
+/**
+   \details Retrieve the source addresses of the roster users
+   belonging to a network group, either through their group field or
+   through the users range of the group
+
+   \param mem_ctx pointer to the memory context
+   \param el pointer to the server element
+   \param net pointer to the network group
+
+   \return NULL terminated array of host prefixes, NULL if no user
+   belongs to the group
+ */
+char **openchangesim_roster_prefixes(TALLOC_CTX *mem_ctx, struct ocsim_server *el, struct ocsim_network *net)
+{
+	char		**prefixes = NULL;
+	char		buf[INET6_ADDRSTRLEN];
+	const char	*ip_address;
+	const char	*group;
+	uint32_t	allocated = 0;
+	uint32_t	count = 0;
+	uint32_t	index;
+	uint32_t	i;
+	bool		member;
+
+	if (!roster || !el || !net) return NULL;
+
+	for (i = 0; i < roster->count; i++) {
+		index = roster->range_start + i;
+		ip_address = openchangesim_roster_get(index, OCSIM_ROSTER_SOURCE_IP);
+		group = openchangesim_roster_get(index, OCSIM_ROSTER_GROUP);
+		member = (group && !strcmp(group, net->name)) ||
+			(net->range_end && index >= net->range_start && index <= net->range_end);
+
+		/* Replay the address assignment of openchangesim_roster_ip() */
+		if (!ip_address) {
+			if (!configuration_get_ip_at(el->ip_range, allocated++, buf, sizeof (buf))) continue;
+			ip_address = buf;
+		}
+		if (!member) continue;
+
+		prefixes = talloc_realloc(mem_ctx, prefixes, char *, count + 2);
+		if (!prefixes) return NULL;
+		prefixes[count++] = talloc_asprintf(prefixes, "%s/%d", ip_address,
+						    strchr(ip_address, ':') ? 128 : 32);
+		prefixes[count] = NULL;
+	}
+
+	return prefixes;
+}
+
+
+/**
+   \details Release the roster index
+ */
+void openchangesim_roster_release(void)
+{
+	if (!roster) return;
+
+	if (roster->fd != -1) {
+		close(roster->fd);
+	}
+	talloc_free(roster);
+	roster = NULL;
+}
@@ -0,0 +1,217 @@
+/*
+   OpenChangeSim session cache
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_session.c
+
+   \brief Store, default folders and own recipient kept for the life
+   of a session
+
+   Each client runs a single user, so the cache is per process. The
+   message store and the default folders are opened on first use and
+   kept open, and the recipient row of the user's own mailbox is
+   resolved once. The modules (sendmail, fetchmail, cleanup) and
+   transactions share them until the session is released by
+   openchangesim_logoff() or a module invalidates the cache after an
+   error. A client logs on again before each module or transaction,
+   unless session_reuse is set.
+ */
+
+#include "src/openchangesim.h"
+
+struct ocsim_session_folder
+{
+	uint32_t		id;
+	mapi_id_t		fid;
+	mapi_object_t		obj_folder;
+};
+
+struct ocsim_session_cache
+{
+	struct mapi_session		*session;
+	mapi_object_t			obj_store;
+	uint32_t			folder_count;
+	struct ocsim_session_folder	folders[OCSIM_SESSION_FOLDERS];
+	struct SRowSet			*self;
+};
+
+static struct ocsim_session_cache	*cache = NULL;
+
+
+/**
+   \details Retrieve the message store of a session, opening it on
+   first use
+
+   \param log pointer to the current operation log, NULL if none
+   \param session pointer to the MAPI session
+   \param obj_store pointer on pointer to the cached store object
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+enum MAPISTATUS openchangesim_session_store(struct ocsim_log *log,
+					    struct mapi_session *session,
+					    mapi_object_t **obj_store)
+{
+	enum MAPISTATUS		retval;
+
+	OPENCHANGE_RETVAL_IF(!session || !obj_store, MAPI_E_INVALID_PARAMETER, NULL);
+
+	if (cache && cache->session != session) {
+		openchangesim_session_invalidate();
+	}
+
+	if (!cache) {
+		cache = talloc_zero(NULL, struct ocsim_session_cache);
+		OPENCHANGE_RETVAL_IF(!cache, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+
+		mapi_object_init(&cache->obj_store);
+		retval = openchangesim_logon_store(log, session, &cache->obj_store);
+		if (retval != MAPI_E_SUCCESS) {
+			talloc_free(cache);
+			cache = NULL;
+			return retval;
+		}
+		cache->session = session;
+	}
+
+	*obj_store = &cache->obj_store;
+	return MAPI_E_SUCCESS;
+}
+
+
+/**
+   \details Retrieve a default folder of a session, resolving and
+   opening it on first use
+
+   \param log pointer to the current operation log, NULL if none
+   \param session pointer to the MAPI session
+   \param id the default folder (olFolderInbox, olFolderOutbox...)
+   \param fid pointer to the folder identifier to set, NULL if not needed
+   \param obj_folder pointer on pointer to the cached folder object
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+enum MAPISTATUS openchangesim_session_folder(struct ocsim_log *log,
+					     struct mapi_session *session,
+					     uint32_t id, mapi_id_t *fid,
+					     mapi_object_t **obj_folder)
+{
+	enum MAPISTATUS			retval;
+	mapi_object_t			*obj_store;
+	struct ocsim_session_folder	*folder;
+	uint32_t			i;
+
+	OPENCHANGE_RETVAL_IF(!obj_folder, MAPI_E_INVALID_PARAMETER, NULL);
+
+	retval = openchangesim_session_store(log, session, &obj_store);
+	if (retval != MAPI_E_SUCCESS) return retval;
+
+	for (i = 0; i < cache->folder_count; i++) {
+		if (cache->folders[i].id == id) break;
+	}
+
+	folder = &cache->folders[i];
+	if (i == cache->folder_count) {
+		OPENCHANGE_RETVAL_IF(i == OCSIM_SESSION_FOLDERS, MAPI_E_NOT_ENOUGH_RESOURCES, NULL);
+
+		OCSIM_LOG_CALL(log, retval, GetDefaultFolder, (obj_store, &folder->fid, id));
+		if (retval != MAPI_E_SUCCESS) return retval;
+
+		mapi_object_init(&folder->obj_folder);
+		OCSIM_LOG_CALL(log, retval, OpenFolder, (obj_store, folder->fid, &folder->obj_folder));
+		if (retval != MAPI_E_SUCCESS) {
+			mapi_object_release(&folder->obj_folder);
+			return retval;
+		}
+		folder->id = id;
+		cache->folder_count++;
+	}
+
+	if (fid) {
+		*fid = folder->fid;
+	}
+	*obj_folder = &folder->obj_folder;
+
+	return MAPI_E_SUCCESS;
+}
+
+
+/**
+   \details Retrieve the recipient row of the user's own mailbox,
+   resolving it on first use
+
+   The row is set as a MAPI_TO recipient and is ready to be passed to
+   ModifyRecipients(). It belongs to the cache and must not be
+   modified or freed.
+
+   \param log pointer to the current operation log, NULL if none
+   \param session pointer to the MAPI session
+   \param rowset pointer on pointer to the cached recipient row set
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+enum MAPISTATUS openchangesim_session_self(struct ocsim_log *log,
+					   struct mapi_session *session,
+					   struct SRowSet **rowset)
+{
+	enum MAPISTATUS		retval;
+	mapi_object_t		*obj_store;
+	const char		*username[2];
+
+	OPENCHANGE_RETVAL_IF(!rowset, MAPI_E_INVALID_PARAMETER, NULL);
+
+	retval = openchangesim_session_store(log, session, &obj_store);
+	if (retval != MAPI_E_SUCCESS) return retval;
+
+	if (!cache->self) {
+		username[0] = session->profile->mailbox;
+		username[1] = NULL;
+
+		retval = openchangesim_recipients_resolve(cache, log, session, username, &cache->self);
+		if (retval != MAPI_E_SUCCESS) return retval;
+	}
+
+	*rowset = cache->self;
+	return MAPI_E_SUCCESS;
+}
+
+
+/**
+   \details Release the cached objects of the current session
+
+   Must be called when an operation on a cached object failed, and
+   before the session is logged on again or freed.
+ */
+void openchangesim_session_invalidate(void)
+{
+	uint32_t	i;
+
+	if (!cache) return;
+
+	for (i = 0; i < cache->folder_count; i++) {
+		mapi_object_release(&cache->folders[i].obj_folder);
+	}
+	Logoff(&cache->obj_store);
+	mapi_object_release(&cache->obj_store);
+
+	talloc_free(cache);
+	cache = NULL;
+}
@@ -0,0 +1,374 @@
+/*
+   OpenChangeSim compiled profile snapshot
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_snapshot.c
+
+   \brief Read-only snapshot of the user range profiles
+
+   Once the profiles are provisioned, the parent resolves the profile
+   of every user in the range and writes the attributes into a compact
+   file: a header, one fixed size record per user indexed by its
+   position in the range, then a pool of NUL terminated strings
+   referenced by offset. Consecutive identical strings are only
+   stored once.
+
+   The file is mapped read-only before forking, so each client builds
+   its mapi_profile from shared memory and logs on without querying
+   the profile database.
+ */
+
+#include <fcntl.h>
+
+#include "src/openchangesim.h"
+
+struct ocsim_snapshot
+{
+	void				*region;
+	size_t				size;
+	struct ocsim_snapshot_header	*header;
+	struct ocsim_snapshot_profile	*profiles;
+	const char			*strings;
+	struct ocsim_snapshot_profile	*current;
+};
+
+static struct ocsim_snapshot	snapshot = { NULL, 0, NULL, NULL, NULL, NULL };
+
+
+struct ocsim_snapshot_writer
+{
+	char		*strings;
+	uint32_t	size;
+	uint32_t	last[OCSIM_SNAPSHOT_STRINGS];
+};
+
+
+static uint32_t openchangesim_snapshot_add_string(TALLOC_CTX *mem_ctx,
+						  struct ocsim_snapshot_writer *w,
+						  uint32_t field, const char *str)
+{
+	size_t		len;
+	uint32_t	offset;
+
+	if (!str) return OCSIM_SNAPSHOT_NULL;
+
+	/* Most attributes are identical for every user of the range */
+	if (w->last[field] != OCSIM_SNAPSHOT_NULL && !strcmp(w->strings + w->last[field], str)) {
+		return w->last[field];
+	}
+
+	len = strlen(str) + 1;
+	w->strings = talloc_realloc(mem_ctx, w->strings, char, w->size + len);
+	if (!w->strings) return OCSIM_SNAPSHOT_NULL;
+
+	offset = w->size;
+	memcpy(w->strings + offset, str, len);
+	w->size += len;
+
+	w->last[field] = offset;
+
+	return offset;
+}
+
+
+/**
+   \details Resolve the profiles of the server user range and write
+   them into a snapshot file
+
+   \param mapi_ctx pointer to the MAPI context
+   \param ctx pointer to the OpenChangeSim context
+   \param server the server name
+   \param path the snapshot file path
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_snapshot_compile(struct mapi_context *mapi_ctx,
+				   struct ocsim_context *ctx,
+				   const char *server,
+				   const char *path)
+{
+	TALLOC_CTX			*mem_ctx;
+	struct ocsim_server		*el;
+	struct ocsim_snapshot_header	header;
+	struct ocsim_snapshot_profile	*profiles;
+	struct ocsim_snapshot_profile	*rec;
+	struct ocsim_snapshot_writer	w;
+	struct mapi_profile		*profile;
+	enum MAPISTATUS			retval;
+	char				*profname;
+	char				*tmp;
+	uint32_t			count;
+	uint32_t			i;
+	int				fd;
+	int				ret = OCSIM_ERROR;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+	OCSIM_RETVAL_IF(!path, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+
+	el = configuration_validate_server(ctx, server);
+	OCSIM_RETVAL_IF(!el, OCSIM_ERROR, OCSIM_INVALID_SERVER, NULL);
+
+	/* Snapshots only cover user ranges */
+	if (!el->range) return OCSIM_ERROR;
+
+	mem_ctx = talloc_named(NULL, 0, "snapshot");
+	count = el->range_end - el->range_start;
+	profiles = talloc_zero_array(mem_ctx, struct ocsim_snapshot_profile, count);
+	OCSIM_RETVAL_IF(!profiles, OCSIM_ERROR, OCSIM_MEMORY_ERROR, mem_ctx);
+
+	memset(&w, 0, sizeof (struct ocsim_snapshot_writer));
+	for (i = 0; i < OCSIM_SNAPSHOT_STRINGS; i++) {
+		w.last[i] = OCSIM_SNAPSHOT_NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		rec = &profiles[i];
+		profname = talloc_asprintf(mem_ctx, PROFNAME_TEMPLATE_NB, el->name,
+					   el->generic_user, el->range_start + i, el->realm);
+		profile = talloc_zero(mem_ctx, struct mapi_profile);
+		retval = OpenProfile(mapi_ctx, profile, profname, NULL);
+		if (retval != MAPI_E_SUCCESS) {
+			DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, profname, "Profile not found, snapshot not created"));
+			goto end;
+		}
+
+		rec->str[OCSIM_SNAPSHOT_PROFNAME] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_PROFNAME, profname);
+		rec->str[OCSIM_SNAPSHOT_USERNAME] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_USERNAME, profile->username);
+		rec->str[OCSIM_SNAPSHOT_PASSWORD] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_PASSWORD, profile->password);
+		rec->str[OCSIM_SNAPSHOT_MAILBOX] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_MAILBOX, profile->mailbox);
+		rec->str[OCSIM_SNAPSHOT_WORKSTATION] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_WORKSTATION, profile->workstation);
+		rec->str[OCSIM_SNAPSHOT_DOMAIN] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_DOMAIN, profile->domain);
+		rec->str[OCSIM_SNAPSHOT_REALM] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_REALM, profile->realm);
+		rec->str[OCSIM_SNAPSHOT_SERVER] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_SERVER, profile->server);
+		rec->str[OCSIM_SNAPSHOT_HOMEMDB] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_HOMEMDB, profile->homemdb);
+		rec->str[OCSIM_SNAPSHOT_LOCALADDR] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_LOCALADDR, profile->localaddr);
+		rec->str[OCSIM_SNAPSHOT_ORG] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_ORG, profile->org);
+		rec->str[OCSIM_SNAPSHOT_OU] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_OU, profile->ou);
+		rec->str[OCSIM_SNAPSHOT_KERBEROS] = openchangesim_snapshot_add_string(mem_ctx, &w, OCSIM_SNAPSHOT_KERBEROS, profile->kerberos);
+		rec->seal = profile->seal;
+		rec->codepage = profile->codepage;
+		rec->language = profile->language;
+		rec->method = profile->method;
+		rec->exchange_version = profile->exchange_version;
+		talloc_free(profile);
+		talloc_free(profname);
+		if (!w.strings) goto end;
+	}
+
+	memset(&header, 0, sizeof (struct ocsim_snapshot_header));
+	memcpy(header.magic, OCSIM_SNAPSHOT_MAGIC, sizeof (header.magic));
+	header.version = OCSIM_SNAPSHOT_VERSION;
+	header.count = count;
+	header.range_start = el->range_start;
+	header.strings_size = w.size;
+
+	/* Write a temporary file and rename it so readers never see a partial snapshot */
+	tmp = talloc_asprintf(mem_ctx, "%s.tmp", path);
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	if (fd == -1) {
+		perror(tmp);
+		goto end;
+	}
+	if (write(fd, &header, sizeof (header)) != sizeof (header) ||
+	    write(fd, profiles, count * sizeof (*profiles)) != (ssize_t)(count * sizeof (*profiles)) ||
+	    write(fd, w.strings, w.size) != (ssize_t) w.size) {
+		perror(tmp);
+		close(fd);
+		unlink(tmp);
+		goto end;
+	}
+	close(fd);
+
+	if (rename(tmp, path) == -1) {
+		perror(path);
+		unlink(tmp);
+		goto end;
+	}
+	ret = OCSIM_SUCCESS;
+
+end:
+	talloc_free(mem_ctx);
+	return ret;
+}
+
+
+/**
+   \details Map a snapshot file in memory
+
+   Must be called by the parent before forking so the clients share
+   the mapping.
+
+   \param path the snapshot file path
+   \param range_start the first user index the snapshot must cover
+   \param count the number of users the snapshot must cover
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_snapshot_load(const char *path, uint32_t range_start, uint32_t count)
+{
+	struct ocsim_snapshot_header	*header;
+	struct stat			st;
+	void				*region;
+	size_t				expected;
+	int				fd;
+
+	openchangesim_snapshot_release();
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) return OCSIM_ERROR;
+
+	if (fstat(fd, &st) == -1 || st.st_size < sizeof (struct ocsim_snapshot_header)) {
+		close(fd);
+		return OCSIM_ERROR;
+	}
+
+	region = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (region == MAP_FAILED) {
+		perror("mmap");
+		return OCSIM_ERROR;
+	}
+
+	header = (struct ocsim_snapshot_header *) region;
+	if (header->range_start != range_start || header->count != count) {
+		munmap(region, st.st_size);
+		return OCSIM_ERROR;
+	}
+
+	expected = sizeof (struct ocsim_snapshot_header) +
+		(size_t) header->count * sizeof (struct ocsim_snapshot_profile) + header->strings_size;
+	if (memcmp(header->magic, OCSIM_SNAPSHOT_MAGIC, sizeof (header->magic)) ||
+	    header->version != OCSIM_SNAPSHOT_VERSION || expected != (size_t) st.st_size ||
+	    (header->strings_size && ((const char *) region)[st.st_size - 1] != '\0')) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_WARN, "Invalid profile snapshot, ignored"));
+		munmap(region, st.st_size);
+		return OCSIM_ERROR;
+	}
+
+	snapshot.region = region;
+	snapshot.size = st.st_size;
+	snapshot.header = header;
+	snapshot.profiles = (struct ocsim_snapshot_profile *)(header + 1);
+	snapshot.strings = (const char *)(snapshot.profiles + header->count);
+	snapshot.current = NULL;
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Unmap the snapshot
+ */
+void openchangesim_snapshot_release(void)
+{
+	if (!snapshot.region) return;
+
+	munmap(snapshot.region, snapshot.size);
+	memset(&snapshot, 0, sizeof (struct ocsim_snapshot));
+}
+
+
+static const char *openchangesim_snapshot_string(struct ocsim_snapshot_profile *rec, uint32_t field)
+{
+	uint32_t	offset = rec->str[field];
+
+	if (offset == OCSIM_SNAPSHOT_NULL || offset >= snapshot.header->strings_size) return NULL;
+	return snapshot.strings + offset;
+}
+
+
+/**
+   \details Select the snapshot profile used by the current client
+
+   \param index the user index in the range
+   \param profname the expected profile name
+
+   \return true if the profile is available in the snapshot, otherwise
+   false
+ */
+bool openchangesim_snapshot_select(uint32_t index, const char *profname)
+{
+	struct ocsim_snapshot_profile	*rec;
+	const char			*name;
+
+	snapshot.current = NULL;
+	if (!snapshot.header || !profname) return false;
+	if (index < snapshot.header->range_start ||
+	    index - snapshot.header->range_start >= snapshot.header->count) {
+		return false;
+	}
+
+	rec = &snapshot.profiles[index - snapshot.header->range_start];
+	name = openchangesim_snapshot_string(rec, OCSIM_SNAPSHOT_PROFNAME);
+	if (!name || strcmp(name, profname)) return false;
+
+	snapshot.current = rec;
+	return true;
+}
+
+
+static char *openchangesim_snapshot_strdup(TALLOC_CTX *mem_ctx, uint32_t field)
+{
+	const char	*str;
+
+	str = openchangesim_snapshot_string(snapshot.current, field);
+	return str ? talloc_strdup(mem_ctx, str) : NULL;
+}
+
+
+/**
+   \details Fill a MAPI profile from the selected snapshot profile
+
+   \param profile pointer to the profile to fill, strings are
+   allocated on it
+   \param profname the profile name
+
+   \return true if the snapshot holds the profile, otherwise false
+ */
+bool openchangesim_snapshot_fill(struct mapi_profile *profile, const char *profname)
+{
+	const char	*name;
+
+	name = snapshot.current ? openchangesim_snapshot_string(snapshot.current, OCSIM_SNAPSHOT_PROFNAME) : NULL;
+	if (!name || !profname || strcmp(name, profname)) return false;
+
+	profile->profname = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_PROFNAME);
+	profile->username = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_USERNAME);
+	profile->password = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_PASSWORD);
+	profile->mailbox = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_MAILBOX);
+	profile->workstation = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_WORKSTATION);
+	profile->domain = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_DOMAIN);
+	profile->realm = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_REALM);
+	profile->server = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_SERVER);
+	profile->homemdb = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_HOMEMDB);
+	profile->localaddr = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_LOCALADDR);
+	profile->org = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_ORG);
+	profile->ou = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_OU);
+	profile->kerberos = openchangesim_snapshot_strdup(profile, OCSIM_SNAPSHOT_KERBEROS);
+	profile->seal = snapshot.current->seal;
+	profile->codepage = snapshot.current->codepage;
+	profile->language = snapshot.current->language;
+	profile->method = snapshot.current->method;
+	profile->exchange_version = snapshot.current->exchange_version;
+
+	return true;
+}
@@ -0,0 +1,514 @@
+/*
+   OpenChangeSim statistics API
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_stats.c
+
+   \brief Latency histograms shared between the parent and the
+   forked clients
+
+   The statistics region is an anonymous shared mapping created by the
+   parent before it forks. Histograms are registered by name in the
+   parent, then updated atomically by every client. The parent dumps
+   the aggregated results once all clients have completed.
+
+   Latencies are recorded in microseconds into log-linear buckets:
+   values below 8 are exact, then each power of two is split into 8
+   sub-buckets, which bounds the relative error to 12.5%.
+
+   Each histogram also keeps a time series, one slot per stats_interval
+   seconds of the run, counting operations, throttled operations and
+   time spent in backoff.
+
+   Streaming operations also record the bytes transferred and the
+   client CPU time spent, reported as bytes per CPU second.
+ */
+
+#include <time.h>
+
+#include "src/openchangesim.h"
+
+static struct ocsim_stats	*stats = NULL;
+
+
+/**
+   \details Initialize the shared statistics region
+
+   Must be called by the parent before any client is forked.
+
+   \param ctx pointer to the OpenChangeSim context
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_stats_init(struct ocsim_context *ctx)
+{
+	void	*region;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+
+	if (stats) return OCSIM_SUCCESS;
+
+	region = mmap(NULL, sizeof (struct ocsim_stats), PROT_READ|PROT_WRITE,
+		      MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED) {
+		perror("mmap");
+		return OCSIM_ERROR;
+	}
+
+	stats = (struct ocsim_stats *) region;
+	memset(stats, 0, sizeof (struct ocsim_stats));
+	gettimeofday(&stats->tv_start, NULL);
+	stats->interval = configuration_get_var_int(ctx, OCSIM_VAR_STATS_INTERVAL, OCSIM_STATS_DFLT_INTERVAL);
+	if (!stats->interval) {
+		stats->interval = OCSIM_STATS_DFLT_INTERVAL;
+	}
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Release the shared statistics region
+ */
+void openchangesim_stats_release(void)
+{
+	if (!stats) return;
+
+	munmap(stats, sizeof (struct ocsim_stats));
+	stats = NULL;
+}
+
+
+/**
+   \details Mark the beginning of the run time axis
+ */
+void openchangesim_stats_start(void)
+{
+	if (!stats) return;
+
+	gettimeofday(&stats->tv_start, NULL);
+}
+
+
+/**
+   \details Clear the recorded values before another run
+
+   Histograms stay registered so the identifiers the modules hold
+   remain valid.
+
+   \param ctx pointer to the OpenChangeSim context
+ */
+void openchangesim_stats_reset(struct ocsim_context *ctx)
+{
+	struct ocsim_histogram	*histogram;
+	uint32_t		i;
+
+	if (!stats || !ctx) return;
+
+	for (i = 0; i < stats->count; i++) {
+		histogram = &stats->histograms[i];
+		memset((char *) histogram + sizeof (histogram->name), 0,
+		       sizeof (struct ocsim_histogram) - sizeof (histogram->name));
+		histogram->min = UINT64_MAX;
+	}
+
+	stats->interval = configuration_get_var_int(ctx, OCSIM_VAR_STATS_INTERVAL, OCSIM_STATS_DFLT_INTERVAL);
+	if (!stats->interval) {
+		stats->interval = OCSIM_STATS_DFLT_INTERVAL;
+	}
+	gettimeofday(&stats->tv_start, NULL);
+}
+
+
+/**
+   \details Retrieve the time elapsed since the beginning of the run
+
+   \return the elapsed time in microseconds, 0 if statistics are not
+   initialized
+ */
+uint64_t openchangesim_stats_elapsed(void)
+{
+	struct timeval	tv;
+
+	if (!stats) return 0;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)(tv.tv_sec - stats->tv_start.tv_sec) * 1000000 +
+		(tv.tv_usec - stats->tv_start.tv_usec);
+}
+
+
+/**
+   \details Retrieve the identifier of a registered histogram
+
+   \param name the histogram name
+
+   \return histogram identifier on success, otherwise -1
+ */
+int openchangesim_stats_lookup(const char *name)
+{
+	uint32_t	i;
+
+	if (!stats || !name) return -1;
+
+	for (i = 0; i < stats->count; i++) {
+		if (!strcmp(stats->histograms[i].name, name)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+/**
+   \details Register a named histogram
+
+   Must be called by the parent before any client is forked so all
+   processes share the same histogram table.
+
+   \param name the histogram name
+
+   \return histogram identifier on success, otherwise -1
+ */
+int openchangesim_stats_register(const char *name)
+{
+	struct ocsim_histogram	*histogram;
+	int			id;
+
+	if (!stats || !name) return -1;
+
+	id = openchangesim_stats_lookup(name);
+	if (id != -1) return id;
+
+	if (stats->count == OCSIM_STATS_MAX) {
+		DEBUG(0, (DEBUG_FORMAT_STRING_MODULE_ERR, name, "Too many histograms"));
+		return -1;
+	}
+
+	histogram = &stats->histograms[stats->count];
+	strncpy(histogram->name, name, sizeof (histogram->name) - 1);
+	histogram->min = UINT64_MAX;
+
+	return stats->count++;
+}
+
+
+static uint32_t openchangesim_stats_bucket(uint64_t usec)
+{
+	uint32_t	e;
+
+	if (usec < OCSIM_HISTOGRAM_SUB_BUCKETS) return usec;
+
+	e = 63 - __builtin_clzll(usec);
+	return (e - 2) * OCSIM_HISTOGRAM_SUB_BUCKETS +
+		((usec >> (e - 3)) & (OCSIM_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+
+static uint64_t openchangesim_stats_bucket_value(uint32_t bucket)
+{
+	uint32_t	e;
+	uint64_t	sub;
+
+	if (bucket < OCSIM_HISTOGRAM_SUB_BUCKETS) return bucket;
+
+	e = bucket / OCSIM_HISTOGRAM_SUB_BUCKETS + 2;
+	sub = bucket % OCSIM_HISTOGRAM_SUB_BUCKETS;
+
+	/* Upper bound of the bucket */
+	return ((OCSIM_HISTOGRAM_SUB_BUCKETS + sub + 1) << (e - 3)) - 1;
+}
+
+
+static uint32_t openchangesim_stats_slot(void)
+{
+	struct timeval	tv;
+	uint32_t	slot;
+
+	gettimeofday(&tv, NULL);
+	if (tv.tv_sec < stats->tv_start.tv_sec) return 0;
+
+	slot = (tv.tv_sec - stats->tv_start.tv_sec) / stats->interval;
+	return (slot < OCSIM_STATS_SLOTS) ? slot : OCSIM_STATS_SLOTS - 1;
+}
+
+
+/**
+   \details Record a latency into a histogram
+
+   \param id the histogram identifier
+   \param usec the latency in microseconds
+   \param success whether the operation succeeded
+ */
+void openchangesim_stats_record(int id, uint64_t usec, bool success)
+{
+	struct ocsim_histogram	*histogram;
+	uint64_t		cur;
+
+	if (!stats || id < 0 || id >= (int) stats->count) return;
+
+	histogram = &stats->histograms[id];
+
+	__sync_fetch_and_add(&histogram->count, 1);
+	__sync_fetch_and_add(&histogram->sum, usec);
+	__sync_fetch_and_add(&histogram->buckets[openchangesim_stats_bucket(usec)], 1);
+	__sync_fetch_and_add(&histogram->slot_ops[openchangesim_stats_slot()], 1);
+	if (!success) {
+		__sync_fetch_and_add(&histogram->errors, 1);
+	}
+
+	cur = histogram->min;
+	while (usec < cur && !__sync_bool_compare_and_swap(&histogram->min, cur, usec)) {
+		cur = histogram->min;
+	}
+	cur = histogram->max;
+	while (usec > cur && !__sync_bool_compare_and_swap(&histogram->max, cur, usec)) {
+		cur = histogram->max;
+	}
+}
+
+
+/**
+   \details Record the throttling undergone by an operation
+
+   \param id the histogram identifier
+   \param throttled the number of throttled calls of the operation
+   \param usec the time spent in backoff in microseconds
+ */
+void openchangesim_stats_record_throttle(int id, uint32_t throttled, uint64_t usec)
+{
+	struct ocsim_histogram	*histogram;
+	uint32_t		slot;
+
+	if (!stats || id < 0 || id >= (int) stats->count) return;
+	if (!throttled && !usec) return;
+
+	histogram = &stats->histograms[id];
+	slot = openchangesim_stats_slot();
+
+	if (throttled) {
+		__sync_fetch_and_add(&histogram->throttled, 1);
+		__sync_fetch_and_add(&histogram->slot_throttled[slot], 1);
+	}
+	__sync_fetch_and_add(&histogram->throttle_usec, usec);
+	__sync_fetch_and_add(&histogram->slot_throttle_usec[slot], usec);
+}
+
+
+/**
+   \details Record the bytes transferred by an operation and the
+   client CPU time it used
+
+   \param id the histogram identifier
+   \param bytes the number of bytes transferred
+   \param cpu_usec the CPU time in microseconds
+ */
+void openchangesim_stats_record_bytes(int id, uint64_t bytes, uint64_t cpu_usec)
+{
+	struct ocsim_histogram	*histogram;
+
+	if (!stats || id < 0 || id >= (int) stats->count) return;
+
+	histogram = &stats->histograms[id];
+	__sync_fetch_and_add(&histogram->bytes, bytes);
+	__sync_fetch_and_add(&histogram->cpu_usec, cpu_usec);
+}
+
+
+/**
+   \details Record a stream operation: its latency, bytes and CPU time
+   in the named histogram and, during a chunk size sweep, in the
+   histogram of the chunk size
+
+   \param name the histogram name
+   \param chunk the chunk size used
+   \param sweep whether several chunk sizes are compared
+   \param usec the latency in microseconds
+   \param bytes the number of bytes transferred
+   \param cpu_usec the CPU time in microseconds
+   \param success whether the operation succeeded
+ */
+void openchangesim_stats_record_stream(const char *name, uint32_t chunk, bool sweep,
+				       uint64_t usec, uint64_t bytes, uint64_t cpu_usec,
+				       bool success)
+{
+	char	sname[OCSIM_STATS_NAME_LEN];
+	int	id;
+
+	id = openchangesim_stats_lookup(name);
+	openchangesim_stats_record(id, usec, success);
+	openchangesim_stats_record_bytes(id, bytes, cpu_usec);
+
+	if (!sweep) return;
+
+	snprintf(sname, sizeof (sname), OCSIM_STREAM_STATS_NAME, name, chunk);
+	id = openchangesim_stats_lookup(sname);
+	openchangesim_stats_record(id, usec, success);
+	openchangesim_stats_record_bytes(id, bytes, cpu_usec);
+}
+
+
+/**
+   \details Retrieve the CPU time used by the calling process
+
+   \return the CPU time in microseconds
+ */
+uint64_t openchangesim_stats_cpu_usec(void)
+{
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts)) return 0;
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/**
+   \details Record a latency into a histogram identified by its name
+
+   \param name the histogram name
+   \param usec the latency in microseconds
+   \param success whether the operation succeeded
+ */
+void openchangesim_stats_record_name(const char *name, uint64_t usec, bool success)
+{
+	openchangesim_stats_record(openchangesim_stats_lookup(name), usec, success);
+}
+
+
+static uint64_t openchangesim_stats_percentile(struct ocsim_histogram *histogram, double percentile)
+{
+	uint64_t	rank;
+	uint64_t	seen = 0;
+	uint32_t	i;
+
+	if (!histogram->count) return 0;
+
+	rank = (uint64_t)(percentile * histogram->count / 100.0);
+	if (rank >= histogram->count) {
+		rank = histogram->count - 1;
+	}
+
+	for (i = 0; i < OCSIM_HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen > rank) {
+			uint64_t value = openchangesim_stats_bucket_value(i);
+			return (value > histogram->max) ? histogram->max : value;
+		}
+	}
+
+	return histogram->max;
+}
+
+
+/**
+   \details Dump all histograms to stdout and syslog
+
+   Latencies are reported in milliseconds and throughput in operations
+   per second over the elapsed run time, followed by the bytes per
+   second of the run, the sustained bytes per second of a single
+   stream and the bytes per CPU second of the streaming operations.
+   The throttled fraction and backoff time of each time slot are
+   reported to syslog.
+ */
+void openchangesim_stats_dump(void)
+{
+	struct ocsim_histogram	*histogram;
+	struct timeval		tv_now;
+	double			elapsed;
+	uint32_t		i;
+	uint32_t		slot;
+	bool			header;
+
+	if (!stats) return;
+
+	gettimeofday(&tv_now, NULL);
+	elapsed = (tv_now.tv_sec - stats->tv_start.tv_sec) +
+		(tv_now.tv_usec - stats->tv_start.tv_usec) / 1000000.0;
+	if (elapsed <= 0) {
+		elapsed = 1;
+	}
+
+	DEBUG(0, ("%-32s %8s %6s %9s %9s %9s %9s %9s %9s %9s %9s %7s %9s\n", "[ms]", "count", "errors",
+		  "ops/s", "min", "avg", "p50", "p90", "p99", "p99.9", "max", "thr%", "backoff"));
+	for (i = 0; i < stats->count; i++) {
+		histogram = &stats->histograms[i];
+		if (!histogram->count) continue;
+
+		DEBUG(0, ("%-32s %8lld %6lld %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %7.2f %9.2f\n",
+			  histogram->name, (long long) histogram->count,
+			  (long long) histogram->errors, histogram->count / elapsed,
+			  histogram->min / 1000.0,
+			  (double) histogram->sum / histogram->count / 1000.0,
+			  openchangesim_stats_percentile(histogram, 50) / 1000.0,
+			  openchangesim_stats_percentile(histogram, 90) / 1000.0,
+			  openchangesim_stats_percentile(histogram, 99) / 1000.0,
+			  openchangesim_stats_percentile(histogram, 99.9) / 1000.0,
+			  histogram->max / 1000.0,
+			  100.0 * histogram->throttled / histogram->count,
+			  histogram->throttle_usec / 1000.0));
+
+		openchangesim_log_string("stats: %s: count=%lld errors=%lld ops/s=%.2f min=%lld avg=%lld p50=%lld p90=%lld p99=%lld p99.9=%lld max=%lld microseconds",
+					 histogram->name, (long long) histogram->count,
+					 (long long) histogram->errors, histogram->count / elapsed,
+					 (long long) histogram->min,
+					 (long long) (histogram->sum / histogram->count),
+					 (long long) openchangesim_stats_percentile(histogram, 50),
+					 (long long) openchangesim_stats_percentile(histogram, 90),
+					 (long long) openchangesim_stats_percentile(histogram, 99),
+					 (long long) openchangesim_stats_percentile(histogram, 99.9),
+					 (long long) histogram->max);
+
+		for (slot = 0; slot < OCSIM_STATS_SLOTS; slot++) {
+			if (!histogram->slot_ops[slot] && !histogram->slot_throttle_usec[slot]) continue;
+
+			openchangesim_log_string("stats: %s: t=%ds ops=%lld throttled=%lld (%.2f%%) backoff=%lld microseconds",
+						 histogram->name, slot * stats->interval,
+						 (long long) histogram->slot_ops[slot],
+						 (long long) histogram->slot_throttled[slot],
+						 histogram->slot_ops[slot] ?
+						 100.0 * histogram->slot_throttled[slot] / histogram->slot_ops[slot] : 0.0,
+						 (long long) histogram->slot_throttle_usec[slot]);
+		}
+	}
+
+	/* Throughput of the streaming operations */
+	for (i = 0, header = false; i < stats->count; i++) {
+		histogram = &stats->histograms[i];
+		if (!histogram->bytes) continue;
+
+		if (!header) {
+			DEBUG(0, ("\n%-32s %12s %9s %11s %9s %12s\n", "[stream]", "MB", "MB/s",
+				  "MB/s/stream", "CPU s", "MB/CPU s"));
+			header = true;
+		}
+		DEBUG(0, ("%-32s %12.2f %9.2f %11.2f %9.2f %12.2f\n", histogram->name,
+			  histogram->bytes / 1048576.0, histogram->bytes / 1048576.0 / elapsed,
+			  histogram->sum ? histogram->bytes / 1048576.0 / (histogram->sum / 1000000.0) : 0.0,
+			  histogram->cpu_usec / 1000000.0,
+			  histogram->cpu_usec ? histogram->bytes / 1048576.0 / (histogram->cpu_usec / 1000000.0) : 0.0));
+		openchangesim_log_string("stats: %s: bytes=%lld cpu=%lld microseconds",
+					 histogram->name, (long long) histogram->bytes,
+					 (long long) histogram->cpu_usec);
+	}
+}
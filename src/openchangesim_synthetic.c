@@ -0,0 +1,224 @@
+/*
+   OpenChangeSim synthetic profile provider
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_synthetic.c
+
+   \brief Profiles expanded in memory from the reference profile
+
+   When mailboxes are created from a template (same server, same
+   password, generic_user1..N), only the reference profile is stored
+   in the profile database. The profile of every other user is derived
+   from it at logon time: the profile name, username, mailbox DN and
+   source address are substituted, everything else is shared.
+
+   With a users_file, the username, password and mailbox DN of each
+   user are read from the roster instead.
+ */
+
+#include "src/openchangesim.h"
+
+struct ocsim_synthetic
+{
+	struct mapi_profile	*reference;
+	char			*ref_username;
+	const char		*generic_user;
+	uint32_t		range_start;
+	uint32_t		count;
+	char			**ip_addresses;
+	/* client selected profile */
+	uint32_t		index;
+	char			*profname;
+};
+
+static struct ocsim_synthetic	*synthetic = NULL;
+
+
+/**
+   \details Check whether synthetic profiles are enabled
+
+   \param ctx pointer to the OpenChangeSim context
+
+   \return true if enabled, otherwise false
+ */
+bool openchangesim_synthetic_enabled(struct ocsim_context *ctx)
+{
+	return configuration_get_var_int(ctx, OCSIM_VAR_SYNTHETIC_PROFILES, 0) != 0;
+}
+
+
+/**
+   \details Load the reference profile the synthetic profiles are
+   derived from
+
+   Must be called by the parent before forking.
+
+   \param mapi_ctx pointer to the MAPI context
+   \param ctx pointer to the OpenChangeSim context
+   \param el pointer to the server element
+   \param profname the reference profile name
+   \param ip_addresses source address of each user of the range, the
+   array is stolen
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_synthetic_init(struct mapi_context *mapi_ctx,
+				 struct ocsim_context *ctx,
+				 struct ocsim_server *el,
+				 const char *profname,
+				 char **ip_addresses)
+{
+	enum MAPISTATUS		retval;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+	OCSIM_RETVAL_IF(!el, OCSIM_ERROR, OCSIM_INVALID_SERVER, NULL);
+
+	talloc_free(synthetic);
+	synthetic = talloc_zero(ctx->mem_ctx, struct ocsim_synthetic);
+	OCSIM_RETVAL_IF(!synthetic, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+
+	synthetic->reference = talloc_zero(synthetic, struct mapi_profile);
+	OCSIM_RETVAL_IF(!synthetic->reference, OCSIM_ERROR, OCSIM_MEMORY_ERROR, synthetic);
+
+	retval = OpenProfile(mapi_ctx, synthetic->reference, profname, NULL);
+	if (retval != MAPI_E_SUCCESS) {
+		mapi_errstr("OpenProfile", GetLastError());
+		talloc_free(synthetic);
+		synthetic = NULL;
+		return OCSIM_ERROR;
+	}
+
+	if (openchangesim_roster_enabled()) {
+		synthetic->ref_username = talloc_strdup(synthetic, openchangesim_roster_get(el->range_start,
+											     OCSIM_ROSTER_USERNAME));
+	} else {
+		synthetic->ref_username = talloc_asprintf(synthetic, PROFNAME_USER, el->generic_user, el->range_start);
+	}
+	synthetic->generic_user = talloc_strdup(synthetic, el->generic_user);
+	synthetic->range_start = el->range_start;
+	synthetic->count = el->range_end - el->range_start;
+	synthetic->ip_addresses = talloc_steal(synthetic, ip_addresses);
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Select the synthetic profile used by the current client
+
+   \param index the user index in the range
+   \param profname the profile name
+
+   \return true if the profile is synthetic, otherwise false
+ */
+bool openchangesim_synthetic_select(uint32_t index, const char *profname)
+{
+	if (!synthetic || !profname) return false;
+
+	talloc_free(synthetic->profname);
+	synthetic->profname = NULL;
+
+	/* The reference profile lives in the profile database */
+	if (index <= synthetic->range_start || index - synthetic->range_start >= synthetic->count) {
+		return false;
+	}
+
+	synthetic->index = index;
+	synthetic->profname = talloc_strdup(synthetic, profname);
+
+	return true;
+}
+
+
+static char *openchangesim_synthetic_strdup(TALLOC_CTX *mem_ctx, const char *str)
+{
+	return str ? talloc_strdup(mem_ctx, str) : NULL;
+}
+
+
+/**
+   \details Fill a MAPI profile with the selected synthetic profile
+
+   \param profile pointer to the profile to fill, strings are
+   allocated on it
+   \param profname the profile name
+
+   \return true if the profile is synthetic, otherwise false
+ */
+bool openchangesim_synthetic_fill(struct mapi_profile *profile, const char *profname)
+{
+	struct mapi_profile	*ref;
+	const char		*cn;
+	const char		*p;
+	const char		*password = NULL;
+	const char		*mailbox = NULL;
+
+	if (!synthetic || !synthetic->profname || !profname) return false;
+	if (strcmp(synthetic->profname, profname)) return false;
+
+	ref = synthetic->reference;
+	profile->profname = talloc_strdup(profile, profname);
+	if (openchangesim_roster_enabled()) {
+		profile->username = openchangesim_synthetic_strdup(profile, openchangesim_roster_get(synthetic->index,
+												     OCSIM_ROSTER_USERNAME));
+		password = openchangesim_roster_get(synthetic->index, OCSIM_ROSTER_PASSWORD);
+		mailbox = openchangesim_roster_get(synthetic->index, OCSIM_ROSTER_MAILBOX);
+		if (!profile->username) return false;
+	} else {
+		profile->username = talloc_asprintf(profile, PROFNAME_USER, synthetic->generic_user, synthetic->index);
+	}
+	profile->password = openchangesim_synthetic_strdup(profile, password ? password : ref->password);
+	profile->workstation = openchangesim_synthetic_strdup(profile, ref->workstation);
+	profile->domain = openchangesim_synthetic_strdup(profile, ref->domain);
+	profile->realm = openchangesim_synthetic_strdup(profile, ref->realm);
+	profile->server = openchangesim_synthetic_strdup(profile, ref->server);
+	profile->homemdb = openchangesim_synthetic_strdup(profile, ref->homemdb);
+	profile->org = openchangesim_synthetic_strdup(profile, ref->org);
+	profile->ou = openchangesim_synthetic_strdup(profile, ref->ou);
+	profile->kerberos = openchangesim_synthetic_strdup(profile, ref->kerberos);
+	profile->localaddr = openchangesim_synthetic_strdup(profile,
+							    synthetic->ip_addresses[synthetic->index - synthetic->range_start]);
+	profile->seal = ref->seal;
+	profile->codepage = ref->codepage;
+	profile->language = ref->language;
+	profile->method = ref->method;
+	profile->exchange_version = ref->exchange_version;
+
+	/* Substitute the username in the last cn= of the mailbox DN, as DuplicateProfile() does */
+	profile->mailbox = NULL;
+	if (mailbox) {
+		profile->mailbox = talloc_strdup(profile, mailbox);
+	} else if (ref->mailbox) {
+		cn = NULL;
+		for (p = ref->mailbox; (p = strcasestr(p, "/cn=")); p++) {
+			cn = p;
+		}
+		if (cn && !strcasecmp(cn + 4, synthetic->ref_username)) {
+			profile->mailbox = talloc_asprintf(profile, "%.*s/cn=%s", (int)(cn - ref->mailbox),
+							   ref->mailbox, profile->username);
+		} else {
+			profile->mailbox = talloc_strdup(profile, ref->mailbox);
+		}
+	}
+
+	return true;
+}
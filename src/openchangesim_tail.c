@@ -0,0 +1,230 @@
+/*
+   OpenChangeSim tail sampling API
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_tail.c
+
+   \brief Per-process capture of the slowest operations
+
+   Each forked client keeps a bounded reservoir of its N slowest
+   operations and a bounded list of the operations exceeding a
+   configured threshold. Both are dumped to syslog when the client
+   completes its run.
+ */
+
+#include "src/openchangesim.h"
+
+struct ocsim_tail
+{
+	char				*profname;
+	uint32_t			slowest_size;
+	uint32_t			slowest_count;
+	uint32_t			slowest_min;
+	struct ocsim_tail_sample	*slowest;
+	uint64_t			threshold;
+	uint32_t			threshold_size;
+	uint32_t			threshold_count;
+	uint32_t			threshold_dropped;
+	struct ocsim_tail_sample	*over_threshold;
+};
+
+static struct ocsim_tail	*tail = NULL;
+
+
+/**
+   \details Initialize the tail sampler of the current process
+
+   \param ctx pointer to the OpenChangeSim context
+   \param profname the profile name used by the current process
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_tail_init(struct ocsim_context *ctx, const char *profname)
+{
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!ctx, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, NULL);
+
+	talloc_free(tail);
+	tail = talloc_zero(ctx->mem_ctx, struct ocsim_tail);
+	OCSIM_RETVAL_IF(!tail, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+
+	tail->profname = talloc_strdup(tail, profname ? profname : "");
+	tail->slowest_size = configuration_get_var_int(ctx, OCSIM_VAR_TAIL_SIZE, OCSIM_TAIL_DFLT_SIZE);
+	tail->threshold = (uint64_t) configuration_get_var_int(ctx, OCSIM_VAR_TAIL_THRESHOLD, 0) * 1000;
+	tail->threshold_size = configuration_get_var_int(ctx, OCSIM_VAR_TAIL_THRESHOLD_MAX,
+							 OCSIM_TAIL_DFLT_THRESHOLD_MAX);
+	if (!tail->threshold) {
+		tail->threshold_size = 0;
+	}
+
+	if (tail->slowest_size) {
+		tail->slowest = talloc_zero_array(tail, struct ocsim_tail_sample, tail->slowest_size);
+		OCSIM_RETVAL_IF(!tail->slowest, OCSIM_ERROR, OCSIM_MEMORY_ERROR, tail);
+	}
+	if (tail->threshold_size) {
+		tail->over_threshold = talloc_zero_array(tail, struct ocsim_tail_sample, tail->threshold_size);
+		OCSIM_RETVAL_IF(!tail->over_threshold, OCSIM_ERROR, OCSIM_MEMORY_ERROR, tail);
+	}
+
+	return OCSIM_SUCCESS;
+}
+
+
+static void openchangesim_tail_fill(struct ocsim_tail_sample *sample,
+				    struct ocsim_log *log,
+				    uint64_t usec,
+				    const char *scenario,
+				    const char *case_name,
+				    const char *clientIP)
+{
+	sample->usec = usec;
+	strncpy(sample->scenario, scenario ? scenario : "", sizeof (sample->scenario) - 1);
+	sample->scenario[sizeof (sample->scenario) - 1] = '\0';
+	strncpy(sample->case_name, case_name ? case_name : "", sizeof (sample->case_name) - 1);
+	sample->case_name[sizeof (sample->case_name) - 1] = '\0';
+	strncpy(sample->clientIP, clientIP ? clientIP : "", sizeof (sample->clientIP) - 1);
+	sample->clientIP[sizeof (sample->clientIP) - 1] = '\0';
+	memcpy(&sample->log, log, sizeof (struct ocsim_log));
+}
+
+
+/**
+   \details Offer a completed operation to the tail sampler
+
+   The operation is kept if it is slower than the fastest operation
+   currently held in the slowest-N reservoir, and/or if it exceeds
+   the configured threshold.
+
+   \param log pointer to the completed operation log
+   \param usec the operation duration in microseconds
+   \param scenario the scenario name
+   \param case_name the case name if any
+   \param clientIP the source IP address used by the client
+ */
+void openchangesim_tail_add(struct ocsim_log *log,
+			    uint64_t usec,
+			    const char *scenario,
+			    const char *case_name,
+			    const char *clientIP)
+{
+	uint32_t	i;
+
+	if (!tail || !log) return;
+
+	if (tail->slowest_size) {
+		if (tail->slowest_count < tail->slowest_size) {
+			openchangesim_tail_fill(&tail->slowest[tail->slowest_count], log, usec,
+						scenario, case_name, clientIP);
+			tail->slowest_count++;
+		} else if (usec > tail->slowest[tail->slowest_min].usec) {
+			openchangesim_tail_fill(&tail->slowest[tail->slowest_min], log, usec,
+						scenario, case_name, clientIP);
+		} else {
+			goto threshold;
+		}
+
+		/* Keep track of the fastest entry in the reservoir */
+		tail->slowest_min = 0;
+		for (i = 1; i < tail->slowest_count; i++) {
+			if (tail->slowest[i].usec < tail->slowest[tail->slowest_min].usec) {
+				tail->slowest_min = i;
+			}
+		}
+	}
+
+threshold:
+	if (tail->threshold && usec >= tail->threshold) {
+		if (tail->threshold_count < tail->threshold_size) {
+			openchangesim_tail_fill(&tail->over_threshold[tail->threshold_count], log, usec,
+						scenario, case_name, clientIP);
+			tail->threshold_count++;
+		} else {
+			tail->threshold_dropped++;
+		}
+	}
+}
+
+
+static int openchangesim_tail_cmp(const void *a, const void *b)
+{
+	const struct ocsim_tail_sample	*sa = (const struct ocsim_tail_sample *) a;
+	const struct ocsim_tail_sample	*sb = (const struct ocsim_tail_sample *) b;
+
+	if (sa->usec < sb->usec) return 1;
+	if (sa->usec > sb->usec) return -1;
+	return 0;
+}
+
+
+static void openchangesim_tail_dump_sample(const char *kind, uint32_t idx, uint32_t total,
+					   struct ocsim_tail_sample *sample)
+{
+	struct ocsim_log	*log = &sample->log;
+	uint32_t		i;
+
+	openchangesim_log_string("tail: %s %d/%d: %s %s \"%s\" %s: %lld microseconds status=%s calls=%d messages=%d bytes=%lld",
+				 kind, idx + 1, total, tail->profname, sample->clientIP,
+				 sample->case_name, sample->scenario, (long long) sample->usec,
+				 mapi_get_errstr(log->retval), log->call_count + log->call_dropped,
+				 log->msg_count, (long long) log->msg_bytes);
+
+	for (i = 0; i < log->call_count; i++) {
+		openchangesim_log_string("tail: %s %d/%d:   %-24s x%-4d %lld microseconds (max %lld) status=%s",
+					 kind, idx + 1, total, log->calls[i].name, log->calls[i].count,
+					 (long long) log->calls[i].usec, (long long) log->calls[i].max_usec,
+					 mapi_get_errstr(log->calls[i].retval));
+	}
+
+	for (i = 0; i < log->msg_count && i < OCSIM_LOG_MAX_MSGS; i++) {
+		openchangesim_log_string("tail: %s %d/%d:   message 0x%016llx %lld bytes",
+					 kind, idx + 1, total, (unsigned long long) log->msg_id[i],
+					 (long long) log->msg_size[i]);
+	}
+}
+
+
+/**
+   \details Dump the tail samples of the current process to syslog
+ */
+void openchangesim_tail_dump(void)
+{
+	uint32_t	i;
+
+	if (!tail) return;
+
+	qsort(tail->slowest, tail->slowest_count, sizeof (struct ocsim_tail_sample),
+	      openchangesim_tail_cmp);
+	for (i = 0; i < tail->slowest_count; i++) {
+		openchangesim_tail_dump_sample("slowest", i, tail->slowest_count, &tail->slowest[i]);
+	}
+
+	for (i = 0; i < tail->threshold_count; i++) {
+		openchangesim_tail_dump_sample("threshold", i, tail->threshold_count,
+					       &tail->over_threshold[i]);
+	}
+	if (tail->threshold_dropped) {
+		openchangesim_log_string("tail: threshold: %s: %d operations over %lld microseconds not captured",
+					 tail->profname, tail->threshold_dropped, (long long) tail->threshold);
+	}
+
+	talloc_free(tail);
+	tail = NULL;
+}
@@ -0,0 +1,283 @@
+/*
+   OpenChangeSim message templates
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_template.c
+
+   \brief Sendmail cases compiled into message templates
+
+   Every message of a sendmail case carries the same properties, body
+   and attachment names, except the subject and default body built
+   from the sending mailbox. The parent compiles each case once its
+   contents are loaded: property array, body to stream, known sizes
+   and generated attachment names. A client patches the mailbox
+   dependent values and the named property identifiers on its first
+   message, and splits the properties into SetProps requests which fit
+   the request buffer. It then sends every message from the template
+   without building anything.
+ */
+
+#include "src/openchangesim.h"
+
+
+static uint32_t openchangesim_template_prop_size(struct SPropValue *prop)
+{
+	uint32_t	size = sizeof (uint32_t);
+
+	switch (prop->ulPropTag & 0xFFFF) {
+	case PT_BOOLEAN:
+		return size + 1;
+	case PT_LONG:
+		return size + 4;
+	case PT_STRING8:
+		return size + (prop->value.lpszA ? strlen(prop->value.lpszA) : 0) + 1;
+	case PT_UNICODE:
+		/* UTF-16, at most two bytes per UTF-8 byte */
+		return size + 2 * ((prop->value.lpszW ? strlen(prop->value.lpszW) : 0) + 1);
+	case PT_BINARY:
+		return size + sizeof (uint16_t) + prop->value.bin.cb;
+	default:
+		return size + 8;
+	}
+}
+
+
+static bool openchangesim_template_batches(struct ocsim_message_template *template)
+{
+	uint32_t	size = 0;
+	uint32_t	prop_size;
+	uint32_t	i;
+
+	talloc_free(template->batch_start);
+	template->batch_start = talloc_array(template, uint32_t, template->prop_count + 1);
+	if (!template->batch_start) return false;
+
+	template->batch_count = 0;
+	for (i = 0; i < template->prop_count; i++) {
+		prop_size = openchangesim_template_prop_size(&template->props[i]);
+		if (!template->batch_count || size + prop_size > OCSIM_PROPERTY_BATCH_SIZE) {
+			template->batch_start[template->batch_count++] = i;
+			size = 0;
+		}
+		size += prop_size;
+	}
+	template->batch_start[template->batch_count] = template->prop_count;
+
+	return true;
+}
+
+
+/**
+   \details Compile a sendmail case into its message template
+
+   Must be called by the parent once the contents, generators, large
+   attachments and properties of the case are set.
+
+   \param sendmail pointer to the sendmail case
+
+   \return OCSIM_SUCCESS on success, otherwise OCSIM_ERROR
+ */
+int openchangesim_template_compile(struct ocsim_scenario_sendmail *sendmail)
+{
+	struct ocsim_message_template	*template;
+	struct SBinary_short		bin;
+	uint32_t			extra = 0;
+	uint32_t			msgflag;
+	uint32_t			format = EDITOR_FORMAT_PLAINTEXT;
+	uint32_t			n = 0;
+	uint32_t			i;
+
+	/* Sanity checks */
+	OCSIM_RETVAL_IF(!sendmail, OCSIM_ERROR, OCSIM_INVALID_PARAMETER, NULL);
+
+	talloc_free(sendmail->message_template);
+	sendmail->message_template = NULL;
+
+	template = talloc_zero(sendmail, struct ocsim_message_template);
+	OCSIM_RETVAL_IF(!template, OCSIM_ERROR, OCSIM_MEMORY_ERROR, NULL);
+
+	if (sendmail->properties) {
+		extra = sendmail->properties->count + sendmail->properties->named_count;
+	}
+	template->props = talloc_zero_array(template, struct SPropValue, 4 + extra);
+	OCSIM_RETVAL_IF(!template->props, OCSIM_ERROR, OCSIM_MEMORY_ERROR, template);
+
+	/* The subject is set by openchangesim_template_prepare() */
+	template->subject_index = n;
+	template->props[n++].ulPropTag = PR_SUBJECT;
+	msgflag = MSGFLAG_UNSENT|MSGFLAG_FROMME;
+	set_SPropValue_proptag(&template->props[n++], PR_MESSAGE_FLAGS, (const void *)&msgflag);
+	template->body_index = 4 + extra;
+
+	switch (sendmail->body_type) {
+	case OCSIM_BODY_UTF8_INLINE:
+		if (sendmail->body_inline_length > MAX_READ_SIZE) {
+			template->body_tag = PR_BODY_UNICODE;
+			template->body.lpb = (uint8_t *)sendmail->body_inline;
+			template->body.cb = sendmail->body_inline_length;
+		} else {
+			set_SPropValue_proptag(&template->props[n++], PR_BODY_UNICODE,
+					       (const void *)sendmail->body_inline);
+		}
+		template->size += sendmail->body_inline_length;
+		break;
+	case OCSIM_BODY_HTML_INLINE:
+		format = EDITOR_FORMAT_HTML;
+		if (sendmail->body_inline_length > MAX_READ_SIZE) {
+			template->body_tag = PR_HTML;
+			template->body.lpb = (uint8_t *)sendmail->body_inline;
+			template->body.cb = sendmail->body_inline_length;
+		} else {
+			bin.cb = sendmail->body_inline_length;
+			bin.lpb = (uint8_t *)sendmail->body_inline;
+			set_SPropValue_proptag(&template->props[n++], PR_HTML, (const void *)&bin);
+		}
+		template->size += sendmail->body_inline_length;
+		break;
+	case OCSIM_BODY_UTF8_FILE:
+		template->body_tag = PR_BODY;
+		template->body = sendmail->body_content;
+		template->size += sendmail->body_content.cb;
+		break;
+	case OCSIM_BODY_HTML_FILE:
+		format = EDITOR_FORMAT_HTML;
+		template->body_tag = PR_HTML;
+		template->body = sendmail->body_content;
+		template->size += sendmail->body_content.cb;
+		break;
+	case OCSIM_BODY_RTF_FILE:
+		format = EDITOR_FORMAT_RTF;
+		template->body_tag = PR_RTF_COMPRESSED;
+		template->body = sendmail->body_content;
+		template->size += sendmail->body_content.cb;
+		break;
+	case OCSIM_BODY_GENERATED:
+		/* The body itself is generated for every message */
+		OCSIM_RETVAL_IF(!sendmail->gen_body, OCSIM_ERROR, OCSIM_NOT_INITIALIZED, template);
+		if (sendmail->gen_body->content == OCSIM_GENERATOR_HTML) {
+			format = EDITOR_FORMAT_HTML;
+			template->body_tag = PR_HTML;
+		} else {
+			template->body_tag = PR_BODY;
+		}
+		break;
+	case OCSIM_BODY_NONE:
+	default:
+		/* The default body is set by openchangesim_template_prepare() */
+		template->body_index = n;
+		template->props[n++].ulPropTag = PR_BODY;
+		break;
+	}
+
+	set_SPropValue_proptag(&template->props[n++], PR_MSG_EDITOR_FORMAT, (const void *)&format);
+
+	if (extra) {
+		memcpy(&template->props[n], sendmail->properties->props, extra * sizeof (struct SPropValue));
+		template->named_index = n + sendmail->properties->count;
+		n += extra;
+	}
+	template->prop_count = n;
+
+	for (i = 0; i < sendmail->attachment_count && sendmail->attachment_contents; i++) {
+		template->size += sendmail->attachment_contents[i].cb;
+	}
+
+	/* Attachment names */
+	template->generated_names = talloc_zero_array(template, char *, sendmail->generator_count + 1);
+	OCSIM_RETVAL_IF(!template->generated_names, OCSIM_ERROR, OCSIM_MEMORY_ERROR, template);
+	for (i = 0; i < sendmail->generator_count; i++) {
+		template->generated_names[i] = talloc_asprintf(template->generated_names, OCSIM_GENERATOR_FILENAME, i + 1,
+							       openchangesim_generator_extension(sendmail->gen_attachments[i]->content));
+		OCSIM_RETVAL_IF(!template->generated_names[i], OCSIM_ERROR, OCSIM_MEMORY_ERROR, template);
+	}
+
+	template->large_names = talloc_zero_array(template, char *, sendmail->large_count + 1);
+	OCSIM_RETVAL_IF(!template->large_names, OCSIM_ERROR, OCSIM_MEMORY_ERROR, template);
+	for (i = 0; i < sendmail->large_count; i++) {
+		if (sendmail->large_objects[i].path) continue;
+		template->large_names[i] = talloc_asprintf(template->large_names, OCSIM_LARGE_FILENAME, i + 1,
+							   openchangesim_generator_extension(sendmail->large_objects[i].content));
+		OCSIM_RETVAL_IF(!template->large_names[i], OCSIM_ERROR, OCSIM_MEMORY_ERROR, template);
+	}
+
+	sendmail->message_template = template;
+
+	return OCSIM_SUCCESS;
+}
+
+
+/**
+   \details Patch the message template of a sendmail case for the
+   client mailbox
+
+   Sets the subject and default body, resolves the named properties
+   of the case and splits the properties into SetProps requests. Only
+   the first call does any work.
+
+   \param log pointer to the current operation log, NULL if none
+   \param session pointer to the MAPI session
+   \param sendmail pointer to the sendmail case
+
+   \return MAPI_E_SUCCESS on success, otherwise MAPI error
+ */
+enum MAPISTATUS openchangesim_template_prepare(struct ocsim_log *log,
+					       struct mapi_session *session,
+					       struct ocsim_scenario_sendmail *sendmail)
+{
+	enum MAPISTATUS			retval;
+	struct ocsim_message_template	*template;
+	struct ocsim_property_set	*set;
+	char				*subject;
+	char				*body;
+	uint32_t			i;
+
+	OPENCHANGE_RETVAL_IF(!session || !sendmail || !sendmail->message_template,
+			     MAPI_E_INVALID_PARAMETER, NULL);
+
+	template = sendmail->message_template;
+	if (template->prepared) return MAPI_E_SUCCESS;
+
+	set = sendmail->properties;
+	if (set && set->named_count) {
+		retval = openchangesim_properties_resolve(log, session, set);
+		if (retval != MAPI_E_SUCCESS) return retval;
+
+		for (i = 0; i < set->named_count; i++) {
+			template->props[template->named_index + i].ulPropTag = set->props[set->count + i].ulPropTag;
+		}
+	}
+
+	subject = talloc_asprintf(template, "%s Mail from %s\n", DFLT_SUBJECT_PREFIX, session->profile->mailbox);
+	OPENCHANGE_RETVAL_IF(!subject, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+	set_SPropValue_proptag(&template->props[template->subject_index], PR_SUBJECT, (const void *)subject);
+
+	if (template->body_index < template->prop_count) {
+		body = talloc_asprintf(template, "Body of message with subject: %s", subject);
+		OPENCHANGE_RETVAL_IF(!body, MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+		set_SPropValue_proptag(&template->props[template->body_index], PR_BODY, (const void *)body);
+		template->size += strlen(body);
+	}
+
+	OPENCHANGE_RETVAL_IF(!openchangesim_template_batches(template), MAPI_E_NOT_ENOUGH_MEMORY, NULL);
+	template->prepared = true;
+
+	return MAPI_E_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/*
+   OpenChangeSim throttling API
+
+   OpenChange Project
+
+   Copyright (C) Julien Kerihuel 2010
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+   \file openchangesim_throttle.c
+
+   \brief Server busy detection and backoff
+
+   Exchange answers with MAPI_E_BUSY when a client is throttled. It
+   is detected on every MAPI call recorded in the operation log.
+   When a backoff delay is configured, modules retry the throttled
+   operation after an exponentially increasing delay, and the time
+   spent waiting is accounted to the operation.
+ */
+
+#include <time.h>
+
+#include "src/openchangesim.h"
+
+struct ocsim_throttle
+{
+	uint32_t	backoff;
+	uint32_t	backoff_max;
+	uint32_t	retries;
+};
+
+static struct ocsim_throttle	throttle = { 0, OCSIM_THROTTLE_DFLT_BACKOFF_MAX, OCSIM_THROTTLE_DFLT_RETRIES };
+
+
+/**
+   \details Load the backoff policy of the current process from the
+   configuration
+
+   \param ctx pointer to the OpenChangeSim context
+ */
+void openchangesim_throttle_init(struct ocsim_context *ctx)
+{
+	throttle.backoff = configuration_get_var_int(ctx, OCSIM_VAR_THROTTLE_BACKOFF, 0);
+	throttle.backoff_max = configuration_get_var_int(ctx, OCSIM_VAR_THROTTLE_BACKOFF_MAX,
+							 OCSIM_THROTTLE_DFLT_BACKOFF_MAX);
+	throttle.retries = configuration_get_var_int(ctx, OCSIM_VAR_THROTTLE_RETRIES,
+						     OCSIM_THROTTLE_DFLT_RETRIES);
+}
+
+
+/**
+   \details Check whether a MAPI status means the server is
+   throttling the client
+
+   \param retval the MAPI status to check
+
+   \return true if the status is a server busy status, otherwise false
+ */
+bool openchangesim_throttle_check(enum MAPISTATUS retval)
+{
+	switch ((uint32_t)retval) {
+	case MAPI_E_BUSY:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+/**
+   \details Honour the backoff policy after a throttled operation
+
+   If the last attempt of the operation was throttled and retries are
+   left, sleep for the backoff delay, account it to the operation and
+   reset the operation status so it can be retried.
+
+   \param log pointer to the operation log
+   \param attempt the number of attempts already retried
+
+   \return true if the operation should be retried, otherwise false
+ */
+bool openchangesim_throttle_backoff(struct ocsim_log *log, uint32_t attempt)
+{
+	struct timespec	ts;
+	uint64_t	delay;
+
+	if (!log || !log->throttle_pending) return false;
+	log->throttle_pending = false;
+
+	if (!throttle.backoff || attempt >= throttle.retries) return false;
+
+	delay = (uint64_t) throttle.backoff << (attempt < 16 ? attempt : 16);
+	if (delay > throttle.backoff_max) {
+		delay = throttle.backoff_max;
+	}
+
+	/* usleep() is unspecified from one second on */
+	ts.tv_sec = delay / 1000;
+	ts.tv_nsec = (delay % 1000) * 1000000;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+	log->throttle_usec += delay * 1000;
+	log->retval = MAPI_E_SUCCESS;
+
+	return true;
+}